@@ -8,17 +8,47 @@
 #include <netinet/tcp.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <poll.h>
 
-#define SERVER_IP "127.0.0.1"
-#define BUFFER_SIZE 2 * 1024 * 1024
+#include "rudp.h"
+#include "crc64.h"
+
+#define LISTEN_IP "127.0.0.1"          // Address server sockets bind to.
+#define TRANSFER_SIZE (2 * 1024 * 1024) // SO_RCVBUF of server sockets holds two, rudp_receive() reads at most one.
 #define MAX_WAIT_TIME 2
-#define CHUNK_SIZE 1024
-#define SYN 1
-#define SYN_ACK 3
-#define ACK 2
-#define FIN 4
-#define FIN_ACK 6
-#define PUSH 16
+#define STATE_DIR_ENV "RUDP_STATE_DIR"    // Directory of the files below, see rudp_set_state_dir().
+#define TICKET_KEY_FILE ".rudp_ticket_key"
+#define SESSION_CACHE_PREFIX ".rudp_session"
+#define TICKET_LIFETIME 3600
+#define TICKET_USED_SLOTS 4096 // Used tickets a receiver remembers until they expire, see rudp_ticket_claim().
+
+#define RTO_INITIAL_MS 250  // Retransmission timeout before the round trip time is known.
+#define RTO_MIN_MS 20
+#define RTO_MAX_MS 4000     // Longest backoff, well within the timer wheel's horizon.
+#define MAX_RETRIES 5       // Retransmissions of a control packet before the wait gives up.
+#define DELAYED_ACK_MS 20   // Shortest time between two progress ACKs.
+#define COOKIE_PERIOD_MS 8000
+// SYN payload: the file ID, padded so the SYN-ACK (cookie, ticket, timestamp) fits in as many bytes.
+#define SYN_SIZE (2 * sizeof(uint64_t) + sizeof(RUDP_Ticket))
+
+#define CHECKPOINT_MAGIC 0x52554450434b5031ULL // "RUDPCKP1"
+#define CHECKPOINT_INTERVAL 64                 // Chunks received between checkpoint saves.
+#define CHECKPOINT_BLOCK 512                   // Bytes of the checkpoint file a save writes if any of them changed.
+
+// Adds n to a counter of the receiving thread, see RUDP_Counters.
+#define COUNTER_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
 
 /*
 0
@@ -31,363 +61,2613 @@
 0 SYN
 */
 
-unsigned short int calculate_checksum(void *data, unsigned int bytes)
+unsigned short int calculate_checksum(const void *data, unsigned int bytes)
 {
-    unsigned short int *data_pointer = (unsigned short int *)data;
+    const unsigned char *data_pointer = (const unsigned char *)data;
     unsigned int total_sum = 0;
-    // Main summing loop
+    // Main summing loop, over big endian words whatever the host's byte order
     while (bytes > 1)
     {
-        total_sum += *data_pointer++;
+        uint16_t word;
+        memcpy(&word, data_pointer, sizeof(word));
+        total_sum += ntohs(word);
+        data_pointer += 2;
         bytes -= 2;
     }
-    // Add left-over byte, if any
+    // Add left-over byte, if any, as the high byte of a last word
     if (bytes > 0)
-        total_sum += *((unsigned char *)data_pointer);
+        total_sum += (unsigned int)*data_pointer << 8;
     // Fold 32-bit sum to 16 bits
     while (total_sum >> 16)
         total_sum = (total_sum & 0xFFFF) + (total_sum >> 16);
     return (~((unsigned short int)total_sum));
 }
 
-// RUDP header
-typedef struct
+// Adds size bytes to the 16 bit word sum of calculate_checksum(), continuing a run of bytes of odd length so far
+// if *odd is set: the pieces of a datagram sum up as if they were one buffer, however they are split.
+static uint32_t rudp_checksum_add(uint32_t sum, const void *data, size_t size, bool *odd)
 {
-    uint32_t checksum;
-    uint16_t length;
-    uint16_t sequence_number;
-    uint16_t acknowledgment_number;
-    uint8_t flags;
-} RUDP_Header;
+    const uint8_t *bytes = (const uint8_t *)data;
+    if (*odd && size > 0)
+    {
+        // the low byte of the word the last piece began
+        sum += bytes[0];
+        bytes++;
+        size--;
+        *odd = false;
+    }
+    for (; size > 1; bytes += 2, size -= 2)
+    {
+        uint16_t word;
+        memcpy(&word, bytes, sizeof(word));
+        sum += ntohs(word);
+    }
+    if (size > 0)
+    {
+        sum += (uint32_t)bytes[0] << 8;
+        *odd = true;
+    }
+    return sum;
+}
 
-// rudp packet
-typedef struct
+// Checksum of a datagram: the encoded header with its checksum field zeroed, then everything after it.
+static uint16_t rudp_datagram_checksum(const struct iovec *iov, int count)
 {
-    RUDP_Header header;
-    char data[CHUNK_SIZE];
-} RUDP_Packet;
+    uint32_t sum = 0;
+    bool odd = false;
+    for (int i = 0; i < count; i++)
+    {
+        sum = rudp_checksum_add(sum, iov[i].iov_base, iov[i].iov_len, &odd);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
 
-// A struct that represents RUDP Socket
+// What a client remembers about a server between runs.
 typedef struct
 {
-    int socket_fd;                // UDP socket file descriptor
-    bool isServer;                // True if the RUDP socket acts like a server, false for client.
-    bool isConnected;             // True if there is an active connection, false otherwise.
-    struct sockaddr_in dest_addr; // Destination address. Client fills it when it connects via rudp_connect(), server fills it when it accepts a connection via rudp_accept().
-} RUDP_Socket;
+    RUDP_Ticket ticket;
+    uint32_t rtt_us; // Handshake round trip time.
+} RUDP_Session;
 
-int rudp_close(RUDP_Socket *);
-int rudp_send(RUDP_Socket *, uint8_t, char *, size_t);
-int rudp_receive(RUDP_Socket *, RUDP_Packet *);
+static int rudp_answer_syn(RUDP_Socket *, RUDP_Packet *, const struct sockaddr_in *);
+static size_t rudp_checkpoint_offer(RUDP_Checkpoint *, uint64_t, char *, size_t);
+static bool rudp_checkpoint_adopt(RUDP_Checkpoint *, uint64_t);
 
-// Allocates a new structure for the RUDP socket (contains basic information about the socket itself).
-// Also creates a UDP socket as a baseline for the RUDP.
-// isServer means that this socket acts like a server. If set to server socket, it also binds the socket to a specific port.
-RUDP_Socket *rudp_socket(bool isServer, unsigned short int listen_port)
+// Fixed-width loads and stores, compiled to single (byte swapping) moves.
+static inline void rudp_put16(uint8_t *wire, uint16_t value)
 {
-    RUDP_Socket *sockfd = (RUDP_Socket *)malloc(sizeof(RUDP_Socket));
-    if (sockfd == NULL)
+    value = htobe16(value);
+    memcpy(wire, &value, sizeof(value));
+}
+
+static inline void rudp_put32(uint8_t *wire, uint32_t value)
+{
+    value = htobe32(value);
+    memcpy(wire, &value, sizeof(value));
+}
+
+static inline uint16_t rudp_get16(const uint8_t *wire)
+{
+    uint16_t value;
+    memcpy(&value, wire, sizeof(value));
+    return be16toh(value);
+}
+
+static inline uint32_t rudp_get32(const uint8_t *wire)
+{
+    uint32_t value;
+    memcpy(&value, wire, sizeof(value));
+    return be32toh(value);
+}
+
+void rudp_header_encode(const RUDP_Header *header, uint8_t *wire)
+{
+    wire[0] = RUDP_VERSION << 4 | (header->send_time != 0 ? RUDP_OPTION_TIMESTAMP : 0);
+    wire[1] = header->flags;
+    rudp_put16(wire + 2, header->checksum);
+    rudp_put16(wire + 4, header->stream_id);
+    rudp_put32(wire + 6, header->sequence_number);
+    rudp_put32(wire + 10, header->acknowledgment_number);
+    rudp_put32(wire + 14, header->connection_id);
+}
+
+int rudp_header_decode(const uint8_t *wire, size_t size, RUDP_Header *header)
+{
+    if (size < RUDP_HEADER_SIZE || wire[0] >> 4 != RUDP_VERSION)
     {
-        perror("malloc(3)");
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    header->flags = wire[1];
+    header->checksum = rudp_get16(wire + 2);
+    header->stream_id = rudp_get16(wire + 4);
+    header->sequence_number = rudp_get32(wire + 6);
+    header->acknowledgment_number = rudp_get32(wire + 10);
+    header->connection_id = rudp_get32(wire + 14);
+    header->length = (uint16_t)size;
+    header->send_time = 0;
+    return wire[0] & 0x0f;
+}
 
-    struct sockaddr_in server;
+// Returns a header of the socket's connection with the given flags, everything else 0.
+static inline RUDP_Header rudp_header(const RUDP_Socket *sockfd, uint8_t flags)
+{
+    RUDP_Header header = {.flags = flags, .connection_id = sockfd->connection_id};
+    return header;
+}
 
-    // Reset the receiver to zeros.
-    memset(&server, 0, sizeof(server));
+// Sends a packet to peer: the encoded header, then size bytes of payload straight from data (it is not copied),
+// then the send time when the socket collects timestamps. Sets header->send_time to that time, or 0, and
+// header->checksum to the checksum of the whole datagram.
+// The first packet of a resumed client takes the session ticket along: a chunk goes out as a RESUME with the ticket
+// in front of its payload, anything else after a RESUME of its own.
+// Returns what sendmsg() returns.
+static ssize_t rudp_sendto(RUDP_Socket *sockfd, RUDP_Header *header, const void *data, size_t size, const struct sockaddr_in *peer)
+{
+    uint8_t wire[RUDP_HEADER_SIZE];
+    uint64_t trailer;
+    uint8_t flags = header->flags;
+    size_t ticket_size = 0;
+    if (sockfd->resumePending)
+    {
+        sockfd->resumePending = false;
+        if (flags == PUSH)
+        {
+            header->flags = RESUME;
+            ticket_size = sizeof(RUDP_Ticket);
+        }
+        else
+        {
+            RUDP_Header resume = rudp_header(sockfd, RESUME);
+            if (rudp_sendto(sockfd, &resume, &sockfd->ticket, sizeof(RUDP_Ticket), peer) == -1)
+            {
+                return -1;
+            }
+        }
+    }
+    header->send_time = sockfd->timestamps ? latency_now_ns() : 0;
+    header->checksum = 0;
+    rudp_header_encode(header, wire);
+    header->flags = flags;
+    trailer = htobe64((uint64_t)header->send_time);
 
-    // Set the receiver's address.
-    if (inet_pton(AF_INET, SERVER_IP, &server.sin_addr) <= 0)
+    struct iovec iov[4] = {{.iov_base = wire, .iov_len = sizeof(wire)}, {.iov_base = &sockfd->ticket, .iov_len = ticket_size}, {.iov_base = (void *)data, .iov_len = size}, {.iov_base = &trailer, .iov_len = sizeof(trailer)}};
+    struct msghdr message = {.msg_name = (void *)peer, .msg_namelen = sizeof(*peer), .msg_iov = iov, .msg_iovlen = header->send_time != 0 ? 4 : 3};
+    header->checksum = rudp_datagram_checksum(iov, (int)message.msg_iovlen);
+    rudp_put16(wire + 2, header->checksum);
+    ssize_t sent = sendmsg(sockfd->socket_fd, &message, 0);
+    if (sent >= 0)
     {
-        perror("inet_pton(3)");
-        exit(EXIT_FAILURE);
+        sockfd->tx_index++;
+    }
+    return sent;
+}
+
+// Returns the time between start and end in milliseconds.
+double rudp_elapsed_ms(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+// Returns the CLOCK_MONOTONIC time in milliseconds, the tick of the timer wheels.
+uint64_t rudp_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Links the timer into the slot its expiry falls in, as seen from wheel->now.
+static void rudp_timer_link(RUDP_Timer_Wheel *wheel, RUDP_Timer *timer)
+{
+    uint64_t delta = timer->expires > wheel->now ? timer->expires - wheel->now : 0;
+    uint64_t expires = timer->expires > wheel->now ? timer->expires : wheel->now;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+    if (delta >= (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)))
+    {
+        // beyond the wheel's horizon: park it in the farthest slot, it is re-linked when that slot cascades
+        expires = wheel->now + (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
     }
 
-    // Set the server's address family to AF_INET (IPv4).
-    server.sin_family = AF_INET;
+    RUDP_Timer **slot = &wheel->slots[level][(expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)];
+    timer->next = *slot;
+    if (*slot != NULL)
+    {
+        (*slot)->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
 
-    // Set the server's port to the specified port. Note that the port must be in network byte order.
-    server.sin_port = htons(listen_port);
+static void rudp_timer_unlink(RUDP_Timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
 
-    sockfd->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd->socket_fd < 0)
+// Starts (or restarts) the timer to call callback(timer, arg) delay_ms milliseconds from now.
+void rudp_timer_start(RUDP_Timer_Wheel *wheel, RUDP_Timer *timer, uint32_t delay_ms, void (*callback)(RUDP_Timer *, void *), void *arg)
+{
+    if (timer->pprev != NULL)
     {
-        perror("socket(2)");
-        free(sockfd);
-        exit(EXIT_FAILURE);
+        rudp_timer_unlink(timer);
+        wheel->pending--;
+    }
+    if (wheel->pending == 0)
+    {
+        // nothing is linked, so the wheel can jump to the present instead of ticking through the idle time
+        wheel->now = rudp_now_ms();
+    }
+    timer->expires = wheel->now + (delay_ms > 0 ? delay_ms : 1);
+    timer->callback = callback;
+    timer->arg = arg;
+    rudp_timer_link(wheel, timer);
+    wheel->pending++;
+}
+
+// Stops the timer if it is pending.
+void rudp_timer_cancel(RUDP_Timer_Wheel *wheel, RUDP_Timer *timer)
+{
+    if (timer->pprev != NULL)
+    {
+        rudp_timer_unlink(timer);
+        wheel->pending--;
     }
+}
 
-    sockfd->isServer = isServer;
+// Moves the timers of a higher level slot down to the levels below.
+static void rudp_timers_cascade(RUDP_Timer_Wheel *wheel, int level)
+{
+    RUDP_Timer *list = wheel->slots[level][(wheel->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)];
+    wheel->slots[level][(wheel->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)] = NULL;
+    while (list != NULL)
+    {
+        RUDP_Timer *timer = list;
+        list = timer->next;
+        rudp_timer_link(wheel, timer);
+    }
+}
+
+// Advances the wheel to now, calling the callbacks of the timers that expired on the way.
+// Callbacks may start and cancel timers, including their own.
+void rudp_timers_run(RUDP_Timer_Wheel *wheel, uint64_t now)
+{
+    if (wheel->pending == 0)
+    {
+        wheel->now = now;
+        return;
+    }
+    while (wheel->now < now && wheel->pending > 0)
+    {
+        wheel->now++;
+        // when a level wraps around, the next slot of the level above comes within its reach
+        for (int level = 1; level < TIMER_LEVELS && (wheel->now & ((1ULL << (TIMER_SLOT_BITS * level)) - 1)) == 0; level++)
+        {
+            rudp_timers_cascade(wheel, level);
+        }
+
+        // detach the slot, so callbacks that re-arm their timer for the same tick run on the next one
+        RUDP_Timer *list = wheel->slots[0][wheel->now & (TIMER_SLOTS - 1)];
+        wheel->slots[0][wheel->now & (TIMER_SLOTS - 1)] = NULL;
+        if (list != NULL)
+        {
+            list->pprev = &list;
+        }
+        while (list != NULL)
+        {
+            RUDP_Timer *timer = list;
+            rudp_timer_unlink(timer);
+            wheel->pending--;
+            timer->callback(timer, timer->arg);
+        }
+    }
+    if (wheel->now < now)
+    {
+        wheel->now = now;
+    }
+}
+
+// Returns the milliseconds until the next timer fires, 0 if one is due, -1 if none is pending.
+// Only looks at the first occupied slot of every level, so it costs at most TIMER_LEVELS * TIMER_SLOTS probes.
+int64_t rudp_timers_next(RUDP_Timer_Wheel *wheel)
+{
+    if (wheel->pending == 0)
+    {
+        return -1;
+    }
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < TIMER_LEVELS; level++)
+    {
+        uint64_t index = wheel->now >> (TIMER_SLOT_BITS * level);
+        for (int i = 1; i <= TIMER_SLOTS; i++)
+        {
+            for (RUDP_Timer *timer = wheel->slots[level][(index + i) & (TIMER_SLOTS - 1)]; timer != NULL; timer = timer->next)
+            {
+                next = timer->expires < next ? timer->expires : next;
+            }
+            if (next != UINT64_MAX)
+            {
+                break;
+            }
+        }
+    }
+    uint64_t now = rudp_now_ms();
+    return next > now ? (int64_t)(next - now) : 0;
+}
+
+// Resends the pending control packet with exponential backoff, and ends the wait after MAX_RETRIES.
+static void rudp_on_retransmit(RUDP_Timer *timer, void *arg)
+{
+    RUDP_Socket *sockfd = (RUDP_Socket *)arg;
+    if (sockfd->retries++ == MAX_RETRIES)
+    {
+        sockfd->timed_out = true;
+        return;
+    }
+    rudp_sendto(sockfd, &sockfd->pending.header, sockfd->pending.data, sockfd->pending_size, &sockfd->dest_addr);
+    sockfd->rto_ms = sockfd->rto_ms < RTO_MAX_MS / 2 ? sockfd->rto_ms * 2 : RTO_MAX_MS;
+    rudp_timer_start(sockfd->timers, timer, sockfd->rto_ms, rudp_on_retransmit, sockfd);
+}
+
+static void rudp_on_response_timeout(RUDP_Timer *timer, void *arg)
+{
+    ((RUDP_Socket *)arg)->timed_out = true;
+}
+
+// Acknowledges the chunks received so far in one ACK, instead of one per chunk.
+// The sender counts it as a sign of progress while it waits for the completion ACK.
+static void rudp_send_progress_ack(RUDP_Socket *sockfd)
+{
+    RUDP_Header header = rudp_header(sockfd, ACK);
+    header.acknowledgment_number = sockfd->chunks_received;
+    rudp_sendto(sockfd, &header, NULL, 0, &sockfd->dest_addr);
+    sockfd->unacked = 0;
+}
+
+// Counts a received chunk. The progress ACK it is owed goes out once the receive queue runs dry, at most every
+// DELAYED_ACK_MS (see rudp_recv_datagram()), so no timer has to run while chunks stream in, and a sender that only
+// reads once it has sent everything does not find its receive buffer full of them.
+static void rudp_ack_later(RUDP_Socket *sockfd)
+{
+    sockfd->chunks_received++;
+    if (sockfd->chunks_received == 0)
+    {
+        // 0 marks the completion ACK
+        sockfd->chunks_received++;
+    }
+    sockfd->unacked++;
+}
+
+// Probes a peer that has been quiet for a third of the idle timeout. A live client answers the probe.
+static void rudp_on_keepalive(RUDP_Timer *timer, void *arg)
+{
+    RUDP_Socket *sockfd = (RUDP_Socket *)arg;
+    uint32_t interval = sockfd->idle_ms / 3 > 0 ? sockfd->idle_ms / 3 : 1;
+    if (sockfd->timers->now - sockfd->last_heard_ms >= interval)
+    {
+        RUDP_Header header = rudp_header(sockfd, KEEPALIVE);
+        rudp_sendto(sockfd, &header, NULL, 0, &sockfd->dest_addr);
+    }
+    rudp_timer_start(sockfd->timers, timer, interval, rudp_on_keepalive, sockfd);
+}
+
+// Closes the connection once the peer has been quiet for idle_ms. Arrivals only note the time, the timer
+// re-arms itself for the rest of the period when it finds the peer was heard from meanwhile.
+static void rudp_on_idle(RUDP_Timer *timer, void *arg)
+{
+    RUDP_Socket *sockfd = (RUDP_Socket *)arg;
+    uint64_t quiet = sockfd->timers->now - sockfd->last_heard_ms;
+    if (quiet < sockfd->idle_ms)
+    {
+        rudp_timer_start(sockfd->timers, timer, sockfd->idle_ms - quiet, rudp_on_idle, sockfd);
+        return;
+    }
+    printf("No datagram from %s:%d for %u ms, closing the connection.\n", inet_ntoa(sockfd->dest_addr.sin_addr), ntohs(sockfd->dest_addr.sin_port), sockfd->idle_ms);
+    rudp_timer_cancel(sockfd->timers, &sockfd->keepalive);
     sockfd->isConnected = false;
+    sockfd->idle_closed = true;
+    sockfd->timed_out = true;
+}
+
+// Closes connections that stay quiet for idle_ms milliseconds (0 keeps them open), probing them with keepalives
+// first. Takes effect when the next connection is accepted.
+void rudp_set_idle_timeout(RUDP_Socket *sockfd, uint32_t idle_ms)
+{
+    sockfd->idle_ms = idle_ms;
+}
+
+// Starts the timers of a connection the server just accepted.
+static void rudp_connection_timers(RUDP_Socket *sockfd)
+{
+    sockfd->idle_closed = false;
+    if (sockfd->idle_ms > 0)
+    {
+        sockfd->last_heard_ms = rudp_now_ms();
+        rudp_timer_start(sockfd->timers, &sockfd->keepalive, sockfd->idle_ms / 3 > 0 ? sockfd->idle_ms / 3 : 1, rudp_on_keepalive, sockfd);
+        rudp_timer_start(sockfd->timers, &sockfd->idle, sockfd->idle_ms, rudp_on_idle, sockfd);
+    }
+}
+
+// Sends a control packet that expects an answer, and keeps resending it until rudp_answered() is called.
+// Returns the number of sent bytes on success and -1 on error.
+static int rudp_send_reliable(RUDP_Socket *sockfd, uint8_t flags, char *data, size_t data_size)
+{
+    size_t payload = data != NULL && data_size <= CHUNK_SIZE ? data_size : 0;
+    sockfd->pending.header = rudp_header(sockfd, flags);
+    if (payload > 0)
+    {
+        memcpy(sockfd->pending.data, data, payload);
+    }
+    sockfd->pending_size = payload;
+
+    if (rudp_sendto(sockfd, &sockfd->pending.header, sockfd->pending.data, payload, &sockfd->dest_addr) == -1)
+    {
+        return -1;
+    }
+    // every exchange backs off on its own, from the timeout the round trip time calls for
+    sockfd->retries = 0;
+    sockfd->rto_ms = sockfd->base_rto_ms;
+    rudp_timer_start(sockfd->timers, &sockfd->retransmit, sockfd->rto_ms, rudp_on_retransmit, sockfd);
+    return payload;
+}
+
+// The pending control packet was answered: stop resending it.
+static void rudp_answered(RUDP_Socket *sockfd)
+{
+    rudp_timer_cancel(sockfd->timers, &sockfd->retransmit);
+    sockfd->rto_ms = sockfd->base_rto_ms;
+    sockfd->timed_out = false;
+}
+
+// Takes on a measured (or cached) round trip time, and the retransmission timeout that goes with it.
+static void rudp_set_rtt(RUDP_Socket *sockfd, uint32_t rtt_us)
+{
+    sockfd->rtt_us = rtt_us;
+    sockfd->base_rto_ms = 4 * rtt_us / 1000 > RTO_MIN_MS ? 4 * rtt_us / 1000 : RTO_MIN_MS;
+    sockfd->rto_ms = sockfd->base_rto_ms;
+}
+
+// Resends the pending control packet right away, when the peer shows it missed our answer.
+static void rudp_retransmit_now(RUDP_Socket *sockfd)
+{
+    rudp_sendto(sockfd, &sockfd->pending.header, sockfd->pending.data, sockfd->pending_size, &sockfd->dest_addr);
+}
+
+#define SIPROUND                                                    \
+    do                                                              \
+    {                                                               \
+        v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0;           \
+        v0 = (v0 << 32) | (v0 >> 32);                               \
+        v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2;           \
+        v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0;           \
+        v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2;           \
+        v2 = (v2 << 32) | (v2 >> 32);                               \
+    } while (0)
+
+// SipHash-2-4 of data under a 128 bit key, a keyed hash that is cheap enough to run per packet.
+static uint64_t rudp_siphash(const uint8_t key[16], const void *data, size_t size)
+{
+    const uint8_t *in = (const uint8_t *)data;
+    uint64_t k0, k1, m;
+    memcpy(&k0, key, 8);
+    memcpy(&k1, key + 8, 8);
+    k0 = le64toh(k0);
+    k1 = le64toh(k1);
+
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    size_t i;
+    for (i = 0; i + 8 <= size; i += 8)
+    {
+        memcpy(&m, in + i, 8);
+        m = le64toh(m);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    // the last word holds the remaining bytes and the length in its top byte
+    m = (uint64_t)size << 56;
+    for (size_t j = 0; i + j < size; j++)
+    {
+        m |= (uint64_t)in[i + j] << (8 * j);
+    }
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static char state_dir[PATH_MAX - 128]; // leaves room for the file names in it
+static pthread_once_t state_dir_once = PTHREAD_ONCE_INIT;
+
+// Creates dir and whichever of its parents are missing, private to the user.
+// Returns 0 on success and -1 on error.
+static int rudp_make_dir(const char *dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char *slash = strchr(path + 1, '/');; slash = strchr(slash + 1, '/'))
+    {
+        if (slash != NULL)
+        {
+            *slash = '\0';
+        }
+        if (mkdir(path, 0700) < 0 && errno != EEXIST)
+        {
+            perror("mkdir(2)");
+            return -1;
+        }
+        if (slash == NULL)
+        {
+            return 0;
+        }
+        *slash = '/';
+    }
+}
+
+int rudp_set_state_dir(const char *dir)
+{
+    if (dir == NULL || *dir == '\0' || strlen(dir) >= sizeof(state_dir))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(state_dir, sizeof(state_dir), "%s", dir);
+    return rudp_make_dir(state_dir);
+}
+
+// Picks the state directory, unless rudp_set_state_dir() did: STATE_DIR_ENV, else $XDG_STATE_HOME/rudp, else
+// ~/.local/state/rudp.
+static void rudp_default_state_dir(void)
+{
+    const char *dir = getenv(STATE_DIR_ENV);
+    const char *home = getenv("HOME");
+    const char *state_home = getenv("XDG_STATE_HOME");
+    if (state_dir[0] != '\0')
+    {
+        return;
+    }
+    if (dir != NULL && *dir != '\0')
+    {
+        snprintf(state_dir, sizeof(state_dir), "%s", dir);
+    }
+    else if (state_home != NULL && *state_home != '\0')
+    {
+        snprintf(state_dir, sizeof(state_dir), "%s/rudp", state_home);
+    }
+    else if (home != NULL && *home != '\0')
+    {
+        snprintf(state_dir, sizeof(state_dir), "%s/.local/state/rudp", home);
+    }
+    else
+    {
+        snprintf(state_dir, sizeof(state_dir), ".");
+    }
+    rudp_make_dir(state_dir);
+}
+
+// Writes the path of the file name in the state directory to path.
+static void rudp_state_path(char *path, size_t size, const char *name)
+{
+    pthread_once(&state_dir_once, rudp_default_state_dir);
+    snprintf(path, size, "%s/%s", state_dir, name);
+}
+
+static uint8_t ticket_key[16];
+static bool ticket_key_loaded = false;
+static pthread_once_t ticket_key_once = PTHREAD_ONCE_INIT;
+
+// Loads the ticket key, or creates it, once per process: the flows' threads may all ask for it at the same time.
+static void rudp_load_ticket_key(void)
+{
+    char path[PATH_MAX];
+    rudp_state_path(path, sizeof(path), TICKET_KEY_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        ssize_t bytes_read = read(fd, ticket_key, sizeof(ticket_key));
+        close(fd);
+        if (bytes_read == sizeof(ticket_key))
+        {
+            ticket_key_loaded = true;
+            return;
+        }
+    }
+    if (getrandom(ticket_key, sizeof(ticket_key), 0) != sizeof(ticket_key))
+    {
+        perror("getrandom(2)");
+        return;
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, ticket_key, sizeof(ticket_key)) != sizeof(ticket_key))
+    {
+        perror("open(2)");
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    ticket_key_loaded = true;
+}
+
+// Copies the key that authenticates session tickets (and SYN cookies) to key, creating it on first use.
+// All receivers with the same state directory share the key file, so a ticket outlives the receiver process that
+// issued it.
+// Returns 0 on success and -1 on error.
+static int rudp_ticket_key(uint8_t key[16])
+{
+    pthread_once(&ticket_key_once, rudp_load_ticket_key);
+    if (!ticket_key_loaded)
+    {
+        return -1;
+    }
+    memcpy(key, ticket_key, sizeof(ticket_key));
+    return 0;
+}
+
+// Fills in a session ticket for the client at peer.
+static void rudp_issue_ticket(RUDP_Ticket *ticket, const struct sockaddr_in *peer)
+{
+    uint8_t key[16];
+    memset(ticket, 0, sizeof(RUDP_Ticket));
+    ticket->issued = htonl((uint32_t)time(NULL));
+    ticket->client_addr = peer->sin_addr.s_addr;
+    ticket->chunk_size = htons(CHUNK_SIZE);
+    ticket->version = htons(TICKET_VERSION);
+    ticket->lifetime = htonl(TICKET_LIFETIME);
+    if (getrandom(&ticket->nonce, sizeof(ticket->nonce), 0) != sizeof(ticket->nonce))
+    {
+        perror("getrandom(2)");
+    }
+    if (rudp_ticket_key(key) == 0)
+    {
+        ticket->mac = rudp_siphash(key, (const uint8_t *)ticket + sizeof(ticket->mac), sizeof(RUDP_Ticket) - sizeof(ticket->mac));
+    }
+}
+
+// Compares size bytes without stopping at the first difference, so the time taken tells nothing about where the
+// bytes differ: a forger cannot find a MAC byte by byte.
+static bool rudp_equal_ct(const void *a, const void *b, size_t size)
+{
+    const volatile uint8_t *x = (const volatile uint8_t *)a;
+    const volatile uint8_t *y = (const volatile uint8_t *)b;
+    uint8_t difference = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        difference |= x[i] ^ y[i];
+    }
+    return difference == 0;
+}
+
+// Checks that a ticket was issued by a receiver on this host to the client at peer, and has not expired.
+static bool rudp_ticket_valid(const RUDP_Ticket *ticket, const struct sockaddr_in *peer)
+{
+    uint8_t key[16];
+    RUDP_Ticket copy;
+    memcpy(&copy, ticket, sizeof(copy));
+    if (rudp_ticket_key(key) < 0)
+    {
+        return false;
+    }
+    uint64_t mac = rudp_siphash(key, (const uint8_t *)&copy + sizeof(copy.mac), sizeof(copy) - sizeof(copy.mac));
+    if (!rudp_equal_ct(&mac, &copy.mac, sizeof(mac)))
+    {
+        return false;
+    }
+
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t issued = ntohl(copy.issued);
+    return ntohs(copy.version) == TICKET_VERSION && copy.client_addr == peer->sin_addr.s_addr &&
+           ntohs(copy.chunk_size) == CHUNK_SIZE && issued <= now + 60 && now - issued <= ntohl(copy.lifetime);
+}
+
+// A ticket the receiver took, remembered until it expires.
+typedef struct
+{
+    uint64_t mac;
+    uint32_t expires;
+} RUDP_Used_Ticket;
+
+static RUDP_Used_Ticket used_tickets[TICKET_USED_SLOTS];
+static pthread_mutex_t used_tickets_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Marks a valid ticket as used, so it is good for one RESUME. The receiver remembers the tickets it took in memory
+// until they expire, which bounds the set: a replay to this process is always caught, a receiver started later does
+// not know the tickets its predecessors took. With every slot holding a live ticket no more are taken, and the
+// clients fall back to a handshake until one expires.
+// Returns false if the ticket was used before (the RESUME is a replay), or there is no room to remember it.
+static bool rudp_ticket_claim(const RUDP_Ticket *ticket)
+{
+    uint32_t now = (uint32_t)time(NULL);
+    int slot = -1;
+    bool replay = false;
+
+    pthread_mutex_lock(&used_tickets_lock);
+    for (int i = 0; i < TICKET_USED_SLOTS; i++)
+    {
+        if (used_tickets[i].expires < now)
+        {
+            slot = slot < 0 ? i : slot;
+        }
+        else if (used_tickets[i].mac == ticket->mac)
+        {
+            replay = true;
+        }
+    }
+    if (!replay && slot >= 0)
+    {
+        used_tickets[slot].mac = ticket->mac;
+        used_tickets[slot].expires = ntohl(ticket->issued) + ntohl(ticket->lifetime);
+    }
+    pthread_mutex_unlock(&used_tickets_lock);
+    return !replay && slot >= 0;
+}
+
+// Allocates a new structure for the RUDP socket (contains basic information about the socket itself).
+// Also creates a UDP socket as a baseline for the RUDP.
+// isServer means that this socket acts like a server. If set to server socket, it also binds the socket to a specific port.
+RUDP_Socket *rudp_socket(bool isServer, unsigned short int listen_port)
+{
+    RUDP_Socket *sockfd = (RUDP_Socket *)malloc(sizeof(RUDP_Socket));
+    if (sockfd == NULL)
+    {
+        perror("malloc(3)");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_in server;
+
+    // Reset the receiver to zeros.
+    memset(&server, 0, sizeof(server));
+
+    // Set the receiver's address.
+    if (inet_pton(AF_INET, LISTEN_IP, &server.sin_addr) <= 0)
+    {
+        perror("inet_pton(3)");
+        exit(EXIT_FAILURE);
+    }
+
+    // Set the server's address family to AF_INET (IPv4).
+    server.sin_family = AF_INET;
+
+    // Set the server's port to the specified port. Note that the port must be in network byte order.
+    server.sin_port = htons(listen_port);
+
+    sockfd->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd->socket_fd < 0)
+    {
+        perror("socket(2)");
+        free(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    sockfd->isServer = isServer;
+    sockfd->isConnected = false;
+    sockfd->rtt_us = 0;
+    sockfd->isResumed = false;
+    sockfd->isContinued = false;
+    sockfd->hasTicket = false;
+    sockfd->resumePending = false;
+    sockfd->early_size = -1;
+    sockfd->timestamps = false;
+    sockfd->tx_index = 0;
+    sockfd->busy_poll_us = 0;
+    sockfd->epoll_fd = -1;
+    sockfd->spin_hits = 0;
+    sockfd->sleeps = 0;
+    sockfd->file_id = 0;
+    sockfd->delivered = NULL;
+    sockfd->delivered_chunks = 0;
+    sockfd->checkpoint = NULL;
+    sockfd->timers = (RUDP_Timer_Wheel *)calloc(1, sizeof(RUDP_Timer_Wheel));
+    if (sockfd->timers == NULL)
+    {
+        perror("calloc(3)");
+        exit(EXIT_FAILURE);
+    }
+    sockfd->timers->now = rudp_now_ms();
+    sockfd->timed_out = false;
+    sockfd->retransmit.pprev = NULL;
+    sockfd->response.pprev = NULL;
+    sockfd->keepalive.pprev = NULL;
+    sockfd->idle.pprev = NULL;
+    sockfd->base_rto_ms = RTO_INITIAL_MS;
+    sockfd->rto_ms = RTO_INITIAL_MS;
+    sockfd->chunks_received = 0;
+    sockfd->unacked = 0;
+    sockfd->last_ack_ms = 0;
+    sockfd->progress_acks = 0;
+    sockfd->idle_ms = 0;
+    sockfd->idle_closed = false;
+
+    // a client picks its connection ID, a server takes on the ID of the client it accepts
+    sockfd->connection_id = 0;
+    if (!isServer && getrandom(&sockfd->connection_id, sizeof(sockfd->connection_id), 0) != sizeof(sockfd->connection_id))
+    {
+        perror("getrandom(2)");
+    }
+
+    if (isServer)
+    {
+        // Nothing retransmits lost chunks, so give the kernel room to queue a whole transfer.
+        // Best effort: the kernel caps the value at net.core.rmem_max.
+        int rcvbuf = 2 * TRANSFER_SIZE;
+        if (setsockopt(sockfd->socket_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1)
+        {
+            perror("setsockopt(2)");
+        }
+
+        if (bind(sockfd->socket_fd, (struct sockaddr *)&server, sizeof(server)) < 0)
+        {
+            perror("bind(2)");
+            close(sockfd->socket_fd);
+            free(sockfd);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return sockfd;
+}
+
+// Turns on kernel timestamps: receive timestamps on a server socket, software transmit timestamps on a client.
+// The ranges received or sent on the socket then collect per-packet latency samples.
+// Returns 0 on success and -1 on error.
+int rudp_enable_timestamps(RUDP_Socket *sockfd)
+{
+    if ((sockfd->isServer ? latency_enable_rx(sockfd->socket_fd) : latency_enable_tx(sockfd->socket_fd)) < 0)
+    {
+        return -1;
+    }
+    sockfd->timestamps = true;
+    sockfd->tx_index = 0;
+    return 0;
+}
+
+// Switches the socket's data receives to busy polling: non-blocking reads in a loop for up to budget_us
+// microseconds, then a sleep in epoll_wait() until the next datagram. Spinning saves the wakeup latency of a
+// blocking read at the price of burning a CPU while the flow is idle, so pin the receiving thread.
+// SO_BUSY_POLL lets the reads poll the device queue directly on drivers that support it.
+// Returns 0 on success and -1 on error.
+int rudp_enable_busy_poll(RUDP_Socket *sockfd, uint32_t budget_us)
+{
+    int optval = (int)budget_us;
+    if (setsockopt(sockfd->socket_fd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)) == -1)
+    {
+        // raising the budget above net.core.busy_read needs CAP_NET_ADMIN, the spin loop works without it
+        perror("setsockopt(2)");
+    }
+    optval = 1;
+    if (setsockopt(sockfd->socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval, sizeof(optval)) == -1)
+    {
+        perror("setsockopt(2)");
+    }
+
+    sockfd->epoll_fd = epoll_create1(0);
+    if (sockfd->epoll_fd < 0)
+    {
+        perror("epoll_create1(2)");
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = sockfd->socket_fd};
+    if (epoll_ctl(sockfd->epoll_fd, EPOLL_CTL_ADD, sockfd->socket_fd, &event) < 0)
+    {
+        perror("epoll_ctl(2)");
+        close(sockfd->epoll_fd);
+        sockfd->epoll_fd = -1;
+        return -1;
+    }
+    sockfd->busy_poll_us = budget_us;
+    return 0;
+}
+
+// Returns true if a datagram from address came from the connection's peer.
+static bool rudp_same_peer(const struct sockaddr_in *address, const struct sockaddr_in *peer)
+{
+    return address->sin_addr.s_addr == peer->sin_addr.s_addr && address->sin_port == peer->sin_port;
+}
+
+// Returns true if a datagram from address came from the host of the connection's peer, whatever its port: a
+// sender that restarts comes back from a new one.
+static bool rudp_same_host(const struct sockaddr_in *address, const struct sockaddr_in *peer)
+{
+    return address->sin_addr.s_addr == peer->sin_addr.s_addr;
+}
+
+// Receives one datagram with recvmsg(), busy polling if the socket is set up for it.
+// The socket's timers run while it waits: a single poll() (or epoll_wait()) sleeps until a datagram arrives or the
+// next timer is due, and a timer that gives up on the peer ends the wait. Without pending timers and with no
+// progress ACK owed, a plain blocking read does the waiting.
+// Returns what recvmsg() returns, or -1 with errno set to ETIMEDOUT when a timer ended the wait.
+static int rudp_recv_datagram(RUDP_Socket *rudp_socket, struct msghdr *message)
+{
+    socklen_t name_length = message->msg_namelen;
+    size_t control_length = message->msg_controllen;
+    RUDP_Timer_Wheel *timers = rudp_socket->timers;
+    while (1)
+    {
+        // the clock is only read for the timers, a socket without any never looks at it
+        uint64_t now = timers->pending > 0 ? rudp_now_ms() : timers->now;
+        if (now != timers->now)
+        {
+            rudp_timers_run(timers, now);
+        }
+        if (rudp_socket->timed_out)
+        {
+            rudp_socket->timed_out = false;
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        int bytes_received;
+        message->msg_namelen = name_length;
+        message->msg_controllen = control_length;
+        if (rudp_socket->busy_poll_us == 0 && timers->pending == 0 && rudp_socket->unacked == 0)
+        {
+            bytes_received = recvmsg(rudp_socket->socket_fd, message, 0);
+            rudp_socket->last_heard_ms = now;
+            return bytes_received;
+        }
+
+        // take a datagram that is already queued, with busy polling keep trying for the budget
+        struct timespec spin_start, spin_now;
+        if (rudp_socket->busy_poll_us > 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &spin_start);
+        }
+        do
+        {
+            message->msg_namelen = name_length;
+            message->msg_controllen = control_length;
+            bytes_received = recvmsg(rudp_socket->socket_fd, message, MSG_DONTWAIT);
+            if (bytes_received >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                rudp_socket->spin_hits += bytes_received >= 0 && rudp_socket->busy_poll_us > 0;
+                rudp_socket->last_heard_ms = now;
+                return bytes_received;
+            }
+            if (rudp_socket->busy_poll_us == 0)
+            {
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &spin_now);
+        } while ((spin_now.tv_sec - spin_start.tv_sec) * 1000000 + (spin_now.tv_nsec - spin_start.tv_nsec) / 1000 < rudp_socket->busy_poll_us);
+
+        // the queue ran dry, so the burst is over: acknowledge it before going to sleep, or, if the last progress
+        // ACK is too recent, sleep no longer than until the next one is due
+        int64_t ack_due = -1;
+        if (rudp_socket->unacked > 0)
+        {
+            uint64_t ack_now = rudp_now_ms();
+            if (ack_now - rudp_socket->last_ack_ms >= DELAYED_ACK_MS)
+            {
+                rudp_send_progress_ack(rudp_socket);
+                rudp_socket->last_ack_ms = ack_now;
+            }
+            else
+            {
+                ack_due = (int64_t)(rudp_socket->last_ack_ms + DELAYED_ACK_MS - ack_now);
+            }
+        }
+        if (rudp_socket->busy_poll_us == 0 && timers->pending == 0 && ack_due < 0)
+        {
+            continue;
+        }
+
+        // sleep until the next datagram, the next timer or the next progress ACK, whichever comes first
+        int64_t timeout = rudp_timers_next(timers);
+        if (ack_due >= 0 && (timeout < 0 || ack_due < timeout))
+        {
+            timeout = ack_due;
+        }
+        int wait_ms = timeout < 0 ? -1 : (int)timeout;
+        int ready;
+        if (rudp_socket->epoll_fd >= 0)
+        {
+            rudp_socket->sleeps++;
+            struct epoll_event event;
+            ready = epoll_wait(rudp_socket->epoll_fd, &event, 1, wait_ms);
+        }
+        else
+        {
+            struct pollfd poll_fd = {.fd = rudp_socket->socket_fd, .events = POLLIN};
+            ready = poll(&poll_fd, 1, wait_ms);
+        }
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("poll(2)");
+            return -1;
+        }
+    }
+}
+
+// Receives one packet: the header is decoded into packet->header and the payload lands in packet->data, both read
+// straight from the datagram. Datagrams that are not RUDP packets of this version, that do not fit a packet or
+// whose checksum (over the header and everything after it) fails are skipped, corrupted ones counted as lost.
+// message supplies the address and control buffers, its iovec is set up here.
+// Returns the payload size, or -1 as rudp_recv_datagram() does.
+static int rudp_recvmsg(RUDP_Socket *rudp_socket, RUDP_Packet *packet, struct msghdr *message)
+{
+    uint8_t wire[RUDP_HEADER_SIZE];
+    struct iovec iov[2] = {{.iov_base = wire, .iov_len = sizeof(wire)}, {.iov_base = packet->data, .iov_len = sizeof(packet->data)}};
+    socklen_t name_length = message->msg_namelen;
+    size_t control_length = message->msg_controllen;
+
+    // the chunk that came with the RESUME goes first, as if it had just arrived from the peer
+    if (rudp_socket->early_size >= 0)
+    {
+        int payload = rudp_socket->early_size;
+        rudp_socket->early_size = -1;
+        memcpy(packet, &rudp_socket->early, sizeof(RUDP_Packet));
+        if (message->msg_name != NULL && name_length >= sizeof(rudp_socket->dest_addr))
+        {
+            memcpy(message->msg_name, &rudp_socket->dest_addr, sizeof(rudp_socket->dest_addr));
+            message->msg_namelen = sizeof(rudp_socket->dest_addr);
+        }
+        message->msg_controllen = 0;
+        return payload;
+    }
+
+    message->msg_iov = iov;
+    message->msg_iovlen = 2;
+    while (1)
+    {
+        message->msg_namelen = name_length;
+        message->msg_controllen = control_length;
+        int bytes_received = rudp_recv_datagram(rudp_socket, message);
+        if (bytes_received < 0)
+        {
+            return -1;
+        }
+        if (message->msg_flags & MSG_TRUNC)
+        {
+            // longer than any packet: the tail is gone, and what is left would be mistaken for a whole packet
+            continue;
+        }
+        int options = rudp_header_decode(wire, (size_t)bytes_received, &packet->header);
+        if (options < 0)
+        {
+            continue;
+        }
+        int payload = bytes_received - RUDP_HEADER_SIZE;
+
+        rudp_put16(wire + 2, 0);
+        iov[1].iov_len = (size_t)payload;
+        uint16_t checksum = rudp_datagram_checksum(iov, 2);
+        iov[1].iov_len = sizeof(packet->data);
+        if (checksum != packet->header.checksum)
+        {
+            printf("Checksum failed for stream %d, sequence number %u: %d\n", packet->header.stream_id, packet->header.sequence_number, checksum);
+            COUNTER_ADD(rudp_socket->counters.lost, 1);
+            continue;
+        }
+
+        if (options & RUDP_OPTION_TIMESTAMP)
+        {
+            uint64_t send_time;
+            if (payload < RUDP_TIMESTAMP_SIZE)
+            {
+                continue;
+            }
+            payload -= RUDP_TIMESTAMP_SIZE;
+            memcpy(&send_time, packet->data + payload, sizeof(send_time));
+            packet->header.send_time = (int64_t)be64toh(send_time);
+            packet->header.length -= RUDP_TIMESTAMP_SIZE;
+        }
+        return payload;
+    }
+}
+
+// Takes the checkpoint offer the server's handshake confirmation carries, size bytes at data: file ID, chunk count
+// and the runs of chunks the server has, see rudp_checkpoint_offer(). An offer for another file than the one
+// announced is ignored.
+static void rudp_take_offer(RUDP_Socket *sockfd, const char *data, int size)
+{
+    const uint8_t *wire = (const uint8_t *)data;
+    uint64_t file_id;
+    if (sockfd->file_id == 0 || size < 12)
+    {
+        return;
+    }
+    memcpy(&file_id, wire, sizeof(file_id));
+    uint32_t chunks = rudp_get32(wire + 8);
+    if (be64toh(file_id) != sockfd->file_id)
+    {
+        return;
+    }
+    free(sockfd->delivered);
+    sockfd->delivered = (uint8_t *)calloc(chunks > 0 ? chunks : 1, sizeof(uint8_t));
+    if (sockfd->delivered == NULL)
+    {
+        return;
+    }
+    for (int run = 12; run + 8 <= size; run += 8)
+    {
+        uint64_t first = rudp_get32(wire + run);
+        uint64_t end = first + rudp_get32(wire + run + 4);
+        for (uint64_t i = first; i < end && i < chunks; i++)
+        {
+            sockfd->delivered[i] = 1;
+        }
+    }
+    sockfd->delivered_chunks = chunks;
+}
+
+// Tries to connect to the other side via RUDP to given IP and port.
+// Returns 0 on failure and 1 on success.
+// Fails if called when the socket is connected/set to server.
+int rudp_connect(RUDP_Socket *sockfd, const char *dest_ip, unsigned short int dest_port)
+{
+    if (sockfd->isServer || sockfd->isConnected)
+    {
+        fprintf(stderr, "Socket is already connected.\n");
+        return 0;
+    }
+    memset(&sockfd->dest_addr, 0, sizeof(sockfd->dest_addr));
+    sockfd->dest_addr.sin_family = AF_INET;
+    if (inet_pton(AF_INET, dest_ip, &sockfd->dest_addr.sin_addr) <= 0)
+    {
+        perror("inet_pton(3)");
+        return 0;
+    }
+    sockfd->dest_addr.sin_port = htons(dest_port);
+
+    // send syn
+    printf("Sending SYN packet.\n");
+    struct timeval syn_time, syn_ack_time;
+    gettimeofday(&syn_time, NULL);
+    // announce the file to continue, if any, so the server can offer its checkpoint. The SYN is padded: the server
+    // answers it with no more bytes than it got, as long as the client's address is not verified.
+    char syn[SYN_SIZE] = {0};
+    uint64_t wire_file_id = htobe64(sockfd->file_id);
+    memcpy(syn, &wire_file_id, sizeof(wire_file_id));
+    // the SYN is resent until the SYN-ACK arrives, so the round trip below includes any retransmissions
+    int sent = rudp_send_reliable(sockfd, SYN, syn, sizeof(syn));
+    if (sent == -1)
+    {
+        printf("Failed to send SYN packet.\n");
+        return 0;
+    }
+
+    RUDP_Packet packet;
+    int recv = rudp_receive(sockfd, &packet);
+    rudp_answered(sockfd);
+    if (recv == -1)
+    {
+        printf("Failed to receive SYN-ACK packet.\n");
+        return 0;
+    }
+    if (packet.header.flags == SYN_ACK)
+    {
+        printf("Received SYN-ACK packet.\n");
+        gettimeofday(&syn_ack_time, NULL);
+        rudp_set_rtt(sockfd, (uint32_t)(rudp_elapsed_ms(&syn_time, &syn_ack_time) * 1000));
+
+        // the SYN-ACK starts with the server's SYN cookie, to be echoed in the ACK
+        uint64_t cookie = 0;
+        if (recv >= (int)sizeof(cookie))
+        {
+            memcpy(&cookie, packet.data, sizeof(cookie));
+        }
+
+        // keep the session ticket, if the server issued one
+        if (recv >= (int)(sizeof(cookie) + sizeof(RUDP_Ticket)))
+        {
+            memcpy(&sockfd->ticket, packet.data + sizeof(cookie), sizeof(RUDP_Ticket));
+            sockfd->hasTicket = true;
+        }
+
+        // send ack, the cookie and the file ID from the SYN let the server complete the handshake without state.
+        // It is resent until the server confirms, a lost ACK would leave the server ignoring the data that follows.
+        printf("Sending ACK packet.\n");
+        char echo[2 * sizeof(uint64_t)];
+        memcpy(echo, &cookie, sizeof(cookie));
+        memcpy(echo + sizeof(cookie), &wire_file_id, sizeof(wire_file_id));
+        sent = rudp_send_reliable(sockfd, ACK, echo, sizeof(echo));
+        if (sent == -1)
+        {
+            return 0;
+        }
+        // the confirmation is an ACK, anything else (such as another SYN-ACK) is skipped
+        do
+        {
+            recv = rudp_receive(sockfd, &packet);
+        } while (recv >= 0 && packet.header.flags != ACK);
+        rudp_answered(sockfd);
+        if (recv == -1)
+        {
+            printf("Failed to receive the handshake confirmation.\n");
+            return 0;
+        }
+        rudp_take_offer(sockfd, packet.data, recv);
+        sockfd->isConnected = true;
+    }
+    else
+    {
+        printf("Received unexpected packet.\n");
+        printf("Received %d\n", packet.header.flags);
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the SYN cookie for a handshake with peer in the given time slot: a keyed hash of the peer's address and
+// port and of the file its SYN announced, so only the peer that got the SYN-ACK can echo it back, and the file ID
+// it repeats in the ACK can be trusted.
+static uint64_t rudp_syn_cookie(const struct sockaddr_in *peer, uint32_t slot, uint64_t file_id)
+{
+    uint8_t key[16];
+    uint32_t fields[5] = {peer->sin_addr.s_addr, peer->sin_port, slot, (uint32_t)file_id, (uint32_t)(file_id >> 32)};
+    if (rudp_ticket_key(key) < 0)
+    {
+        return 0;
+    }
+    return rudp_siphash(key, fields, sizeof(fields));
+}
+
+// Checks the ACK that completes a handshake: the cookie from the SYN-ACK, then the file ID the SYN announced.
+// Cookies stay valid for one to two COOKIE_PERIOD_MS periods.
+// Returns true if the cookie is valid, and stores the file ID (0 for none) in file_id.
+static bool rudp_syn_cookie_valid(const struct sockaddr_in *peer, const RUDP_Packet *ack, int length, uint64_t *file_id)
+{
+    uint64_t cookie, wire_file_id;
+    if (ack->header.flags != ACK || length < (int)(sizeof(cookie) + sizeof(wire_file_id)))
+    {
+        return false;
+    }
+    memcpy(&cookie, ack->data, sizeof(cookie));
+    memcpy(&wire_file_id, ack->data + sizeof(cookie), sizeof(wire_file_id));
+    *file_id = be64toh(wire_file_id);
+    uint32_t slot = (uint32_t)(rudp_now_ms() / COOKIE_PERIOD_MS);
+    uint64_t current = rudp_syn_cookie(peer, slot, *file_id), previous = rudp_syn_cookie(peer, slot - 1, *file_id);
+    bool current_match = rudp_equal_ct(&cookie, &current, sizeof(cookie));
+    bool previous_match = rudp_equal_ct(&cookie, &previous, sizeof(cookie));
+    return cookie != 0 && (current_match | previous_match);
+}
+
+// Confirms a completed handshake to the client, which resends its ACK until the confirmation arrives. The
+// confirmation carries the checkpoint offer if the client announced a file: the cookie in its ACK verified its
+// address, so the offer only ever goes to the peer that asked for it.
+static void rudp_confirm_handshake(RUDP_Socket *sockfd)
+{
+    char offer[CHUNK_SIZE];
+    size_t offer_size = 0;
+    if (sockfd->checkpoint != NULL && sockfd->file_id != 0)
+    {
+        offer_size = rudp_checkpoint_offer(sockfd->checkpoint, sockfd->file_id, offer, sizeof(offer));
+    }
+    RUDP_Header header = rudp_header(sockfd, ACK);
+    rudp_sendto(sockfd, &header, offer, offer_size, &sockfd->dest_addr);
+}
+
+// Answers the connected client's handshake ACK once more, if packet (length payload bytes from peer) is one:
+// the client resends it when the confirmation was lost.
+// Returns true if packet was a repeated handshake ACK.
+static bool rudp_handshake_repeated(RUDP_Socket *sockfd, const struct sockaddr_in *peer, const RUDP_Packet *packet, int length)
+{
+    uint64_t file_id;
+    if (packet->header.connection_id != sockfd->connection_id || !rudp_same_peer(peer, &sockfd->dest_addr) || !rudp_syn_cookie_valid(peer, packet, length, &file_id))
+    {
+        return false;
+    }
+    rudp_confirm_handshake(sockfd);
+    return true;
+}
+
+// Completes a handshake on the server once the client's ACK checks out: the socket takes on the client's
+// connection ID, and a checkpointing server switches its checkpoint to the announced file (0 for none).
+// Returns true if the client continues the file the checkpoint holds.
+static bool rudp_handshake_complete(RUDP_Socket *sockfd, uint32_t connection_id, uint64_t file_id)
+{
+    sockfd->connection_id = connection_id;
+    sockfd->file_id = file_id;
+    sockfd->isContinued = sockfd->checkpoint != NULL && rudp_checkpoint_adopt(sockfd->checkpoint, file_id);
+    return sockfd->isContinued;
+}
+
+// Accepts incoming connection request and completes the handshake, returns 0 on failure and 1 on success.
+// Fails if called when the socket is connected/set to client.
+// The handshake is stateless until it completes: a SYN is answered with a SYN-ACK carrying a SYN cookie, and the
+// socket only takes on a peer whose ACK echoes a valid cookie (or who resumes with a valid session ticket). A flood
+// of SYNs costs a hash and a datagram each, and never holds up the clients that finish their handshake.
+int rudp_accept(RUDP_Socket *sockfd)
+{
+    if (!sockfd->isServer || sockfd->isConnected)
+    {
+        return 0;
+    }
+
+    printf("Waiting for connection...\n");
+
+    RUDP_Packet packet;
+    struct sockaddr_in peer;
+    struct msghdr message = {.msg_name = &peer};
+    while (1)
+    {
+        message.msg_namelen = sizeof(peer);
+        message.msg_controllen = 0;
+        int recv = rudp_recvmsg(sockfd, &packet, &message);
+        if (recv == -1)
+        {
+            perror("recvmsg");
+            return 0;
+        }
+
+        // a returning client presents its session ticket with its first chunk, without a handshake
+        if (packet.header.flags == RESUME)
+        {
+            RUDP_Ticket ticket;
+            if (recv >= (int)(sizeof(RUDP_Ticket)))
+            {
+                memcpy(&ticket, packet.data, sizeof(ticket));
+            }
+            if (recv >= (int)(sizeof(RUDP_Ticket)) && rudp_ticket_valid(&ticket, &peer) && rudp_ticket_claim(&ticket))
+            {
+                printf("Received RESUME packet with a valid session ticket.\n");
+                sockfd->dest_addr = peer;
+                // a resumed session announces no file, whatever the checkpoint holds is not continued
+                rudp_handshake_complete(sockfd, packet.header.connection_id, 0);
+                sockfd->isConnected = true;
+                sockfd->isResumed = true;
+                rudp_connection_timers(sockfd);
+
+                // what follows the ticket is the first chunk, the next receive takes it
+                int chunk = recv - (int)sizeof(RUDP_Ticket);
+                if (chunk > 0)
+                {
+                    sockfd->early.header = packet.header;
+                    sockfd->early.header.flags = PUSH;
+                    sockfd->early.header.length -= sizeof(RUDP_Ticket);
+                    memcpy(sockfd->early.data, packet.data + sizeof(RUDP_Ticket), chunk);
+                    sockfd->early_size = chunk;
+                }
+
+                // the ticket is used up, the client gets the next one
+                rudp_issue_ticket(&ticket, &peer);
+                rudp_send(sockfd, RESUME_ACK, (char *)&ticket, sizeof(ticket));
+                printf("Resumed session with %s:%d\n", inet_ntoa(sockfd->dest_addr.sin_addr), ntohs(sockfd->dest_addr.sin_port));
+                return 1;
+            }
+            // a forged, expired or replayed ticket: tell the client, so it falls back to a SYN right away
+            printf("Rejected session ticket, waiting for SYN...\n");
+            RUDP_Header reject = {.flags = RESUME_REJECT, .connection_id = packet.header.connection_id};
+            rudp_sendto(sockfd, &reject, NULL, 0, &peer);
+            continue;
+        }
+
+        if (packet.header.flags == SYN)
+        {
+            rudp_answer_syn(sockfd, &packet, &peer);
+            continue;
+        }
+
+        uint64_t file_id;
+        if (rudp_syn_cookie_valid(&peer, &packet, recv, &file_id))
+        {
+            printf("Received ACK packet.\n");
+            sockfd->dest_addr = peer;
+            rudp_handshake_complete(sockfd, packet.header.connection_id, file_id);
+            rudp_confirm_handshake(sockfd);
+            sockfd->isConnected = true;
+            rudp_connection_timers(sockfd);
+            printf("Connected to %s:%d\n", inet_ntoa(sockfd->dest_addr.sin_addr), ntohs(sockfd->dest_addr.sin_port));
+            return 1;
+        }
+    }
+}
+
+// Answers a SYN from peer with a SYN-ACK: a SYN cookie, and a session ticket for the next connection if the SYN
+// left room for it. The peer's address is not verified yet, so the SYN-ACK is never larger than the SYN and the
+// server can not be made to reflect more than it receives; a SYN too short for the cookie goes unanswered.
+// Keeps no state, the client's ACK completes the handshake (see rudp_confirm_handshake() for the checkpoint offer).
+// Returns 0 on failure and 1 on success.
+static int rudp_answer_syn(RUDP_Socket *sockfd, RUDP_Packet *syn, const struct sockaddr_in *peer)
+{
+    printf("Received SYN packet.\n");
+
+    RUDP_Packet packet;
+    uint64_t file_id = 0;
+    uint64_t cookie;
+    size_t syn_size = syn->header.length + (syn->header.send_time != 0 ? RUDP_TIMESTAMP_SIZE : 0);
+    size_t budget = syn_size - RUDP_HEADER_SIZE - (sockfd->timestamps ? RUDP_TIMESTAMP_SIZE : 0);
+    if (syn_size < RUDP_HEADER_SIZE + (sockfd->timestamps ? RUDP_TIMESTAMP_SIZE : 0) + sizeof(cookie))
+    {
+        printf("SYN too short to answer.\n");
+        return 0;
+    }
+    if (syn->header.length >= RUDP_HEADER_SIZE + sizeof(uint64_t))
+    {
+        memcpy(&file_id, syn->data, sizeof(file_id));
+        file_id = be64toh(file_id);
+    }
+
+    printf("Sending SYN-ACK packet.\n");
+    cookie = rudp_syn_cookie(peer, (uint32_t)(rudp_now_ms() / COOKIE_PERIOD_MS), file_id);
+    size_t payload_size = sizeof(cookie);
+    memcpy(packet.data, &cookie, sizeof(cookie));
+    if (budget >= sizeof(cookie) + sizeof(RUDP_Ticket))
+    {
+        rudp_issue_ticket((RUDP_Ticket *)(packet.data + sizeof(cookie)), peer);
+        payload_size += sizeof(RUDP_Ticket);
+    }
+
+    // the SYN-ACK goes out under the connection ID of the SYN, the socket has no connection yet
+    packet.header = rudp_header(sockfd, SYN_ACK);
+    packet.header.connection_id = syn->header.connection_id;
+    if (rudp_sendto(sockfd, &packet.header, packet.data, payload_size, peer) == -1)
+    {
+        printf("Failed to send SYN-ACK packet.\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the path of the client's session cache for the server at dest_ip:dest_port.
+static void rudp_session_path(char *path, size_t size, const char *dest_ip, unsigned short int dest_port)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "%s_%s_%d", SESSION_CACHE_PREFIX, dest_ip, dest_port);
+    rudp_state_path(path, size, name);
+}
+
+// Drops the cached session for the server, so the next rudp_resume() does a full handshake.
+void rudp_forget_session(const char *dest_ip, unsigned short int dest_port)
+{
+    char path[PATH_MAX];
+    rudp_session_path(path, sizeof(path), dest_ip, dest_port);
+    unlink(path);
+}
+
+// Caches the socket's session ticket and round trip time for the next rudp_resume() to the same server.
+static void rudp_save_session(const RUDP_Socket *sockfd)
+{
+    char path[PATH_MAX];
+    RUDP_Session session;
+    rudp_session_path(path, sizeof(path), inet_ntoa(sockfd->dest_addr.sin_addr), ntohs(sockfd->dest_addr.sin_port));
+    session.ticket = sockfd->ticket;
+    session.rtt_us = sockfd->rtt_us;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, &session, sizeof(session)) != sizeof(session))
+    {
+        perror("open(2)");
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// Connects like rudp_connect(), but skips the handshake when an earlier connection to the same server left a
+// session ticket in the cache: the ticket goes out in front of the first chunk, in a RESUME packet (0-RTT).
+// A ticket is good for one RESUME, so it leaves the cache here and the server's RESUME_ACK brings the next one.
+// After a full handshake the new ticket and the measured round trip time are cached for next time.
+// Returns 0 on failure and 1 on success. sockfd->isResumed tells which path was taken.
+int rudp_resume(RUDP_Socket *sockfd, const char *dest_ip, unsigned short int dest_port)
+{
+    if (sockfd->isServer || sockfd->isConnected)
+    {
+        fprintf(stderr, "Socket is already connected.\n");
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    rudp_session_path(path, sizeof(path), dest_ip, dest_port);
+
+    RUDP_Session session;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        ssize_t bytes_read = read(fd, &session, sizeof(session));
+        close(fd);
+
+        uint32_t now = (uint32_t)time(NULL);
+        if (bytes_read == sizeof(session) && now - ntohl(session.ticket.issued) < ntohl(session.ticket.lifetime))
+        {
+            memset(&sockfd->dest_addr, 0, sizeof(sockfd->dest_addr));
+            sockfd->dest_addr.sin_family = AF_INET;
+            if (inet_pton(AF_INET, dest_ip, &sockfd->dest_addr.sin_addr) <= 0)
+            {
+                perror("inet_pton(3)");
+                return 0;
+            }
+            sockfd->dest_addr.sin_port = htons(dest_port);
+
+            printf("Resuming the session, the ticket goes out with the first packet.\n");
+            unlink(path);
+            sockfd->ticket = session.ticket;
+            sockfd->resumePending = true;
+            // reuse what the last handshake measured instead of probing again, timeouts included
+            rudp_set_rtt(sockfd, session.rtt_us);
+            sockfd->isConnected = true;
+            sockfd->isResumed = true;
+            return 1;
+        }
+    }
+
+    if (rudp_connect(sockfd, dest_ip, dest_port) == 0)
+    {
+        return 0;
+    }
+
+    if (sockfd->hasTicket)
+    {
+        rudp_save_session(sockfd);
+    }
+    return 1;
+}
+
+// Receives data from the other side and put it into the buffer.
+// Returns the number of received bytes on success, 0 if got FIN packet (disconnect), and -1 on error.
+int rudp_receive(RUDP_Socket *rudp_socket, RUDP_Packet *packet)
+{
+    size_t total_received = 0;
+    // datagrams from anyone but the connection's peer are dropped, they never change its address
+    struct sockaddr_in peer;
+    struct msghdr message = {.msg_name = &peer};
+
+    if (rudp_socket->isServer)
+    {
+
+        while (total_received < TRANSFER_SIZE)
+        {
+            message.msg_namelen = sizeof(peer);
+            int bytes_received = rudp_recvmsg(rudp_socket, packet, &message);
+            if (bytes_received < 0)
+            {
+                printf("%s:%d\n", inet_ntoa(rudp_socket->dest_addr.sin_addr), ntohs(rudp_socket->dest_addr.sin_port));
+                perror("recvfrom");
+                return -1;
+            }
+            if (rudp_socket->isConnected && (packet->header.connection_id != rudp_socket->connection_id || !rudp_same_peer(&peer, &rudp_socket->dest_addr)))
+            {
+                continue;
+            }
+            if (rudp_socket->isConnected && rudp_handshake_repeated(rudp_socket, &peer, packet, bytes_received))
+            {
+                continue;
+            }
+
+            size_t data_size = bytes_received;
+
+            if (packet->header.flags == SYN || packet->header.flags == SYN_ACK || packet->header.flags == ACK || packet->header.flags == FIN_ACK || packet->header.flags == RESUME)
+            {
+                // Ignore control packets (SYN, SYN-ACK, ACK, FIN, RESUME)
+                break;
+            }
+            else if (packet->header.flags == FIN)
+            {
+                return 0;
+            }
+
+            total_received += data_size;
+
+            // Check if all data has been received
+            if (total_received >= TRANSFER_SIZE)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        // only receive connection packets, waiting at most MAX_WAIT_TIME for the server to answer
+        rudp_timer_start(rudp_socket->timers, &rudp_socket->response, MAX_WAIT_TIME * 1000, rudp_on_response_timeout, rudp_socket);
+        while (1)
+        {
+            message.msg_namelen = sizeof(peer);
+            int bytes_received = rudp_recvmsg(rudp_socket, packet, &message);
+            if (bytes_received < 0)
+            {
+                rudp_timer_cancel(rudp_socket->timers, &rudp_socket->response);
+                perror("recvfrom");
+                return -1;
+            }
+            if (packet->header.connection_id != rudp_socket->connection_id || !rudp_same_peer(&peer, &rudp_socket->dest_addr))
+            {
+                // a stray answer to an earlier connection from the same port, or a datagram from someone else
+                continue;
+            }
+            if (packet->header.flags == SYN_ACK && rudp_socket->isConnected)
+            {
+                // the server answered a retransmitted SYN as well, the handshake is already done
+                continue;
+            }
+            if (packet->header.flags == KEEPALIVE)
+            {
+                // answer the server's probe, so it keeps the connection
+                rudp_send(rudp_socket, KEEPALIVE, NULL, 0);
+                continue;
+            }
+            if (packet->header.flags == RESUME_ACK)
+            {
+                // the server took the ticket and handed out the next one
+                if (bytes_received == (int)sizeof(RUDP_Ticket))
+                {
+                    memcpy(&rudp_socket->ticket, packet->data, sizeof(RUDP_Ticket));
+                    rudp_socket->hasTicket = true;
+                    rudp_save_session(rudp_socket);
+                }
+                continue;
+            }
+            if (packet->header.flags == RESUME_REJECT)
+            {
+                // the server refused the ticket, and dropped whatever was sent with it
+                rudp_timer_cancel(rudp_socket->timers, &rudp_socket->response);
+                errno = ECONNREFUSED;
+                return -1;
+            }
+            if (packet->header.flags == ACK && packet->header.acknowledgment_number != 0 && bytes_received == 0)
+            {
+                // a progress ACK: the server is still busy receiving, give it another MAX_WAIT_TIME
+                rudp_socket->progress_acks++;
+                rudp_timer_start(rudp_socket->timers, &rudp_socket->response, MAX_WAIT_TIME * 1000, rudp_on_response_timeout, rudp_socket);
+                continue;
+            }
+            rudp_timer_cancel(rudp_socket->timers, &rudp_socket->response);
+            if (packet->header.flags == SYN || packet->header.flags == SYN_ACK || packet->header.flags == ACK || packet->header.flags == FIN_ACK)
+            {
+                return bytes_received;
+            }
+            else if (packet->header.flags == FIN)
+            {
+                return 0;
+            }
+            break;
+        }
+    }
+    return total_received;
+}
+
+// Sends data stores in buffer to the other side.
+// Returns the number of sent bytes on success and -1 on error.
+int rudp_send(RUDP_Socket *rudp_socket, uint8_t flags, char *data, size_t data_size)
+{
+
+    if (flags == SYN || flags == SYN_ACK || flags == ACK || flags == FIN || flags == FIN_ACK || flags == RESUME || flags == RESUME_ACK || flags == KEEPALIVE)
+    {
+        // If SYN, SYN-ACK, ACK, FIN, or FIN-ACK flags are set, send packet with header only,
+        // unless the control packet carries a small payload (such as the digest on a completion ACK)
+        size_t payload = data != NULL && data_size <= CHUNK_SIZE ? data_size : 0;
+        RUDP_Header header = rudp_header(rudp_socket, flags); // sequence, acknowledgment and stream all 0
+
+        if (rudp_sendto(rudp_socket, &header, data, payload, &rudp_socket->dest_addr) == -1)
+        {
+            return -1; // Return -1 on failure
+        }
+    }
+    else
+    {
+        // If data packet, split data into chunks and send them starting at sequence number 0
+        RUDP_Range range = {.buffer = data, .size = data_size, .first_sequence = 0};
+        return rudp_send_range(rudp_socket, &range);
+    }
+
+    return data_size; // Return the size of the data sent on success
+}
+
+// Sends one PUSH chunk of a stream (0 for a plain range) with the given sequence number, straight from data.
+// Returns 0 on success and -1 on error.
+static int rudp_send_chunk(RUDP_Socket *rudp_socket, RUDP_Header *header, uint16_t stream_id, uint32_t sequence_number, const char *data, size_t size)
+{
+    *header = rudp_header(rudp_socket, PUSH);
+    header->sequence_number = sequence_number;
+    header->stream_id = stream_id;
+    return rudp_sendto(rudp_socket, header, data, size, &rudp_socket->dest_addr) == -1 ? -1 : 0;
+}
+
+// Matches the transmit timestamps queued on the socket with the send times of the range's chunks.
+// sent_at[i] is the send time of the chunk that went out as datagram first_index + i.
+static void rudp_collect_tx_timestamps(RUDP_Socket *rudp_socket, RUDP_Range *range, const int64_t *sent_at, uint32_t first_index, size_t count)
+{
+    uint32_t index;
+    int64_t timestamp;
+    while (latency_tx_timestamp(rudp_socket->socket_fd, &index, &timestamp) > 0)
+    {
+        uint32_t chunk = index - first_index;
+        if (chunk < count)
+        {
+            latency_add(&range->send_to_wire, timestamp - sent_at[chunk]);
+        }
+    }
+}
+
+// Sends the range as PUSH chunks numbered from range->first_sequence on, so that several flows can share one sequence space.
+// Every chunk is folded into range->digest right after it is handed to the kernel.
+// Chunks set in range->chunk_map (if any) are already at the receiver: they are hashed but not sent.
+// Returns the number of bytes in the range on success and -1 on error.
+int rudp_send_range(RUDP_Socket *rudp_socket, RUDP_Range *range)
+{
+    RUDP_Header header;
+
+    char *data = range->buffer;
+    size_t data_size = range->size;
+    size_t total_sent = 0;
+    uint32_t sequence_number = range->first_sequence;
+    range->digest = 0;
+    range->digest_ms = 0;
+    range->resumed = 0;
+
+    // With transmit timestamps on, remember when every chunk was handed to the kernel.
+    size_t chunks = (data_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    int64_t *sent_at = NULL;
+    uint32_t first_index = rudp_socket->tx_index;
+    latency_reset(&range->send_to_wire);
+    if (rudp_socket->timestamps)
+    {
+        sent_at = (int64_t *)malloc((chunks > 0 ? chunks : 1) * sizeof(int64_t));
+    }
+
+    while (total_sent < data_size)
+    {
+        size_t remaining = data_size - total_sent;
+        size_t chunk_size = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+
+        if (range->chunk_map != NULL && range->chunk_map[sequence_number - range->first_sequence])
+        {
+            range->digest = crc64_update(range->digest, data + total_sent, chunk_size);
+            range->resumed += chunk_size;
+            sequence_number++;
+            total_sent += chunk_size;
+            continue;
+        }
+
+        // Send the packet
+        if (rudp_send_chunk(rudp_socket, &header, 0, sequence_number, data + total_sent, chunk_size) == -1)
+        {
+            free(sent_at);
+            return -1; // Return -1 on failure
+        }
+
+        if (sent_at != NULL)
+        {
+            size_t chunk = sequence_number - range->first_sequence;
+            sent_at[chunk] = header.send_time;
+            // drain the error queue now and then, it counts against the socket's receive buffer
+            if (chunk % 64 == 63)
+            {
+                rudp_collect_tx_timestamps(rudp_socket, range, sent_at, first_index, chunks);
+            }
+        }
+
+        struct timeval hash_start, hash_end;
+        gettimeofday(&hash_start, NULL);
+        range->digest = crc64_update(range->digest, data + total_sent, chunk_size);
+        gettimeofday(&hash_end, NULL);
+        range->digest_ms += rudp_elapsed_ms(&hash_start, &hash_end);
+
+        // Increment sequence number by the size of the chunk sent
+        sequence_number++;
+
+        total_sent += chunk_size;
+    }
+
+    if (sent_at != NULL)
+    {
+        rudp_collect_tx_timestamps(rudp_socket, range, sent_at, first_index, chunks);
+        free(sent_at);
+    }
+
+    return data_size;
+}
+
+// Entry of the rudp_send_streams() ready queue: a stream with chunks left, ordered by priority and then by the
+// turn it was queued in, so that streams of equal priority are served round robin.
+typedef struct
+{
+    uint8_t priority;
+    uint32_t turn;
+    int stream;
+} RUDP_Ready;
+
+static inline bool rudp_ready_before(const RUDP_Ready *a, const RUDP_Ready *b)
+{
+    return a->priority != b->priority ? a->priority < b->priority : a->turn < b->turn;
+}
+
+// Adds an entry to the ready queue, a binary min-heap of *size entries.
+static void rudp_ready_push(RUDP_Ready *queue, int *size, RUDP_Ready entry)
+{
+    int i = (*size)++;
+    while (i > 0 && rudp_ready_before(&entry, &queue[(i - 1) / 2]))
+    {
+        queue[i] = queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue[i] = entry;
+}
+
+// Removes and returns the most urgent entry of a non-empty ready queue.
+static RUDP_Ready rudp_ready_pop(RUDP_Ready *queue, int *size)
+{
+    RUDP_Ready top = queue[0];
+    RUDP_Ready last = queue[--(*size)];
+    int i = 0;
+    while (2 * i + 1 < *size)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < *size && rudp_ready_before(&queue[child + 1], &queue[child]))
+        {
+            child++;
+        }
+        if (!rudp_ready_before(&queue[child], &last))
+        {
+            break;
+        }
+        queue[i] = queue[child];
+        i = child;
+    }
+    queue[i] = last;
+    return top;
+}
+
+// Sends count streams over one connection, a chunk at a time. The next chunk always comes from the most urgent
+// (lowest priority value) stream that has data left, and streams of equal priority take turns, so they are all in
+// flight together. A ready queue picks the stream, in O(log count) per chunk.
+// Chunks carry the stream ID and their index in the stream as sequence number. Each stream's digest covers its
+// own range, chunks set in a stream's chunk_map are skipped.
+// Returns the number of bytes in all the streams on success and -1 on error.
+int rudp_send_streams(RUDP_Socket *rudp_socket, RUDP_Stream *streams, int count)
+{
+    RUDP_Header header;
+    RUDP_Ready queue[MAX_STREAMS];
+    int queued = 0;
+    uint32_t turn = 0;
+    size_t total = 0;
+
+    if (count > MAX_STREAMS)
+    {
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        streams[i].next_chunk = 0;
+        streams[i].range.digest = 0;
+        streams[i].range.digest_ms = 0;
+        streams[i].range.resumed = 0;
+        total += streams[i].range.size;
+        if (streams[i].range.size > 0)
+        {
+            rudp_ready_push(queue, &queued, (RUDP_Ready){streams[i].priority, turn++, i});
+        }
+    }
+
+    while (queued > 0)
+    {
+        RUDP_Ready ready = rudp_ready_pop(queue, &queued);
+        RUDP_Stream *stream = &streams[ready.stream];
+        RUDP_Range *range = &stream->range;
+        size_t offset = stream->next_chunk * CHUNK_SIZE;
+        size_t chunk_size = range->size - offset < CHUNK_SIZE ? range->size - offset : CHUNK_SIZE;
+
+        if (range->chunk_map != NULL && range->chunk_map[stream->next_chunk])
+        {
+            range->resumed += chunk_size;
+        }
+        else if (rudp_send_chunk(rudp_socket, &header, stream->id, (uint32_t)stream->next_chunk, range->buffer + offset, chunk_size) == -1)
+        {
+            return -1;
+        }
+
+        struct timeval hash_start, hash_end;
+        gettimeofday(&hash_start, NULL);
+        range->digest = crc64_update(range->digest, range->buffer + offset, chunk_size);
+        gettimeofday(&hash_end, NULL);
+        range->digest_ms += rudp_elapsed_ms(&hash_start, &hash_end);
+
+        // back of its priority's line, behind the streams of that priority that were waiting
+        stream->next_chunk++;
+        if (stream->next_chunk * CHUNK_SIZE < range->size)
+        {
+            ready.turn = turn++;
+            rudp_ready_push(queue, &queued, ready);
+        }
+    }
+
+    return total;
+}
+
+// Splits total bytes into flows chunk-aligned stripes and returns the bounds of stripe index.
+// Both sides call this with the same arguments so they agree on which sequence numbers each flow carries.
+void rudp_stripe(size_t total, int flows, int index, size_t *offset, size_t *length)
+{
+    size_t chunks = (total + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t first_chunk = chunks * index / flows;
+    size_t end_chunk = chunks * (index + 1) / flows;
+    size_t end = end_chunk * CHUNK_SIZE < total ? end_chunk * CHUNK_SIZE : total;
+
+    *offset = first_chunk * CHUNK_SIZE;
+    *length = end > *offset ? end - *offset : 0;
+}
+
+// Identifies a file by its path, size, modification time and inode, so an edited file is never continued.
+uint64_t rudp_file_id(const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) < 0)
+    {
+        perror("stat(2)");
+        return 0;
+    }
+    uint64_t fields[4] = {(uint64_t)info.st_size, (uint64_t)info.st_mtim.tv_sec, (uint64_t)info.st_mtim.tv_nsec, (uint64_t)info.st_ino};
+    uint64_t id = crc64_update(crc64_update(0, path, strlen(path)), fields, sizeof(fields));
+    return id != 0 ? id : 1;
+}
+
+// Size of the checkpoint file: magic, file ID, chunk count, then one bit per chunk.
+#define CHECKPOINT_IMAGE_SIZE(chunks) (20 + ((chunks) + 7) / 8)
+#define CHECKPOINT_BLOCKS(chunks) ((CHECKPOINT_IMAGE_SIZE(chunks) + CHECKPOINT_BLOCK - 1) / CHECKPOINT_BLOCK)
+
+// Rebuilds the image from the chunk map: magic, file ID, chunk count, then one bit per chunk. Call with the lock
+// held, and only where the file changes, the bits are otherwise kept current by rudp_checkpoint_mark().
+static void rudp_checkpoint_build(RUDP_Checkpoint *checkpoint)
+{
+    size_t size = CHECKPOINT_IMAGE_SIZE(checkpoint->chunks);
+    uint8_t *image = checkpoint->image;
+    uint64_t magic = htobe64(CHECKPOINT_MAGIC), file_id = htobe64(checkpoint->file_id);
+    uint32_t chunks = htonl((uint32_t)checkpoint->chunks);
+    memcpy(image, &magic, 8);
+    memcpy(image + 8, &file_id, 8);
+    memcpy(image + 16, &chunks, 4);
+    memset(image + 20, 0, size - 20);
+    for (size_t i = 0; i < checkpoint->chunks; i++)
+    {
+        image[20 + i / 8] |= (__atomic_load_n(&checkpoint->chunk_map[i], __ATOMIC_RELAXED) != 0) << (i % 8);
+    }
+}
+
+// Writes the whole checkpoint file after rudp_checkpoint_build(). Call with the lock held.
+static void rudp_checkpoint_write(RUDP_Checkpoint *checkpoint)
+{
+    size_t size = CHECKPOINT_IMAGE_SIZE(checkpoint->chunks);
+    rudp_checkpoint_build(checkpoint);
+    memset(checkpoint->dirty, 0, CHECKPOINT_BLOCKS(checkpoint->chunks));
+    if (pwrite(checkpoint->fd, checkpoint->image, size, 0) != (ssize_t)size)
+    {
+        perror("pwrite(2)");
+    }
+}
+
+// Records a chunk of the file as received: in the chunk map and in the image, whose block the next save writes.
+// Relaxed atomics, the flows record their chunks concurrently and a save that misses one writes it the next time.
+static void rudp_checkpoint_mark(RUDP_Checkpoint *checkpoint, size_t chunk)
+{
+    size_t byte = 20 + chunk / 8;
+    __atomic_store_n(&checkpoint->chunk_map[chunk], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&checkpoint->image[byte], (uint8_t)(1 << (chunk % 8)), __ATOMIC_RELAXED);
+    __atomic_store_n(&checkpoint->dirty[byte / CHECKPOINT_BLOCK], 1, __ATOMIC_RELAXED);
+}
+
+// Forgets every chunk of the checkpoint. Call with the lock held.
+static void rudp_checkpoint_empty(RUDP_Checkpoint *checkpoint)
+{
+    for (size_t i = 0; i < checkpoint->chunks; i++)
+    {
+        __atomic_store_n(&checkpoint->chunk_map[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Opens the checkpoint at path for a file of size bytes, loading what an earlier run recorded.
+// spool_valid tells whether the data those chunks went to survived; if not, the checkpoint starts empty.
+// Returns 0 on success and -1 on error.
+int rudp_checkpoint_open(RUDP_Checkpoint *checkpoint, const char *path, size_t size, bool spool_valid)
+{
+    memset(checkpoint, 0, sizeof(RUDP_Checkpoint));
+    checkpoint->chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    checkpoint->chunk_map = (uint8_t *)calloc(checkpoint->chunks > 0 ? checkpoint->chunks : 1, sizeof(uint8_t));
+    checkpoint->image = (uint8_t *)malloc(CHECKPOINT_IMAGE_SIZE(checkpoint->chunks));
+    checkpoint->dirty = (uint8_t *)calloc(CHECKPOINT_BLOCKS(checkpoint->chunks), sizeof(uint8_t));
+    if (checkpoint->chunk_map == NULL || checkpoint->image == NULL || checkpoint->dirty == NULL)
+    {
+        perror("malloc(3)");
+        free(checkpoint->chunk_map);
+        free(checkpoint->image);
+        free(checkpoint->dirty);
+        return -1;
+    }
+    pthread_mutex_init(&checkpoint->lock, NULL);
 
-    if (isServer)
+    checkpoint->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (checkpoint->fd < 0)
     {
+        perror("open(2)");
+        free(checkpoint->chunk_map);
+        free(checkpoint->image);
+        free(checkpoint->dirty);
+        return -1;
+    }
 
-        if (bind(sockfd->socket_fd, (struct sockaddr *)&server, sizeof(server)) < 0)
+    size_t image_size = CHECKPOINT_IMAGE_SIZE(checkpoint->chunks);
+    uint8_t *image = checkpoint->image;
+    uint64_t magic, file_id;
+    uint32_t chunks;
+    if (spool_valid && pread(checkpoint->fd, image, image_size, 0) == (ssize_t)image_size)
+    {
+        memcpy(&magic, image, 8);
+        memcpy(&file_id, image + 8, 8);
+        memcpy(&chunks, image + 16, 4);
+        if (be64toh(magic) == CHECKPOINT_MAGIC && ntohl(chunks) == checkpoint->chunks)
         {
-            perror("bind(2)");
-            close(sockfd->socket_fd);
-            free(sockfd);
-            exit(EXIT_FAILURE);
+            checkpoint->file_id = be64toh(file_id);
+            for (size_t i = 0; i < checkpoint->chunks; i++)
+            {
+                checkpoint->chunk_map[i] = (image[20 + i / 8] >> (i % 8)) & 1;
+            }
         }
     }
-    else
+    rudp_checkpoint_build(checkpoint);
+    return 0;
+}
+
+// Saves the checkpoint, so the chunks received so far survive the sender or the receiver dying. Only the blocks
+// that changed since the last save are written, a save costs the same however large the file. Chunk bits only
+// ever get set between two saves, so a crash half way through one leaves a checkpoint that is still true.
+void rudp_checkpoint_save(RUDP_Checkpoint *checkpoint)
+{
+    size_t size = CHECKPOINT_IMAGE_SIZE(checkpoint->chunks);
+    pthread_mutex_lock(&checkpoint->lock);
+    for (size_t block = 0; block < CHECKPOINT_BLOCKS(checkpoint->chunks); block++)
     {
-        struct timeval tv = {MAX_WAIT_TIME, 0};
-        if (setsockopt(sockfd->socket_fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv)) == -1)
+        if (!__atomic_exchange_n(&checkpoint->dirty[block], 0, __ATOMIC_RELAXED))
         {
-            perror("setsockopt(2)");
-            close(sockfd->socket_fd);
-            exit(EXIT_FAILURE);
+            continue;
+        }
+        size_t offset = block * CHECKPOINT_BLOCK;
+        size_t length = size - offset < CHECKPOINT_BLOCK ? size - offset : CHECKPOINT_BLOCK;
+        if (pwrite(checkpoint->fd, checkpoint->image + offset, length, (off_t)offset) != (ssize_t)length)
+        {
+            perror("pwrite(2)");
         }
     }
-
-    return sockfd;
+    pthread_mutex_unlock(&checkpoint->lock);
 }
 
-// Tries to connect to the other side via RUDP to given IP and port.
-// Returns 0 on failure and 1 on success.
-// Fails if called when the socket is connected/set to server.
-int rudp_connect(RUDP_Socket *sockfd, const char *dest_ip, unsigned short int dest_port)
+// Forgets the file once it was received completely.
+void rudp_checkpoint_clear(RUDP_Checkpoint *checkpoint)
 {
-    if (sockfd->isServer || sockfd->isConnected)
-    {
-        fprintf(stderr, "Socket is already connected.\n");
-        return 0;
-    }
-    memset(&sockfd->dest_addr, 0, sizeof(sockfd->dest_addr));
-    sockfd->dest_addr.sin_family = AF_INET;
-    if (inet_pton(AF_INET, dest_ip, &sockfd->dest_addr.sin_addr) <= 0)
-    {
-        perror("inet_pton(3)");
-        return 0;
-    }
-    sockfd->dest_addr.sin_port = htons(dest_port);
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->file_id = 0;
+    rudp_checkpoint_empty(checkpoint);
+    rudp_checkpoint_write(checkpoint);
+    pthread_mutex_unlock(&checkpoint->lock);
+}
 
-    // send syn
-    printf("Sending SYN packet.\n");
-    int sent = rudp_send(sockfd, SYN, NULL, 0);
-    if (sent == -1)
+// Builds the checkpoint offer for a client that wants to continue file_id: file ID, chunk count, then the runs of
+// chunks already received as (first chunk, chunk count) pairs, all big endian. A transfer that got far before it
+// broke off is a few runs whatever the size of the file. Runs that do not fit in capacity are left out, loudly:
+// the offer stays true, the client just sends those chunks again.
+// Returns the size of the offer written to out, 0 if capacity has no room for it.
+static size_t rudp_checkpoint_offer(RUDP_Checkpoint *checkpoint, uint64_t file_id, char *out, size_t capacity)
+{
+    uint8_t *wire = (uint8_t *)out;
+    size_t size = 12, runs = 0, offered = 0;
+    if (capacity < size)
     {
-        printf("Failed to send SYN packet.\n");
         return 0;
     }
 
-    RUDP_Packet packet;
-    int recv = rudp_receive(sockfd, &packet);
-    if (recv == -1)
-    {
-        printf("Failed to receive SYN-ACK packet.\n");
-        return 0;
-    }
-    if (packet.header.flags == SYN_ACK)
+    pthread_mutex_lock(&checkpoint->lock);
+    uint64_t wire_file_id = htobe64(file_id);
+    memcpy(wire, &wire_file_id, 8);
+    rudp_put32(wire + 8, (uint32_t)checkpoint->chunks);
+    // chunks of another file are no use to this client, it gets an empty offer
+    for (size_t i = 0; checkpoint->file_id == file_id && i < checkpoint->chunks;)
     {
-        printf("Received SYN-ACK packet.\n");
-        // send ack
-        printf("Sending ACK packet.\n");
-        sent = rudp_send(sockfd, ACK, NULL, 0);
-        if (sent == -1)
+        if (!__atomic_load_n(&checkpoint->chunk_map[i], __ATOMIC_RELAXED))
         {
-            return 0;
+            i++;
+            continue;
+        }
+        size_t first = i;
+        while (i < checkpoint->chunks && __atomic_load_n(&checkpoint->chunk_map[i], __ATOMIC_RELAXED))
+        {
+            i++;
+        }
+        runs++;
+        if (size + 8 <= capacity)
+        {
+            rudp_put32(wire + size, (uint32_t)first);
+            rudp_put32(wire + size + 4, (uint32_t)(i - first));
+            size += 8;
+            offered++;
         }
-        sockfd->isConnected = true;
     }
-    else
+    pthread_mutex_unlock(&checkpoint->lock);
+    if (offered < runs)
     {
-        printf("Received unexpected packet.\n");
-        printf("Received %d\n", packet.header.flags);
-        return 0;
+        fprintf(stderr, "Checkpoint offer truncated: %zu of %zu runs of received chunks fit, the sender resends the rest\n", offered, runs);
     }
-    return 1;
+    return size;
 }
 
-// Accepts incoming connection request and completes the handshake, returns 0 on failure and 1 on success.
-// Fails if called when the socket is connected/set to client.
-int rudp_accept(RUDP_Socket *sockfd)
+// Switches the checkpoint to the file a handshake announced (0 for none). The chunks it holds are kept only if the
+// announced file is the one they belong to, any other file (or none) starts from an empty checkpoint.
+// Returns true if the checkpoint holds file_id, so the transfer continues from it.
+static bool rudp_checkpoint_adopt(RUDP_Checkpoint *checkpoint, uint64_t file_id)
 {
-    if (!sockfd->isServer || sockfd->isConnected)
+    bool continued = true;
+    pthread_mutex_lock(&checkpoint->lock);
+    if (file_id == 0 || checkpoint->file_id != file_id)
     {
-        return 0;
+        checkpoint->file_id = file_id;
+        rudp_checkpoint_empty(checkpoint);
+        rudp_checkpoint_write(checkpoint);
+        continued = false;
     }
+    pthread_mutex_unlock(&checkpoint->lock);
+    return continued;
+}
 
-    printf("Waiting for connection...\n");
+void rudp_checkpoint_close(RUDP_Checkpoint *checkpoint)
+{
+    close(checkpoint->fd);
+    free(checkpoint->chunk_map);
+    free(checkpoint->image);
+    free(checkpoint->dirty);
+    pthread_mutex_destroy(&checkpoint->lock);
+}
 
-    RUDP_Packet packet;
-    int recv = rudp_receive(sockfd, &packet);
-    if (recv == -1)
+// Makes the range record its chunks in the checkpoint as well as in its own map.
+void rudp_range_checkpoint(RUDP_Range *range, RUDP_Checkpoint *checkpoint)
+{
+    range->checkpoint = checkpoint;
+}
+
+// Prepares range to receive size bytes into buffer, starting at first_sequence.
+// Returns 0 on success and -1 on error.
+int rudp_range_init(RUDP_Range *range, char *buffer, size_t size, uint32_t first_sequence)
+{
+    size_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    memset(range, 0, sizeof(RUDP_Range));
+    range->buffer = buffer;
+    range->size = size;
+    range->first_sequence = first_sequence;
+    range->chunk_map = (uint8_t *)calloc(chunks > 0 ? chunks : 1, sizeof(uint8_t));
+    if (range->chunk_map == NULL)
     {
-        return 0;
+        perror("calloc(3)");
+        return -1;
     }
+    return 0;
+}
+
+// Forgets the chunks received so far and the digest over them.
+static void rudp_range_forget(RUDP_Range *range)
+{
+    memset(range->chunk_map, 0, (range->size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    range->received = 0;
+    range->resumed = 0;
+    range->next_index = 0;
+    range->digest = 0;
+    range->digested = 0;
+}
 
-    //  if received syn send back syn ack
-    if (packet.header.flags == SYN)
+// Takes over the chunks of the range the checkpoint holds, and restarts the digest so it covers them.
+// Only for a connection whose handshake announced the checkpoint's file, see rudp_checkpoint_adopt().
+static void rudp_range_resume(RUDP_Range *range)
+{
+    size_t chunks = (range->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    rudp_range_forget(range);
+    for (size_t i = 0; i < chunks; i++)
     {
-        printf("Received SYN packet.\n");
-        // send syn ack
-        printf("Sending SYN-ACK packet.\n");
-        int sent = rudp_send(sockfd, SYN_ACK, NULL, 0);
-        if (sent == -1)
+        range->chunk_map[i] = __atomic_load_n(&range->checkpoint->chunk_map[range->first_sequence + i], __ATOMIC_RELAXED);
+        if (range->chunk_map[i])
         {
-            printf("Failed to send SYN-ACK packet.\n");
-            return 0;
+            range->received += range->size - i * CHUNK_SIZE < CHUNK_SIZE ? range->size - i * CHUNK_SIZE : CHUNK_SIZE;
         }
     }
+    range->resumed = range->received;
+}
 
-    // receive ack
-    recv = rudp_receive(sockfd, &packet);
-    if (recv == -1)
+// Forgets the chunks received so far so the range can receive the next transfer. A checkpointed range takes the
+// chunks its checkpoint holds back once the receive finds the handshake continued the checkpoint's file.
+void rudp_range_reset(RUDP_Range *range)
+{
+    rudp_range_forget(range);
+    range->digest_ms = 0;
+    latency_reset(&range->one_way);
+    latency_reset(&range->kernel_to_app);
+}
+
+void rudp_range_free(RUDP_Range *range)
+{
+    free(range->chunk_map);
+    range->chunk_map = NULL;
+    latency_free(&range->one_way);
+    latency_free(&range->kernel_to_app);
+    latency_free(&range->send_to_wire);
+}
+
+// Folds the chunks that are now in order into the range digest, and hands them to the range's deliver callback.
+static void rudp_range_digest(RUDP_Range *range)
+{
+    size_t chunks = (range->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (range->digested < chunks && range->chunk_map[range->digested])
     {
-        printf("Failed to receive ACK packet.\n");
-        return 0;
+        struct timeval hash_start, hash_end;
+        size_t first = range->digested * CHUNK_SIZE;
+        gettimeofday(&hash_start, NULL);
+        while (range->digested < chunks && range->chunk_map[range->digested])
+        {
+            size_t offset = range->digested * CHUNK_SIZE;
+            size_t length = range->size - offset < CHUNK_SIZE ? range->size - offset : CHUNK_SIZE;
+            range->digest = crc64_update(range->digest, range->buffer + offset, length);
+            range->digested++;
+        }
+        gettimeofday(&hash_end, NULL);
+        range->digest_ms += rudp_elapsed_ms(&hash_start, &hash_end);
+        if (range->deliver != NULL)
+        {
+            size_t end = range->digested * CHUNK_SIZE < range->size ? range->digested * CHUNK_SIZE : range->size;
+            range->deliver(range->deliver_arg, range->buffer + first, end - first, first);
+        }
     }
+}
 
-    if (packet.header.flags == ACK)
+// Copies a verified PUSH chunk, chunk index of the range, into the range and extends the range digest.
+// Chunks that belong to another range and duplicates are dropped, and counted as duplicates. A chunk whose payload
+// is not exactly as long as its place in the range (CHUNK_SIZE, or what is left for the last one) is dropped and
+// counted as lost: it would spill into the next chunk, or leave a gap that still counted as received.
+// Returns true if the chunk was new.
+static bool rudp_range_store(RUDP_Range *range, size_t index, const RUDP_Packet *packet, size_t data_size, bool *started, RUDP_Counters *counters)
+{
+    size_t chunks = (range->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (index >= chunks || range->chunk_map[index])
     {
-        printf("Received ACK packet.\n");
-        sockfd->isConnected = true;
+        COUNTER_ADD(counters->duplicates, 1);
+        return false;
     }
-    else
+    size_t chunk_offset = index * CHUNK_SIZE;
+    size_t expected = range->size - chunk_offset < CHUNK_SIZE ? range->size - chunk_offset : CHUNK_SIZE;
+    if (data_size != expected)
     {
-        printf("Received unexpected packet.\n");
-        return 0;
+        COUNTER_ADD(counters->lost, 1);
+        return false;
     }
-    printf("Connected to %s:%d\n", inet_ntoa(sockfd->dest_addr.sin_addr), ntohs(sockfd->dest_addr.sin_port));
-    return 1;
+
+    if (!*started)
+    {
+        gettimeofday(&range->start, NULL);
+        *started = true;
+    }
+    memcpy(range->buffer + chunk_offset, packet->data, data_size);
+    range->chunk_map[index] = 1;
+    if (range->checkpoint != NULL)
+    {
+        rudp_checkpoint_mark(range->checkpoint, range->first_sequence + index);
+    }
+    range->received += data_size;
+    COUNTER_ADD(counters->bytes, data_size);
+
+    // The chunks this one overtook are missing, except those the checkpoint already held.
+    if (index >= range->next_index)
+    {
+        size_t overtaken = 0;
+        for (size_t i = range->next_index; i < index; i++)
+        {
+            overtaken += !range->chunk_map[i];
+        }
+        COUNTER_ADD(counters->lost, overtaken);
+        range->next_index = index + 1;
+    }
+
+    // Extend the digest over every chunk that is now in order, so hashing keeps pace with the receive
+    // instead of running as a second pass once the range is complete.
+    rudp_range_digest(range);
+    return true;
 }
 
-// Receives data from the other side and put it into the buffer.
+// Receives PUSH chunks into the range until all of its bytes arrived.
+// On a checkpointed range, a sender restarted on the peer's host may redo the handshake: it is offered the checkpoint
+// and receiving goes on.
 // Returns the number of received bytes on success, 0 if got FIN packet (disconnect), and -1 on error.
-int rudp_receive(RUDP_Socket *rudp_socket, RUDP_Packet *packet)
+int rudp_receive_range(RUDP_Socket *rudp_socket, RUDP_Range *range)
 {
-    size_t total_received = 0;
-    socklen_t addr_len = sizeof(rudp_socket->dest_addr);
+    RUDP_Packet packet;
+    size_t unsaved = 0;
+    bool started = false;
 
-    if (rudp_socket->isServer)
+    // recvmsg() rather than recvfrom(), so the kernel's receive timestamp comes along with the datagram. The
+    // sender's address lands in peer, only a completed handshake may change the connection's peer.
+    char control[LATENCY_CONTROL_SIZE];
+    struct sockaddr_in peer;
+    struct msghdr message = {.msg_name = &peer};
+
+    if (rudp_socket->isContinued)
     {
+        rudp_range_resume(range);
+        rudp_socket->isContinued = false;
+    }
 
-        while (total_received < BUFFER_SIZE)
+    while (range->received < range->size)
+    {
+        message.msg_namelen = sizeof(peer);
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        int bytes_received = rudp_recvmsg(rudp_socket, &packet, &message);
+        if (bytes_received < 0)
         {
-            int bytes_received = recvfrom(rudp_socket->socket_fd, packet, sizeof(RUDP_Packet), 0, (struct sockaddr *)&rudp_socket->dest_addr, &addr_len);
-            if (bytes_received < 0)
+            if (rudp_socket->idle_closed)
             {
-                printf("%s:%d\n", inet_ntoa(rudp_socket->dest_addr.sin_addr), ntohs(rudp_socket->dest_addr.sin_port));
-                perror("recvfrom");
-                return -1;
+                // the idle timer closed the connection, as if the peer had sent FIN
+                return 0;
             }
+            perror("recvmsg");
+            return -1;
+        }
+        int64_t app_time = rudp_socket->timestamps ? latency_now_ns() : 0;
 
-            size_t data_size = bytes_received - sizeof(RUDP_Header);
-
-            if (packet->header.flags == SYN || packet->header.flags == SYN_ACK || packet->header.flags == ACK || packet->header.flags == FIN_ACK)
-            {
-                // Ignore control packets (SYN, SYN-ACK, ACK, FIN)
-                break;
-            }
-            else if (packet->header.flags == FIN)
+        // only the SYN and ACK of a sender restarted on the peer's host may come from another connection or port
+        bool ours = packet.header.connection_id == rudp_socket->connection_id && rudp_same_peer(&peer, &rudp_socket->dest_addr);
+        bool restart = range->checkpoint != NULL && rudp_same_host(&peer, &rudp_socket->dest_addr);
+        if (packet.header.flags == FIN && ours)
+        {
+            return 0;
+        }
+        if (packet.header.flags == SYN && restart)
+        {
+            // the sender restarted: the confirmation of its ACK offers what arrived, it carries on with the rest
+            rudp_answer_syn(rudp_socket, &packet, &peer);
+            continue;
+        }
+        if (rudp_handshake_repeated(rudp_socket, &peer, &packet, bytes_received))
+        {
+            continue;
+        }
+        uint64_t file_id;
+        if (restart && rudp_syn_cookie_valid(&peer, &packet, bytes_received, &file_id))
+        {
+            rudp_socket->dest_addr = peer;
+            bool continued = rudp_handshake_complete(rudp_socket, packet.header.connection_id, file_id);
+            rudp_confirm_handshake(rudp_socket);
+            if (continued)
             {
-                return 0;
+                rudp_range_resume(range);
             }
-            else if (packet->header.flags == PUSH)
+            else
             {
-                // Check if the received packet is corrupted
-                unsigned short int checksum = calculate_checksum(packet->data, data_size);
-                if (checksum != packet->header.checksum)
-                {
-                    printf("Checksum failed for sequence number %d: %d\n", packet->header.sequence_number, checksum);
-                    printf("seq %d, len %d, chek %d, ack %d, f %d\n", packet->header.sequence_number, packet->header.length, packet->header.checksum, packet->header.acknowledgment_number, packet->header.flags);
-                    continue;
-                }
+                rudp_range_forget(range);
             }
+            rudp_socket->isContinued = false;
+            started = false;
+            continue;
+        }
+        if (packet.header.flags != PUSH || !ours)
+        {
+            // Ignore stray control packets, and chunks of an earlier connection
+            continue;
+        }
 
-            total_received += data_size;
+        size_t data_size = bytes_received;
+        COUNTER_ADD(rudp_socket->counters.packets, 1);
 
-            // Check if all data has been received
-            if (total_received >= BUFFER_SIZE)
-            {
-                break;
-            }
-        }
-    }
-    else
-    {
-        // only receive connection packets
-        int bytes_received = recvfrom(rudp_socket->socket_fd, packet, sizeof(RUDP_Packet), 0, (struct sockaddr *)&rudp_socket->dest_addr, &addr_len);
-        if (bytes_received < 0)
+        size_t index = (uint32_t)(packet.header.sequence_number - range->first_sequence);
+        if (!rudp_range_store(range, index, &packet, data_size, &started, &rudp_socket->counters))
         {
-            perror("recvfrom");
-            return -1;
+            continue;
         }
-        if (packet->header.flags == SYN || packet->header.flags == SYN_ACK || packet->header.flags == ACK || packet->header.flags == FIN_ACK)
+        rudp_ack_later(rudp_socket);
+
+        if (range->checkpoint != NULL && ++unsaved == CHECKPOINT_INTERVAL)
         {
-            return bytes_received;
+            rudp_checkpoint_save(range->checkpoint);
+            unsaved = 0;
         }
-        else if (packet->header.flags == FIN)
+
+        int64_t kernel_time = rudp_socket->timestamps ? latency_rx_timestamp(&message) : 0;
+        if (kernel_time != 0)
         {
-            return 0;
+            // the one-way delay needs the send time, which only a sender with timestamps on puts in the packet
+            if (packet.header.send_time != 0)
+            {
+                latency_add(&range->one_way, kernel_time - packet.header.send_time);
+            }
+            latency_add(&range->kernel_to_app, app_time - kernel_time);
         }
     }
-    return total_received;
+    // the completion ACK covers whatever the progress ACK was waiting for
+    rudp_socket->unacked = 0;
+    gettimeofday(&range->end, NULL);
+    if (!started)
+    {
+        // the checkpoint already held the whole range
+        range->start = range->end;
+    }
+    // chunks that came from the checkpoint are hashed here if nothing arrived after them
+    rudp_range_digest(range);
+
+    return range->received;
 }
 
-// Sends data stores in buffer to the other side.
-// Returns the number of sent bytes on success and -1 on error.
-int rudp_send(RUDP_Socket *rudp_socket, uint8_t flags, char *data, size_t data_size)
+// Receives count multiplexed streams until every one of them is complete. Chunks are sorted into their stream
+// by the stream ID in the header, and a stream is marked complete (with its own end time) and delivered as soon
+// as its last chunk arrives, however far behind the other streams are. Chunks are not retransmitted, so the call
+// as a whole still waits for every stream: a lost chunk leaves its own stream incomplete, and the call with it.
+// The streams may share one checkpoint, a restarted sender may then redo the handshake as in rudp_receive_range().
+// Returns the number of received bytes on success, 0 if got FIN packet (disconnect), and -1 on error.
+int rudp_receive_streams(RUDP_Socket *rudp_socket, RUDP_Stream *streams, int count)
 {
-
     RUDP_Packet packet;
-    packet.header.flags = flags;
+    RUDP_Checkpoint *checkpoint = count > 0 ? streams[0].range.checkpoint : NULL;
+    bool started[MAX_STREAMS] = {false};
+    size_t unsaved = 0, total = 0;
+    int remaining = 0;
 
-    if (flags == SYN || flags == SYN_ACK || flags == ACK || flags == FIN || flags == FIN_ACK)
+    if (count > MAX_STREAMS)
     {
-        // If SYN, SYN-ACK, ACK, FIN, or FIN-ACK flags are set, send packet with header only
-        packet.header.length = sizeof(RUDP_Header);
-        packet.header.sequence_number = 0;       // Set sequence number
-        packet.header.acknowledgment_number = 0; // Set appropriate acknowledgment number
-        packet.header.checksum = 0;              // Set checksum to 0
-
-        if (sendto(rudp_socket->socket_fd, (const char *)&packet, sizeof(RUDP_Header), 0,
-                   (struct sockaddr *)&rudp_socket->dest_addr, (socklen_t)sizeof(rudp_socket->dest_addr)) == -1)
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (rudp_socket->isContinued)
         {
-            return -1; // Return -1 on failure
+            rudp_range_resume(&streams[i].range);
         }
+        streams[i].complete = streams[i].range.received >= streams[i].range.size;
+        remaining += !streams[i].complete;
     }
-    else
+    rudp_socket->isContinued = false;
+
+    char control[LATENCY_CONTROL_SIZE];
+    struct sockaddr_in peer;
+    struct msghdr message = {.msg_name = &peer};
+
+    while (remaining > 0)
     {
-        // If data packet, split data into chunks and send
-        size_t total_sent = 0;
-        int sequence_number = 0;
-        while (total_sent < data_size)
+        message.msg_namelen = sizeof(peer);
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        int bytes_received = rudp_recvmsg(rudp_socket, &packet, &message);
+        if (bytes_received < 0)
         {
-            size_t remaining = data_size - total_sent;
-            size_t chunk_size = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+            if (rudp_socket->idle_closed)
+            {
+                // the idle timer closed the connection, as if the peer had sent FIN
+                return 0;
+            }
+            perror("recvmsg");
+            return -1;
+        }
+        int64_t app_time = rudp_socket->timestamps ? latency_now_ns() : 0;
 
-            packet.header.length = sizeof(RUDP_Header) + chunk_size;
-            packet.header.sequence_number = sequence_number; // Set sequence number
-            packet.header.acknowledgment_number = 0;         // Set appropriate acknowledgment number
-            memcpy(packet.data, data + total_sent, chunk_size);
-            packet.header.checksum = calculate_checksum(packet.data, chunk_size);
+        // only the SYN and ACK of a sender restarted on the peer's host may come from another connection or port
+        bool ours = packet.header.connection_id == rudp_socket->connection_id && rudp_same_peer(&peer, &rudp_socket->dest_addr);
+        bool restart = checkpoint != NULL && rudp_same_host(&peer, &rudp_socket->dest_addr);
+        if (packet.header.flags == FIN && ours)
+        {
+            return 0;
+        }
+        if (packet.header.flags == SYN && restart)
+        {
+            rudp_answer_syn(rudp_socket, &packet, &peer);
+            continue;
+        }
+        if (rudp_handshake_repeated(rudp_socket, &peer, &packet, bytes_received))
+        {
+            continue;
+        }
+        uint64_t file_id;
+        if (restart && rudp_syn_cookie_valid(&peer, &packet, bytes_received, &file_id))
+        {
+            rudp_socket->dest_addr = peer;
+            bool continued = rudp_handshake_complete(rudp_socket, packet.header.connection_id, file_id);
+            rudp_confirm_handshake(rudp_socket);
+            rudp_socket->isContinued = false;
+            remaining = 0;
+            for (int i = 0; i < count; i++)
+            {
+                if (continued)
+                {
+                    rudp_range_resume(&streams[i].range);
+                }
+                else
+                {
+                    rudp_range_forget(&streams[i].range);
+                }
+                streams[i].complete = streams[i].range.received >= streams[i].range.size;
+                remaining += !streams[i].complete;
+                started[i] = false;
+            }
+            continue;
+        }
+        if (packet.header.flags != PUSH || !ours)
+        {
+            continue;
+        }
 
-            // Send the packet
-            if (sendto(rudp_socket->socket_fd, (const char *)&packet, sizeof(RUDP_Header) + chunk_size, 0,
-                       (struct sockaddr *)&rudp_socket->dest_addr, (socklen_t)sizeof(rudp_socket->dest_addr)) == -1)
+        int i = 0;
+        while (i < count && streams[i].id != packet.header.stream_id)
+        {
+            i++;
+        }
+        if (i == count || streams[i].complete)
+        {
+            if (i < count)
             {
-                return -1; // Return -1 on failure
+                // a chunk of a stream that is already complete was sent twice
+                COUNTER_ADD(rudp_socket->counters.duplicates, 1);
             }
+            continue;
+        }
+        RUDP_Range *range = &streams[i].range;
 
-            // print sent packet info
-            // printf("seq %d, len %d, chek %d\n", packet.header.sequence_number, packet.header.length, packet.header.checksum);
+        size_t data_size = bytes_received;
+        COUNTER_ADD(rudp_socket->counters.packets, 1);
 
-            // Increment sequence number by the size of the chunk sent
-            sequence_number++;
+        // stream chunks are numbered within their stream
+        if (!rudp_range_store(range, packet.header.sequence_number, &packet, data_size, &started[i], &rudp_socket->counters))
+        {
+            continue;
+        }
+        rudp_ack_later(rudp_socket);
 
-            total_sent += chunk_size;
+        if (checkpoint != NULL && ++unsaved == CHECKPOINT_INTERVAL)
+        {
+            rudp_checkpoint_save(checkpoint);
+            unsaved = 0;
+        }
+
+        int64_t kernel_time = rudp_socket->timestamps ? latency_rx_timestamp(&message) : 0;
+        if (kernel_time != 0)
+        {
+            // the one-way delay needs the send time, which only a sender with timestamps on puts in the packet
+            if (packet.header.send_time != 0)
+            {
+                latency_add(&range->one_way, kernel_time - packet.header.send_time);
+            }
+            latency_add(&range->kernel_to_app, app_time - kernel_time);
+        }
+
+        if (range->received >= range->size)
+        {
+            gettimeofday(&range->end, NULL);
+            streams[i].complete = true;
+            remaining--;
         }
     }
 
-    return data_size; // Return the size of the data sent on success
+    rudp_socket->unacked = 0;
+    for (int i = 0; i < count; i++)
+    {
+        RUDP_Range *range = &streams[i].range;
+        if (!started[i])
+        {
+            // the checkpoint already held the whole stream
+            gettimeofday(&range->end, NULL);
+            range->start = range->end;
+        }
+        rudp_range_digest(range);
+        total += range->received;
+    }
+
+    return total;
 }
 
-// Disconnects from an actively connected socket.
+// Disconnects from an actively connected socket. A client sends FIN, a server answers the FIN it received.
 // Returns 1 on success, 0 when the socket is already disconnected (failure).
 int rudp_disconnect(RUDP_Socket *sockfd)
 {
@@ -399,9 +2679,9 @@ int rudp_disconnect(RUDP_Socket *sockfd)
 
     if (!sockfd->isServer)
     {
-        // send fin
+        // send fin, resent until the FIN-ACK arrives
         printf("Sending FIN packet.\n");
-        int sent = rudp_send(sockfd, FIN, NULL, 0);
+        int sent = rudp_send_reliable(sockfd, FIN, NULL, 0);
         if (sent == -1)
         {
             return 0;
@@ -410,6 +2690,7 @@ int rudp_disconnect(RUDP_Socket *sockfd)
         // receive fin ack
         RUDP_Packet packet;
         int recv = rudp_receive(sockfd, &packet);
+        rudp_answered(sockfd);
         if (recv == -1)
         {
             return 0;
@@ -434,13 +2715,46 @@ int rudp_disconnect(RUDP_Socket *sockfd)
             return 0;
         }
     }
+    else
+    {
+        // the client sent FIN: answer with FIN-ACK, resent until the last ACK arrives
+        sockfd->unacked = 0;
+        rudp_timer_cancel(sockfd->timers, &sockfd->keepalive);
+        rudp_timer_cancel(sockfd->timers, &sockfd->idle);
+        if (rudp_send_reliable(sockfd, FIN_ACK, NULL, 0) == -1)
+        {
+            return 0;
+        }
+        RUDP_Packet packet;
+        int recv;
+        do
+        {
+            recv = rudp_receive(sockfd, &packet);
+            if (recv != -1 && packet.header.flags == FIN)
+            {
+                rudp_retransmit_now(sockfd);
+            }
+        } while (recv == 0 && packet.header.flags == FIN);
+        rudp_answered(sockfd);
+        sockfd->isConnected = false;
+        if (recv == -1)
+        {
+            return 0;
+        }
+    }
     return 1;
 }
 
 // This function releases all the memory allocation and resources of the socket.
 int rudp_close(RUDP_Socket *sockfd)
 {
+    if (sockfd->epoll_fd >= 0)
+    {
+        close(sockfd->epoll_fd);
+    }
     close(sockfd->socket_fd);
+    free(sockfd->delivered);
+    free(sockfd->timers);
     free(sockfd);
     return 1;
 }
\ No newline at end of file
@@ -1,119 +1,659 @@
-#include "RUDP_API.c"
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 
-#define SERVER_IP "127.0.0.1"
+#include "rudp.h"
+#include "crc64.h"
+#include "report.h"
+#include "writer.h"
+#include "placement.h"
 
-#define BUFFER_SIZE 2 * 1024 * 1024
+#define BUFFER_SIZE (2 * 1024 * 1024) // Bytes of the file received.
 
 typedef struct
 {
     double time_taken;
     double bandwidth;
+    double digest_time;
+    double cpu_time;
 } FileStats;
 
+// Where the chunks of a range go with -o.
+typedef struct
+{
+    Writer *writer;
+    RUDP_Range *range;
+    char *file_data; // Start of the reassembly buffer, the ranges reassemble the file in place.
+    int source;      // The range's part of the buffer as a source of the writer, in this run.
+} RangeOutput;
+
+// Per-flow state handed to a receiver thread.
+typedef struct
+{
+    RUDP_Socket *sock; // Accepted RUDP socket of this flow.
+    RUDP_Range range;  // The flow's share of the reassembly buffer.
+    RUDP_Stream streams[MAX_STREAMS]; // With -multiplex, the share split into independent streams.
+    int stream_count;  // Number of streams, 0 to receive the share as a single range.
+    int cpu;           // CPU the receiving thread is pinned to, -1 if not pinned.
+    double cpu_ms;     // CPU time the thread spent receiving the range.
+    int status;        // Bytes received, 0 if the flow was disconnected, -1 on error.
+    Writer writer;     // With -o, writes the flow's chunks to the output file once they are in order.
+    RangeOutput output;                       // -o state of range.
+    RangeOutput stream_outputs[MAX_STREAMS];  // -o state of the streams' ranges.
+} FlowArgs;
+
+/*
+* @brief Deliver callback of the ranges with -o. Hands the in-order part of a range to the writer, which writes it
+* straight from the reassembly buffer a block at a time and the tail once the range is complete. Nothing is copied
+* and the receiving thread never waits for the disk, so it keeps draining the socket while the disk is slow.
+*/
+void write_chunks(void *arg, const char *data, size_t length, size_t offset)
+{
+    RangeOutput *output = (RangeOutput *)arg;
+    writer_ready(output->writer, output->source, offset + length);
+}
+
+// Registers the range's part of the reassembly buffer with the flow's writer, once per run.
+void add_source(RangeOutput *output)
+{
+    RUDP_Range *range = output->range;
+    output->source = writer_source(output->writer, range->buffer, range->size, (off_t)(range->buffer - output->file_data));
+}
+
+// Points a range's deliver callback at the flow's writer.
+void output_range(FlowArgs *flow, RangeOutput *output, RUDP_Range *range, char *file_data)
+{
+    output->writer = &flow->writer;
+    output->range = range;
+    output->file_data = file_data;
+    range->deliver = write_chunks;
+    range->deliver_arg = output;
+}
+
+// Sums up the flow's streams in its range: they are consecutive pieces of it, so their digests combine in order.
+void fold_streams(FlowArgs *flow)
+{
+    RUDP_Range *flow_range = &flow->range;
+    flow_range->digest = 0;
+    flow_range->digest_ms = 0;
+    flow_range->received = 0;
+    flow_range->resumed = 0;
+    for (int i = 0; i < flow->stream_count; i++)
+    {
+        RUDP_Range *range = &flow->streams[i].range;
+        flow_range->digest = crc64_combine(flow_range->digest, range->digest, range->size);
+        flow_range->digest_ms += range->digest_ms;
+        flow_range->received += range->received;
+        flow_range->resumed += range->resumed;
+        if (i == 0 || timercmp(&range->start, &flow_range->start, <))
+        {
+            flow_range->start = range->start;
+        }
+        if (i == 0 || timercmp(&range->end, &flow_range->end, >))
+        {
+            flow_range->end = range->end;
+        }
+        latency_merge(&flow_range->one_way, &range->one_way);
+        latency_merge(&flow_range->kernel_to_app, &range->kernel_to_app);
+    }
+}
+
+typedef struct
+{
+    RUDP_Socket **socks;
+    int count;
+} FlowReport;
+
+// Sums the receive counters of the flows for the interval reports.
+void sample_flows(void *arg, Report_Sample *sample)
+{
+    FlowReport *report = (FlowReport *)arg;
+    for (int i = 0; i < report->count; i++)
+    {
+        RUDP_Counters *counters = &report->socks[i]->counters;
+        sample->bytes += REPORT_READ(counters->bytes);
+        sample->packets += REPORT_READ(counters->packets);
+        sample->lost += REPORT_READ(counters->lost);
+        sample->retransmits += REPORT_READ(counters->duplicates);
+    }
+}
+
+// Receives one flow's sequence range. On FIN, also completes the flow's disconnect handshake.
+void *receive_flow(void *arg)
+{
+    FlowArgs *flow = (FlowArgs *)arg;
+
+    placement_pin(flow->cpu);
+
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    rudp_range_reset(&flow->range);
+    if (flow->stream_count == 0)
+    {
+        flow->status = rudp_receive_range(flow->sock, &flow->range);
+    }
+    else
+    {
+        for (int i = 0; i < flow->stream_count; i++)
+        {
+            rudp_range_reset(&flow->streams[i].range);
+        }
+        flow->status = rudp_receive_streams(flow->sock, flow->streams, flow->stream_count);
+        fold_streams(flow);
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    flow->cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000.0 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000000.0;
+    if (flow->status != 0)
+    {
+        return NULL;
+    }
+
+    if (flow->sock->idle_closed)
+    {
+        return NULL;
+    }
+
+    // send FIN-ACK
+    printf("Received FIN packet, sending FIN-ACK...\n");
+    if (rudp_disconnect(flow->sock) == 0)
+    {
+        flow->status = -1;
+    }
+    return NULL;
+}
+
+// returns the value of the flag at argv[*i] and steps over it, exits if the command line ends with the flag
+static char *option_value(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "Missing value for %s\n", argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    return argv[++*i];
+}
+
 int main(int argc, char *argv[])
 {
 
     int server_port;
+    int flows = 1;
+    bool timestamps = false;
+    int busy_poll_us = 0;
+    int first_cpu = -1;
+    bool checkpointing = false;
+    int multiplex = 0;
+    int idle_seconds = 0;
+    int interval_ms = 0;
+    char *output_path = NULL;
+    int writer_flags = 0;
+    bool hugepages = false;
+    char *numa = NULL;
+    char *state = NULL;
 
-    if (argc != 3)
+    if (argc < 3)
     {
-        fprintf(stderr, "Usage: %s -p <server_port>\n", argv[0]);
+        fprintf(stderr, "Usage: %s -p <server_port> [-streams <count>] [-multiplex <count>] [-timestamps] [-busypoll <spin microseconds>] [-cpu <first cpu>] [-checkpoint] [-idle <seconds>] [-interval <ms>] [-o <file> [-sync]] [-hugepages] [-numa <node|interface>] [-state <dir>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    for (size_t i = 0; i < argc; i++)
+    for (int i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "-p") == 0)
         {
-            server_port = atoi(argv[i + 1]);
+            server_port = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-streams") == 0)
+        {
+            flows = atoi(option_value(argc, argv, &i));
         }
+        else if (strcmp(argv[i], "-multiplex") == 0)
+        {
+            multiplex = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-timestamps") == 0)
+        {
+            timestamps = true;
+        }
+        else if (strcmp(argv[i], "-busypoll") == 0)
+        {
+            busy_poll_us = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-cpu") == 0)
+        {
+            first_cpu = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-idle") == 0)
+        {
+            idle_seconds = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-interval") == 0)
+        {
+            interval_ms = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-checkpoint") == 0)
+        {
+            checkpointing = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            output_path = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-sync") == 0)
+        {
+            writer_flags |= WRITER_SYNC;
+        }
+        else if (strcmp(argv[i], "-hugepages") == 0)
+        {
+            hugepages = true;
+        }
+        else if (strcmp(argv[i], "-numa") == 0)
+        {
+            numa = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-state") == 0)
+        {
+            state = option_value(argc, argv, &i);
+        }
+    }
+
+    if (flows < 1 || flows > MAX_FLOWS)
+    {
+        fprintf(stderr, "The number of streams must be between 1 and %d\n", MAX_FLOWS);
+        exit(EXIT_FAILURE);
+    }
+    if (multiplex < 0 || multiplex > MAX_STREAMS)
+    {
+        fprintf(stderr, "The number of multiplexed streams must be at most %d\n", MAX_STREAMS);
+        exit(EXIT_FAILURE);
+    }
+    // The checkpoint spool already keeps the file on disk.
+    if (output_path != NULL && checkpointing)
+    {
+        fprintf(stderr, "-o does not support -checkpoint\n");
+        exit(EXIT_FAILURE);
+    }
+    if (state != NULL && rudp_set_state_dir(state) < 0)
+    {
+        fprintf(stderr, "Cannot keep the state in %s\n", state);
+        exit(EXIT_FAILURE);
+    }
+
+    // huge pages and the NUMA node apply to the reassembly buffer
+    Placement placement;
+    int node = -1;
+    if (numa != NULL && placement_node(numa, &node) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (numa != NULL && node < 0)
+    {
+        fprintf(stdout, "%s has no NUMA node, the buffers are not bound.\n", numa);
     }
+    placement_init(&placement, hugepages, node);
 
     fprintf(stdout, "Starting Receiver...\n");
 
-    // Create a UDP socket between the Sender and the Receiver.
-    RUDP_Socket *sock = rudp_socket(true, server_port);
+    // Create a UDP socket for every flow, flow i listens on server_port + i.
+    RUDP_Socket *socks[MAX_FLOWS];
+    for (int i = 0; i < flows; i++)
+    {
+        socks[i] = rudp_socket(true, server_port + i);
+        if (timestamps && rudp_enable_timestamps(socks[i]) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (busy_poll_us > 0 && rudp_enable_busy_poll(socks[i], busy_poll_us) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        // a sender that goes quiet for longer (and does not answer keepalives) is disconnected
+        rudp_set_idle_timeout(socks[i], idle_seconds * 1000);
+    }
+
+    // The flows reassemble the file into this buffer. With -checkpoint it is a shared mapping of a spool file
+    // (which is not placed), so the chunks the checkpoint lists are still there after the receiver restarts.
+    char *file_data;
+    RUDP_Checkpoint checkpoint;
+    if (checkpointing)
+    {
+        char path[64], spool_path[80];
+        snprintf(path, sizeof(path), "%s_%d", CHECKPOINT_PREFIX, server_port);
+        snprintf(spool_path, sizeof(spool_path), "%s.part", path);
+        int spool = open(spool_path, O_RDWR | O_CREAT, 0644);
+        struct stat info;
+        if (spool < 0 || fstat(spool, &info) < 0 || ftruncate(spool, BUFFER_SIZE) < 0)
+        {
+            perror("open(2)");
+            exit(EXIT_FAILURE);
+        }
+        file_data = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, spool, 0);
+        close(spool);
+        if (file_data == MAP_FAILED)
+        {
+            perror("mmap(2)");
+            exit(EXIT_FAILURE);
+        }
+        if (rudp_checkpoint_open(&checkpoint, path, BUFFER_SIZE, info.st_size == BUFFER_SIZE) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < flows; i++)
+        {
+            socks[i]->checkpoint = &checkpoint;
+        }
+    }
+    else
+    {
+        file_data = (char *)placement_alloc(&placement, BUFFER_SIZE);
+        if (file_data == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    if (rudp_accept(sock) == 0)
+    // With -o every flow writes its chunks into the output file as soon as they are in order. The flows still
+    // reassemble in the buffer, chunks arrive out of order and the writers write them from there once they are.
+    int output_fd = -1;
+    if (output_path != NULL && (output_fd = writer_open(output_path, BUFFER_SIZE)) < 0)
     {
-        perror("rudp_accept(3)");
         exit(EXIT_FAILURE);
     }
 
+    for (int i = 0; i < flows; i++)
+    {
+        if (rudp_accept(socks[i]) == 0)
+        {
+            perror("rudp_accept(3)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    FlowArgs flow_args[MAX_FLOWS];
+    pthread_t threads[MAX_FLOWS];
+    int cpus[MAX_FLOWS];
+    for (int i = 0; i < flows; i++)
+    {
+        size_t offset, length;
+        rudp_stripe(BUFFER_SIZE, flows, i, &offset, &length);
+        flow_args[i].sock = socks[i];
+        // flow i runs on CPU first_cpu + i, wrapping around the online CPUs
+        flow_args[i].cpu = cpus[i] = placement_cpu(first_cpu, i);
+        if (rudp_range_init(&flow_args[i].range, file_data + offset, length, offset / CHUNK_SIZE) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (output_fd >= 0 && multiplex == 0)
+        {
+            output_range(&flow_args[i], &flow_args[i].output, &flow_args[i].range, file_data);
+        }
+        if (checkpointing)
+        {
+            rudp_range_checkpoint(&flow_args[i].range, &checkpoint);
+        }
+        // the sender splits its stripe the same way, stream j + 1 carries piece j
+        flow_args[i].stream_count = multiplex;
+        for (int j = 0; j < multiplex; j++)
+        {
+            size_t stream_offset, stream_length;
+            rudp_stripe(length, multiplex, j, &stream_offset, &stream_length);
+            flow_args[i].streams[j].id = j + 1;
+            if (rudp_range_init(&flow_args[i].streams[j].range, file_data + offset + stream_offset, stream_length, (offset + stream_offset) / CHUNK_SIZE) < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+            if (checkpointing)
+            {
+                rudp_range_checkpoint(&flow_args[i].streams[j].range, &checkpoint);
+            }
+            if (output_fd >= 0)
+            {
+                output_range(&flow_args[i], &flow_args[i].stream_outputs[j], &flow_args[i].streams[j].range, file_data);
+            }
+        }
+    }
+
+    // latency samples of all flows of the current run
+    Latency_Samples one_way = {0}, kernel_to_app = {0};
+
     FileStats *fileStats = NULL;
     int fileStatsCount = 0;
     double total_time_taken = 0;
     double total_bandwidth = 0;
+    size_t total_bytes_transferred = 0;
+
+    // the interval reports sample the sockets' receive counters while the flows receive
+    Reporter reporter;
+    FlowReport flow_report = {socks, flows};
+    if (interval_ms > 0 && report_start(&reporter, interval_ms, REPORT_PACKETS | REPORT_LOST | REPORT_RETRANSMITS, sample_flows, &flow_report) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // the writers need no ring, they write from the reassembly buffer
+    for (int i = 0; i < flows && output_fd >= 0; i++)
+    {
+        writer_init(&flow_args[i].writer, 0, NULL);
+    }
 
-    RUDP_Packet packet;
     while (1)
     {
-        clock_t start, end;
+        for (int i = 0; i < flows; i++)
+        {
+            if (output_fd >= 0)
+            {
+                if (writer_start(&flow_args[i].writer, output_fd, writer_flags) < 0)
+                {
+                    exit(EXIT_FAILURE);
+                }
+                if (multiplex == 0)
+                {
+                    add_source(&flow_args[i].output);
+                }
+                for (int j = 0; j < multiplex; j++)
+                {
+                    add_source(&flow_args[i].stream_outputs[j]);
+                }
+            }
+            if (pthread_create(&threads[i], NULL, receive_flow, &flow_args[i]) != 0)
+            {
+                perror("pthread_create(3)");
+                exit(EXIT_FAILURE);
+            }
+        }
 
-        // start clock
-        start = clock();
-        int recv_len = rudp_receive(sock, &packet);
-        if (recv_len == 0)
+        int done = 0, failed = 0;
+        size_t recv_len = 0, resumed = 0;
+        for (int i = 0; i < flows; i++)
         {
-            printf("Received FIN packet. Exiting...\n");
-            break;
+            pthread_join(threads[i], NULL);
+            if (flow_args[i].status == 0)
+            {
+                done = 1;
+            }
+            else if (flow_args[i].status < 0)
+            {
+                failed = 1;
+            }
+            else
+            {
+                recv_len += flow_args[i].status;
+                resumed += flow_args[i].range.resumed;
+            }
         }
-        else if (recv_len == -1)
+
+        if (failed)
         {
             perror("rudp_recv(3)");
             exit(EXIT_FAILURE);
         }
-        end = clock();
+        for (int i = 0; i < flows && output_fd >= 0; i++)
+        {
+            if (writer_stop(&flow_args[i].writer) < 0)
+            {
+                perror("pwritev(2)");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (done && socks[0]->idle_closed)
+        {
+            printf("Sender went idle. Exiting...\n");
+            break;
+        }
+        if (done)
+        {
+            printf("Received FIN packet. Exiting...\n");
+            break;
+        }
 
-        // send ack
-        int sent_len = rudp_send(sock, ACK, NULL, 0);
+        // the flows were hashed while they arrived, merge their digests in file order
+        uint64_t digest = 0;
+        double digest_time = 0, cpu_time = 0;
+        for (int i = 0; i < flows; i++)
+        {
+            digest = crc64_combine(digest, flow_args[i].range.digest, flow_args[i].range.size);
+            digest_time += flow_args[i].range.digest_ms;
+            cpu_time += flow_args[i].cpu_ms;
+        }
+
+        // send a single completion ack for the whole file on the first flow, carrying the file digest
+        uint64_t wire_digest = htobe64(digest);
+        int sent_len = rudp_send(socks[0], ACK, (char *)&wire_digest, sizeof(wire_digest));
         if (sent_len == -1)
         {
             perror("rudp_send(3)");
             exit(EXIT_FAILURE);
         }
+        if (checkpointing)
+        {
+            // the file is complete, the next transfer starts from an empty checkpoint
+            rudp_checkpoint_clear(&checkpoint);
+        }
+
+        // the file took from the first chunk of any flow to the last chunk of any flow
+        struct timeval start = flow_args[0].range.start, end = flow_args[0].range.end;
+        for (int i = 1; i < flows; i++)
+        {
+            if (timercmp(&flow_args[i].range.start, &start, <))
+            {
+                start = flow_args[i].range.start;
+            }
+            if (timercmp(&flow_args[i].range.end, &end, >))
+            {
+                end = flow_args[i].range.end;
+            }
+        }
+
         // measure the time in milliseconds taken to receive the file
-        double time_taken = ((double)(end - start)) / (CLOCKS_PER_SEC / 1000);
+        double time_taken = rudp_elapsed_ms(&start, &end);
         total_time_taken += time_taken;
 
-        // calculate the bandwidth in MB/s
-        double bandwidth = (BUFFER_SIZE / (time_taken / 1000)) / (1024 * 1024);
+        // calculate the bandwidth in MB/s, over the bytes that actually crossed the network in this run
+        double bandwidth = time_taken > 0 ? ((recv_len - resumed) / (time_taken / 1000)) / (1024 * 1024) : 0;
         total_bandwidth += bandwidth;
+        total_bytes_transferred += recv_len - resumed;
 
         fileStatsCount++;
         fileStats = realloc(fileStats, fileStatsCount * sizeof(FileStats));
         if (fileStats == NULL)
         {
             perror("realloc(3)");
-            rudp_disconnect(sock);
-            rudp_close(sock);
+            for (int i = 0; i < flows; i++)
+            {
+                rudp_disconnect(socks[i]);
+                rudp_close(socks[i]);
+            }
             free(fileStats);
             exit(EXIT_FAILURE);
         }
         // store the file statistics
         fileStats[fileStatsCount - 1].time_taken = time_taken;
         fileStats[fileStatsCount - 1].bandwidth = bandwidth;
+        fileStats[fileStatsCount - 1].digest_time = digest_time;
+        fileStats[fileStatsCount - 1].cpu_time = cpu_time;
 
-        fprintf(stdout, "File received. Bytes received: %d\n", recv_len);
+        fprintf(stdout, "File received. Bytes received: %zu\n", recv_len);
+        fprintf(stdout, "CRC-64: %016" PRIx64 "\n", digest);
+        if (resumed > 0)
+        {
+            fprintf(stdout, "Continued from checkpoint: %zu bytes were already received, %zu bytes transferred\n", resumed, recv_len - resumed);
+        }
+        if (flows > 1)
+        {
+            for (int i = 0; i < flows; i++)
+            {
+                double flow_time = rudp_elapsed_ms(&flow_args[i].range.start, &flow_args[i].range.end);
+                fprintf(stdout, "  Flow %d: %d bytes, Time = %.2f ms, Speed = %.2f MB/s\n", i + 1, flow_args[i].status,
+                        flow_time, (flow_args[i].status / (flow_time / 1000)) / (1024 * 1024));
+            }
+        }
+        for (int i = 0; i < flows; i++)
+        {
+            // each stream is delivered as soon as it is complete, however far behind the others are
+            for (int j = 0; j < flow_args[i].stream_count; j++)
+            {
+                RUDP_Range *range = &flow_args[i].streams[j].range;
+                fprintf(stdout, "  Flow %d, stream %d: %zu bytes, delivered %.2f ms after the flow's first chunk\n", i + 1, j + 1,
+                        range->received, rudp_elapsed_ms(&flow_args[i].range.start, &range->end));
+            }
+        }
+        if (timestamps)
+        {
+            // network time and user-space scheduling delay, separated by the kernel's arrival timestamp
+            latency_reset(&one_way);
+            latency_reset(&kernel_to_app);
+            for (int i = 0; i < flows; i++)
+            {
+                latency_merge(&one_way, &flow_args[i].range.one_way);
+                latency_merge(&kernel_to_app, &flow_args[i].range.kernel_to_app);
+            }
+            latency_print(stdout, "One-way delay", &one_way);
+            latency_print(stdout, "Kernel-to-app latency", &kernel_to_app);
+        }
 
-        fprintf(stdout, "Waiting for Sender response...\n");
-    }
+        if (output_fd >= 0)
+        {
+            const Writer *writers[MAX_FLOWS];
+            for (int i = 0; i < flows; i++)
+            {
+                writers[i] = &flow_args[i].writer;
+            }
+            fprintf(stdout, "Written to %s\n", output_path);
+            writer_print_stats(stdout, writers, flows);
+        }
 
-    // send FIN-ACK
-    printf("Sending FIN-ACK...\n");
-    if (rudp_send(sock, FIN_ACK, NULL, 0) == -1)
-    {
-        perror("rudp_send(3)");
-        exit(EXIT_FAILURE);
+        if (busy_poll_us > 0)
+        {
+            size_t spin_hits = 0, sleeps = 0;
+            for (int i = 0; i < flows; i++)
+            {
+                spin_hits += socks[i]->spin_hits;
+                sleeps += socks[i]->sleeps;
+                socks[i]->spin_hits = 0;
+                socks[i]->sleeps = 0;
+            }
+            fprintf(stdout, "Busy poll: %zu datagrams caught spinning, %zu sleeps in epoll_wait\n", spin_hits, sleeps);
+        }
+
+        fprintf(stdout, "Waiting for Sender response...\n");
     }
 
-    // receive ACK
-    if (rudp_receive(sock, &packet) == -1)
+    printf("Received ACK. Closing connection...\n");
+    if (interval_ms > 0)
     {
-        perror("rudp_recv(3)");
-        exit(EXIT_FAILURE);
+        report_stop(&reporter);
     }
-    printf("Received ACK. Closing connection...\n");
 
     // Print the file statistics
     fprintf(stdout, "-----------------------\n");
@@ -122,18 +662,60 @@ int main(int argc, char *argv[])
     {
         double bandwidth = fileStats[i].bandwidth;
         double time = fileStats[i].time_taken;
-        fprintf(stdout, "Run %zu: Time = %.2f ms, Speed = %.2f MB/s\n", i + 1, time, bandwidth);
+        // CPU time covers waiting for the first chunk too, which is where busy polling spends its cycles
+        fprintf(stdout, "Run %zu: Time = %.2f ms, Speed = %.2f MB/s, Hashing = %.2f ms, CPU = %.2f ms\n", i + 1, time, bandwidth,
+                fileStats[i].digest_time, fileStats[i].cpu_time);
     }
 
     // Print the average file statistics
     fprintf(stdout, "Average time: %.2f ms\n", total_time_taken / fileStatsCount);
     fprintf(stdout, "Average bandwidth: %.2f MB/s\n", total_bandwidth / fileStatsCount);
+    // the mean of the runs' rates weighs a short run like a long one, the aggregate is bytes over time
+    fprintf(stdout, "Aggregate bandwidth: %.2f MB/s (%zu bytes in %.2f ms)\n",
+            total_time_taken > 0 ? (total_bytes_transferred / (total_time_taken / 1000)) / (1024 * 1024) : 0, total_bytes_transferred, total_time_taken);
+    fprintf(stdout, "Flows: %d\n", flows);
+    if (multiplex > 0)
+    {
+        fprintf(stdout, "Multiplexed streams per flow: %d\n", multiplex);
+    }
+    if (busy_poll_us > 0)
+    {
+        fprintf(stdout, "Receive mode: busy poll (%d us spin budget)\n", busy_poll_us);
+    }
+    else
+    {
+        fprintf(stdout, "Receive mode: blocking\n");
+    }
+    placement_print(stdout, &placement, cpus, flows);
 
     fprintf(stdout, "-----------------------\n");
 
     fprintf(stdout, "Receiver end\n");
     free(fileStats);
 
-    rudp_close(sock);
+    for (int i = 0; i < flows; i++)
+    {
+        for (int j = 0; j < flow_args[i].stream_count; j++)
+        {
+            rudp_range_free(&flow_args[i].streams[j].range);
+        }
+        rudp_range_free(&flow_args[i].range);
+        rudp_close(socks[i]);
+    }
+    latency_free(&one_way);
+    latency_free(&kernel_to_app);
+    if (output_fd >= 0)
+    {
+        close(output_fd);
+    }
+    if (checkpointing)
+    {
+        rudp_checkpoint_close(&checkpoint);
+        munmap(file_data, BUFFER_SIZE);
+    }
+    else
+    {
+        placement_free(&placement, file_data, BUFFER_SIZE);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,111 +1,517 @@
-#include "RUDP_API.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "rudp.h"
+#include "crc64.h"
+#include "reader.h"
+#include "placement.h"
+
+#define FILE_NAME "data.txt"
+#define BUFFER_SIZE (2 * 1024 * 1024) // Bytes of the file sent, the receiver expects as many.
+
+// Per-flow state handed to a sender thread.
+typedef struct
+{
+    RUDP_Socket *sock; // Connected RUDP socket of this flow.
+    RUDP_Range range;  // The flow's stripe of the file. Its buffer is not used, the data comes from reader.
+    Reader reader;     // Reads the stripe from the file while it is sent.
+    RUDP_Stream streams[MAX_STREAMS]; // With -multiplex, the stripe split into independent streams.
+    int stream_count;  // Number of streams, 0 to send the stripe as a single range.
+    int cpu;           // CPU the sending thread is pinned to, -1 if not pinned.
+    Placement *placement; // Where the flow's buffers are allocated.
+    int status;        // 0 on success, -1 on error.
+} FlowArgs;
+
+// Sends the stripe one block at a time as the reader brings it in: every block is a range of its own, numbered
+// and checkpointed as its part of the stripe, and the block digests combine into the stripe's.
+static int send_blocks(FlowArgs *flow)
+{
+    RUDP_Range *range = &flow->range;
+    RUDP_Range block;
+    size_t position = 0, size;
+    const char *data;
+
+    memset(&block, 0, sizeof(block));
+    latency_reset(&range->send_to_wire);
+    while ((data = reader_next(&flow->reader, &size)) != NULL)
+    {
+        block.buffer = (char *)data;
+        block.size = size;
+        block.first_sequence = range->first_sequence + position / CHUNK_SIZE;
+        block.chunk_map = range->chunk_map != NULL ? range->chunk_map + position / CHUNK_SIZE : NULL;
+        if (rudp_send_range(flow->sock, &block) < 0)
+        {
+            latency_free(&block.send_to_wire);
+            return -1;
+        }
+        reader_release(&flow->reader);
+
+        range->digest = crc64_combine(range->digest, block.digest, block.size);
+        range->digest_ms += block.digest_ms;
+        range->resumed += block.resumed;
+        latency_merge(&range->send_to_wire, &block.send_to_wire);
+        position += size;
+    }
+    latency_free(&block.send_to_wire);
+    return position == range->size ? 0 : -1;
+}
+
+// Sends the stripe as multiplexed streams. The streams interleave over the whole stripe, so it is read in full first.
+static int send_multiplexed(FlowArgs *flow)
+{
+    RUDP_Range *range = &flow->range;
+    char *stripe = (char *)placement_alloc(flow->placement, range->size);
+    size_t position = 0, size;
+    const char *data;
+
+    if (stripe == NULL)
+    {
+        return -1;
+    }
+    while ((data = reader_next(&flow->reader, &size)) != NULL)
+    {
+        memcpy(stripe + position, data, size);
+        reader_release(&flow->reader);
+        position += size;
+    }
+    if (position != range->size)
+    {
+        placement_free(flow->placement, stripe, range->size);
+        return -1;
+    }
+    for (int i = 0; i < flow->stream_count; i++)
+    {
+        RUDP_Range *stream_range = &flow->streams[i].range;
+        stream_range->buffer = stripe + (size_t)(stream_range->first_sequence - range->first_sequence) * CHUNK_SIZE;
+    }
+
+    int status = rudp_send_streams(flow->sock, flow->streams, flow->stream_count) < 0 ? -1 : 0;
+    // the streams are consecutive pieces of the stripe, so their digests combine into the stripe's
+    for (int i = 0; i < flow->stream_count; i++)
+    {
+        RUDP_Range *stream_range = &flow->streams[i].range;
+        range->digest = crc64_combine(range->digest, stream_range->digest, stream_range->size);
+        range->digest_ms += stream_range->digest_ms;
+        range->resumed += stream_range->resumed;
+    }
+    placement_free(flow->placement, stripe, range->size);
+    return status;
+}
+
+// Sends one stripe of the file as a sequence range, or as multiplexed streams.
+void *send_flow(void *arg)
+{
+    FlowArgs *flow = (FlowArgs *)arg;
+    placement_pin(flow->cpu);
+    flow->range.digest = 0;
+    flow->range.digest_ms = 0;
+    flow->range.resumed = 0;
+    flow->status = flow->stream_count == 0 ? send_blocks(flow) : send_multiplexed(flow);
+    if (flow->status < 0 && flow->reader.error != 0)
+    {
+        errno = flow->reader.error;
+        perror("read(2)");
+    }
+    return NULL;
+}
+
+// returns the value of the flag at argv[*i] and steps over it, exits if the command line ends with the flag
+static char *option_value(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "Missing value for %s\n", argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    return argv[++*i];
+}
 
 int main(int argc, char *argv[])
 {
 
     char *server_ip;
     int server_port;
+    int flows = 1;
+    int multiplex = 0;
+    char *priority_list = NULL;
+    bool resume = false;
+    bool timestamps = false;
+    bool continuing = false;
+    int ring = READER_BLOCKS;
+    int read_flags = 0;
+    bool hugepages = false;
+    int first_cpu = -1;
+    char *numa = NULL;
+    char *state = NULL;
 
-    if (argc != 5)
+    if (argc < 5)
     {
-        fprintf(stderr, "Usage: %s -ip <server_ip> -p <server_port>\n", argv[0]);
+        fprintf(stderr, "Usage: %s -ip <server_ip> -p <server_port> [-streams <count>] [-multiplex <count> [-priorities <p1,p2,...>]] [-resume] [-timestamps] [-continue] [-ring <blocks>] [-direct] [-hugepages] [-cpu <first cpu>] [-numa <node|interface>] [-state <dir>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    for (size_t i = 0; i < argc; i++)
+    for (int i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "-ip") == 0)
         {
-            server_ip = argv[i + 1];
+            server_ip = option_value(argc, argv, &i);
         }
         else if (strcmp(argv[i], "-p") == 0)
         {
-            server_port = atoi(argv[i + 1]);
+            server_port = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-streams") == 0)
+        {
+            flows = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-multiplex") == 0)
+        {
+            multiplex = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-priorities") == 0)
+        {
+            priority_list = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-resume") == 0)
+        {
+            resume = true;
+        }
+        else if (strcmp(argv[i], "-timestamps") == 0)
+        {
+            timestamps = true;
+        }
+        else if (strcmp(argv[i], "-continue") == 0)
+        {
+            continuing = true;
+        }
+        else if (strcmp(argv[i], "-ring") == 0)
+        {
+            ring = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-direct") == 0)
+        {
+            read_flags |= READER_DIRECT;
+        }
+        else if (strcmp(argv[i], "-hugepages") == 0)
+        {
+            hugepages = true;
+        }
+        else if (strcmp(argv[i], "-cpu") == 0)
+        {
+            first_cpu = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-numa") == 0)
+        {
+            numa = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-state") == 0)
+        {
+            state = option_value(argc, argv, &i);
         }
     }
 
-    fprintf(stdout, "Starting Sender...\n");
-
-    // buffer to store the file
-    char *file_data = (char *)calloc(BUFFER_SIZE, sizeof(char));
-
-    // Open the file
-    FILE *file = fopen("data.txt", "r");
-    if (file == NULL)
+    if (flows < 1 || flows > MAX_FLOWS)
+    {
+        fprintf(stderr, "The number of streams must be between 1 and %d\n", MAX_FLOWS);
+        exit(EXIT_FAILURE);
+    }
+    if (multiplex < 0 || multiplex > MAX_STREAMS)
     {
-        perror("fopen(3)");
-        free(file_data);
+        fprintf(stderr, "The number of multiplexed streams must be at most %d\n", MAX_STREAMS);
         exit(EXIT_FAILURE);
     }
+    if (ring < 1 || ring > READER_MAX_BLOCKS)
+    {
+        fprintf(stderr, "The ring must have between 1 and %d blocks\n", READER_MAX_BLOCKS);
+        exit(EXIT_FAILURE);
+    }
+    if (state != NULL && rudp_set_state_dir(state) < 0)
+    {
+        fprintf(stderr, "Cannot keep the state in %s\n", state);
+        exit(EXIT_FAILURE);
+    }
+    // -priorities gives stream j the j-th value, the streams past the end of the list get priority 0
+    uint8_t priorities[MAX_STREAMS] = {0};
+    for (int j = 0; priority_list != NULL && *priority_list != '\0'; j++)
+    {
+        char *end;
+        long priority = strtol(priority_list, &end, 10);
+        if (j == MAX_STREAMS || end == priority_list || priority < 0 || priority > UINT8_MAX || (*end != ',' && *end != '\0'))
+        {
+            fprintf(stderr, "The stream priorities must be a list of at most %d numbers between 0 and %d, separated by commas\n", MAX_STREAMS, UINT8_MAX);
+            exit(EXIT_FAILURE);
+        }
+        priorities[j] = (uint8_t)priority;
+        priority_list = *end == ',' ? end + 1 : end;
+    }
 
-    // read the file into a buffer
-    int bytes_read;
-    if ((bytes_read = fread(file_data, sizeof(char), BUFFER_SIZE, file)) < BUFFER_SIZE)
+    // huge pages and the NUMA node apply to the reader rings and the multiplexed stripes
+    Placement placement;
+    int node = -1;
+    if (numa != NULL && placement_node(numa, &node) < 0)
     {
-        perror("fread(3)");
-        fclose(file);
-        free(file_data);
         exit(EXIT_FAILURE);
     }
-    fprintf(stdout, "bytes read: %d.\n", bytes_read);
+    if (numa != NULL && node < 0)
+    {
+        fprintf(stdout, "%s has no NUMA node, the buffers are not bound.\n", numa);
+    }
+    placement_init(&placement, hugepages, node);
 
-    // Close the file
-    fclose(file);
+    fprintf(stdout, "Starting Sender...\n");
 
-    // Create a UDP socket between the Sender and the Receiver.
-    RUDP_Socket *sock = rudp_socket(false, server_port);
+    // The file is not read up front: every flow reads its stripe while sending it, see send_flow().
+    struct stat file_info;
+    if (stat(FILE_NAME, &file_info) < 0)
+    {
+        perror("stat(2)");
+        exit(EXIT_FAILURE);
+    }
+    if (file_info.st_size < BUFFER_SIZE)
+    {
+        fprintf(stderr, "%s holds %lld bytes, the receiver expects %d\n", FILE_NAME, (long long)file_info.st_size, BUFFER_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    int bytes_read = BUFFER_SIZE;
+    fprintf(stdout, "Sending %d bytes of %s, read through a ring of %d x %d KB blocks per flow%s.\n",
+            bytes_read, FILE_NAME, ring, READER_BLOCK_SIZE / 1024, read_flags & READER_DIRECT ? " with O_DIRECT" : "");
 
-    fprintf(stdout, "Socket created.\n");
+    // With -continue the SYN names the file, and the SYN-ACK tells which chunks the receiver already has.
+    // That needs the round trip, so it takes precedence over -resume.
+    uint64_t file_id = continuing ? rudp_file_id(FILE_NAME) : 0;
+    if (continuing)
+    {
+        resume = false;
+    }
 
-    // Connect to the receiver
-    if (rudp_connect(sock, server_ip, server_port) == 0)
+    // Every flow has its own UDP socket (and so its own source port) and talks to its own receiver port.
+    RUDP_Socket *socks[MAX_FLOWS];
+    for (int i = 0; i < flows; i++)
     {
-        fprintf(stderr, "Failed to connect to the receiver.\n");
-        rudp_close(sock);
-        free(file_data);
-        exit(EXIT_FAILURE);
+        // Create a UDP socket between the Sender and the Receiver.
+        socks[i] = rudp_socket(false, server_port + i);
+        if (timestamps && rudp_enable_timestamps(socks[i]) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        socks[i]->file_id = file_id;
+
+        // Connect to the receiver, with -resume a cached session ticket replaces the handshake
+        int connected = resume ? rudp_resume(socks[i], server_ip, server_port + i) : rudp_connect(socks[i], server_ip, server_port + i);
+        if (connected == 0)
+        {
+            fprintf(stderr, "Failed to connect to the receiver.\n");
+            rudp_close(socks[i]);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    fprintf(stdout, "Connected to the receiver.\n");
+    int resumed = 0;
+    for (int i = 0; i < flows; i++)
+    {
+        resumed += socks[i]->isResumed;
+    }
+    fprintf(stdout, "Connected to the receiver over %d flow(s)", flows);
+    if (resumed > 0)
+    {
+        fprintf(stdout, ", %d resumed without a handshake (cached RTT %.2f ms)", resumed, socks[0]->rtt_us / 1000.0);
+    }
+    else if (socks[0]->rtt_us > 0)
+    {
+        fprintf(stdout, ", handshake RTT %.2f ms", socks[0]->rtt_us / 1000.0);
+    }
+    fprintf(stdout, ".\n");
 
     RUDP_Packet rec_packet;
+    FlowArgs flow_args[MAX_FLOWS];
+    const Reader *readers[MAX_FLOWS];
+    pthread_t threads[MAX_FLOWS];
+    int cpus[MAX_FLOWS];
+    memset(flow_args, 0, sizeof(flow_args));
+    Latency_Samples send_to_wire = {0};
+
+    // the rings are allocated once and serve every file sent
+    for (int i = 0; i < flows; i++)
+    {
+        if (reader_init(&flow_args[i].reader, ring, &placement) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
 
     char decision;
     do
     {
 
-        // send the file to the receiver
-        if (rudp_send(sock, PUSH, file_data, bytes_read) < 0)
+        // send the file to the receiver, every flow sends its own sequence range in parallel
+        for (int i = 0; i < flows; i++)
+        {
+            size_t offset;
+            flow_args[i].sock = socks[i];
+            flow_args[i].cpu = cpus[i] = placement_cpu(first_cpu, i);
+            flow_args[i].placement = &placement;
+            rudp_stripe(bytes_read, flows, i, &offset, &flow_args[i].range.size);
+            flow_args[i].range.first_sequence = offset / CHUNK_SIZE;
+            // skip what the receiver's checkpoint holds, in the first transfer after connecting
+            flow_args[i].range.chunk_map = NULL;
+            if (socks[i]->delivered != NULL && socks[i]->delivered_chunks == (bytes_read + CHUNK_SIZE - 1) / CHUNK_SIZE)
+            {
+                flow_args[i].range.chunk_map = socks[i]->delivered + offset / CHUNK_SIZE;
+            }
+            // with -multiplex the stripe goes out as streams, the most urgent first and those of equal priority
+            // interleaved chunk by chunk
+            flow_args[i].stream_count = multiplex;
+            for (int j = 0; j < multiplex; j++)
+            {
+                RUDP_Stream *stream = &flow_args[i].streams[j];
+                size_t stream_offset;
+                stream->id = j + 1;
+                stream->priority = priorities[j];
+                rudp_stripe(flow_args[i].range.size, multiplex, j, &stream_offset, &stream->range.size);
+                stream->range.first_sequence = flow_args[i].range.first_sequence + stream_offset / CHUNK_SIZE;
+                stream->range.chunk_map = flow_args[i].range.chunk_map != NULL ? flow_args[i].range.chunk_map + stream_offset / CHUNK_SIZE : NULL;
+            }
+            if (reader_start(&flow_args[i].reader, FILE_NAME, (off_t)offset, flow_args[i].range.size, read_flags) < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+            readers[i] = &flow_args[i].reader;
+            if (pthread_create(&threads[i], NULL, send_flow, &flow_args[i]) != 0)
+            {
+                perror("pthread_create(3)");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int failed = 0;
+        for (int i = 0; i < flows; i++)
+        {
+            pthread_join(threads[i], NULL);
+            reader_stop(&flow_args[i].reader);
+            if (flow_args[i].status != 0)
+            {
+                failed = 1;
+            }
+        }
+        if (failed)
         {
             fprintf(stderr, "Failed to send the file.\n");
-            rudp_close(sock);
-            free(file_data);
+            for (int i = 0; i < flows; i++)
+            {
+                rudp_close(socks[i]);
+            }
             exit(EXIT_FAILURE);
         }
 
+        // Merge the flow digests in file order.
+        uint64_t digest = 0;
+        double digest_ms = 0;
+        size_t skipped = 0;
+        for (int i = 0; i < flows; i++)
+        {
+            digest = crc64_combine(digest, flow_args[i].range.digest, flow_args[i].range.size);
+            digest_ms += flow_args[i].range.digest_ms;
+            skipped += flow_args[i].range.resumed;
+            free(socks[i]->delivered);
+            socks[i]->delivered = NULL;
+        }
+
         fprintf(stdout, "File sent.\n");
+        if (skipped > 0)
+        {
+            fprintf(stdout, "Continued a transfer: skipped %zu bytes the receiver already had, sent %zu bytes\n", skipped, bytes_read - skipped);
+        }
+        fprintf(stdout, "CRC-64: %016" PRIx64 " (%s, hashing took %.2f ms)\n", digest, crc64_kernel(), digest_ms);
+        reader_print_stats(stdout, readers, flows);
+        placement_print(stdout, &placement, cpus, flows);
+        if (timestamps)
+        {
+            latency_reset(&send_to_wire);
+            for (int i = 0; i < flows; i++)
+            {
+                latency_merge(&send_to_wire, &flow_args[i].range.send_to_wire);
+            }
+            latency_print(stdout, "Send-to-wire latency", &send_to_wire);
+        }
 
-        // receive response packet from the receiver
-        if (rudp_receive(sock, &rec_packet) < 0)
+        // receive the single completion packet of the transfer on the first flow, it carries the receiver's digest
+        int rec_len = rudp_receive(socks[0], &rec_packet);
+        if (rec_len < 0 && resumed > 0)
+        {
+            // The receiver did not accept a ticket (expired, used before, or issued under another key) and dropped
+            // the data. Forget the cached sessions, redo the handshakes and send the file again.
+            fprintf(stderr, "%s, reconnecting with a full handshake...\n",
+                    errno == ECONNREFUSED ? "The receiver rejected the session ticket" : "No response to the resumed session");
+            resumed = 0;
+            for (int i = 0; i < flows; i++)
+            {
+                rudp_forget_session(server_ip, server_port + i);
+                rudp_close(socks[i]);
+                socks[i] = rudp_socket(false, server_port + i);
+                if ((timestamps && rudp_enable_timestamps(socks[i]) < 0) || rudp_resume(socks[i], server_ip, server_port + i) == 0)
+                {
+                    fprintf(stderr, "Failed to connect to the receiver.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            decision = 'Y';
+            continue;
+        }
+        if (rec_len < 0)
         {
             fprintf(stderr, "Failed to receive response packet.\n");
-            rudp_close(sock);
-            free(file_data);
+            for (int i = 0; i < flows; i++)
+            {
+                rudp_close(socks[i]);
+            }
             exit(EXIT_FAILURE);
         }
 
+        if (rec_len >= (int)sizeof(uint64_t))
+        {
+            uint64_t receiver_digest;
+            memcpy(&receiver_digest, rec_packet.data, sizeof(receiver_digest));
+            receiver_digest = be64toh(receiver_digest);
+            if (receiver_digest != digest)
+            {
+                fprintf(stderr, "Integrity check failed: the receiver got CRC-64 %016" PRIx64 "\n", receiver_digest);
+            }
+            else
+            {
+                fprintf(stdout, "Integrity check passed.\n");
+            }
+        }
+
         printf("do you want to send another file? (Y/N): ");
         scanf(" %c", &decision);
     } while (decision == 'Y' || decision == 'y');
 
-    // disconnect from the receiver and close the socket
-    int d = rudp_disconnect(sock);
-    if (d == 0){
-        fprintf(stderr, "Failed to disconnect from the receiver.\n");
-        return 1;
+    // disconnect every flow from the receiver and close the sockets
+    for (int i = 0; i < flows; i++)
+    {
+        int d = rudp_disconnect(socks[i]);
+        if (d == 0){
+            fprintf(stderr, "Failed to disconnect from the receiver.\n");
+            return 1;
+        }
+        printf("Disconnected from %s:%d\n", inet_ntoa(socks[i]->dest_addr.sin_addr), ntohs(socks[i]->dest_addr.sin_port));
+        rudp_close(socks[i]);
+    }
+    for (int i = 0; i < flows; i++)
+    {
+        latency_free(&flow_args[i].range.send_to_wire);
+        reader_free(&flow_args[i].reader);
     }
-    printf("Disconnected from %s:%d\n", inet_ntoa(sock->dest_addr.sin_addr), ntohs(sock->dest_addr.sin_port));
-    rudp_close(sock);
-    free(file_data);
+    latency_free(&send_to_wire);
     return 0;
-}
\ No newline at end of file
+}
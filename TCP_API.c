@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "TCP_API.h"
+#include "crc64.h"
+
+#define CHECKPOINT_MAGIC 0x544350434b505431ULL // "TCPCKPT1"
+
+ssize_t tcp_send_all(int sock, const void *data, size_t size) {
+    const char *cursor = (const char *)data;
+    size_t total_sent = 0;
+    while (total_sent < size) {
+        ssize_t sent = send(sock, cursor + total_sent, size - total_sent, 0);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total_sent += sent;
+    }
+    return total_sent;
+}
+
+ssize_t tcp_recv_all(int sock, void *data, size_t size) {
+    char *cursor = (char *)data;
+    size_t total_received = 0;
+    while (total_received < size) {
+        ssize_t received = recv(sock, cursor + total_received, size - total_received, 0);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (received == 0)
+            return 0;
+        total_received += received;
+    }
+    return total_received;
+}
+
+void tcp_stripe(size_t total, int streams, int index, size_t *offset, size_t *length) {
+    size_t base = total / streams;
+    size_t extra = total % streams;
+    size_t i = (size_t)index;
+
+    // The first (total % streams) stripes carry one extra byte.
+    *offset = i * base + (i < extra ? i : extra);
+    *length = base + (i < extra ? 1 : 0);
+}
+
+int tcp_send_stream_header(int sock, size_t offset, size_t length, uint32_t flags) {
+    Stream_Header header;
+    header.offset = htonl((uint32_t)offset);
+    header.length = htonl((uint32_t)length);
+    header.flags = htonl(flags);
+    return tcp_send_all(sock, &header, sizeof(header)) < 0 ? -1 : 0;
+}
+
+int tcp_recv_stream_header(int sock, size_t *offset, size_t *length, uint32_t *flags) {
+    Stream_Header header;
+    ssize_t received = tcp_recv_all(sock, &header, sizeof(header));
+    if (received <= 0)
+        return (int)received;
+    *offset = ntohl(header.offset);
+    *length = ntohl(header.length);
+    *flags = ntohl(header.flags);
+    return 1;
+}
+
+size_t tcp_pack_chunk(const char *data, size_t size, char *frame) {
+    Chunk_Header header;
+    char *payload = frame + sizeof(Chunk_Header);
+
+    // Pieces that do not shrink are stored raw, so random data costs only the frame header.
+    int compressed = lz_compress(data, (int)size, payload, (int)size - 1);
+    if (compressed <= 0) {
+        memcpy(payload, data, size);
+        compressed = (int)size;
+    }
+
+    header.raw_length = htonl((uint32_t)size);
+    header.wire_length = htonl((uint32_t)compressed);
+    memcpy(frame, &header, sizeof(header));
+    return sizeof(header) + compressed;
+}
+
+ssize_t tcp_recv_chunk(int sock, char *frame) {
+    Chunk_Header header;
+    ssize_t received = tcp_recv_all(sock, &header, sizeof(header));
+    if (received <= 0)
+        return received;
+
+    size_t wire_length = ntohl(header.wire_length);
+    if (wire_length > CHUNK_FRAME_SIZE - sizeof(header))
+        return -1;
+    memcpy(frame, &header, sizeof(header));
+
+    received = tcp_recv_all(sock, frame + sizeof(header), wire_length);
+    if (received <= 0 && wire_length > 0)
+        return received;
+    return sizeof(header) + wire_length;
+}
+
+ssize_t tcp_unpack_chunk(const char *frame, size_t frame_size, char *dest, size_t capacity) {
+    Chunk_Header header;
+    if (frame_size < sizeof(header))
+        return -1;
+    memcpy(&header, frame, sizeof(header));
+
+    size_t raw_length = ntohl(header.raw_length);
+    size_t wire_length = ntohl(header.wire_length);
+    const char *payload = frame + sizeof(header);
+    if (wire_length != frame_size - sizeof(header) || raw_length > capacity)
+        return -1;
+
+    if (wire_length == raw_length) {
+        memcpy(dest, payload, raw_length);
+        return raw_length;
+    }
+    int decompressed = lz_decompress(payload, (int)wire_length, dest, (int)raw_length);
+    return decompressed == (int)raw_length ? decompressed : -1;
+}
+
+void tcp_pack_stream_ack(char *reply, uint64_t digest) {
+    uint64_t wire_digest = htobe64(digest);
+    memcpy(reply, "ACK", 3);
+    memcpy(reply + 3, &wire_digest, sizeof(wire_digest));
+}
+
+int tcp_send_stream_ack(int sock, uint64_t digest) {
+    char reply[STREAM_ACK_SIZE];
+    tcp_pack_stream_ack(reply, digest);
+    return tcp_send_all(sock, reply, sizeof(reply)) < 0 ? -1 : 0;
+}
+
+int tcp_recv_stream_ack(int sock, uint64_t *digest) {
+    char reply[STREAM_ACK_SIZE];
+    uint64_t wire_digest;
+    if (tcp_recv_all(sock, reply, sizeof(reply)) <= 0 || memcmp(reply, "ACK", 3) != 0)
+        return -1;
+    memcpy(&wire_digest, reply + 3, sizeof(wire_digest));
+    *digest = be64toh(wire_digest);
+    return 0;
+}
+
+int tcp_send_continue_request(int sock, uint64_t file_id, size_t *delivered) {
+    uint64_t wire_value = htobe64(file_id);
+    if (tcp_send_all(sock, &wire_value, sizeof(wire_value)) < 0 || tcp_recv_all(sock, &wire_value, sizeof(wire_value)) <= 0)
+        return -1;
+    *delivered = be64toh(wire_value);
+    return 0;
+}
+
+int tcp_recv_continue_request(int sock, uint64_t *file_id) {
+    uint64_t wire_file_id;
+    if (tcp_recv_all(sock, &wire_file_id, sizeof(wire_file_id)) <= 0)
+        return -1;
+    *file_id = be64toh(wire_file_id);
+    return 0;
+}
+
+int tcp_send_continue_reply(int sock, size_t delivered) {
+    uint64_t wire_delivered = htobe64(delivered);
+    return tcp_send_all(sock, &wire_delivered, sizeof(wire_delivered)) < 0 ? -1 : 0;
+}
+
+uint64_t tcp_file_id(const char *path) {
+    struct stat info;
+    if (stat(path, &info) < 0) {
+        perror("stat(2)");
+        return 0;
+    }
+    uint64_t fields[4] = {(uint64_t)info.st_size, (uint64_t)info.st_mtim.tv_sec, (uint64_t)info.st_mtim.tv_nsec, (uint64_t)info.st_ino};
+    uint64_t id = crc64_update(crc64_update(0, path, strlen(path)), fields, sizeof(fields));
+    return id != 0 ? id : 1;
+}
+
+// Writes magic, file ID, range count and the ranges, all big endian. Called with the lock held.
+static void checkpoint_write(TCP_Checkpoint *checkpoint) {
+    uint64_t image[3 + 2 * MAX_EXTENTS];
+    image[0] = htobe64(CHECKPOINT_MAGIC);
+    image[1] = htobe64(checkpoint->file_id);
+    image[2] = htobe64((uint64_t)checkpoint->count);
+    for (int i = 0; i < checkpoint->count; i++) {
+        image[3 + 2 * i] = htobe64(checkpoint->extents[i].start);
+        image[4 + 2 * i] = htobe64(checkpoint->extents[i].end);
+    }
+    // One small write at offset 0, so a crash leaves either the old or the new checkpoint.
+    size_t size = (3 + 2 * checkpoint->count) * sizeof(uint64_t);
+    if (pwrite(checkpoint->fd, image, size, 0) != (ssize_t)size)
+        perror("pwrite(2)");
+}
+
+int tcp_checkpoint_open(TCP_Checkpoint *checkpoint, const char *path, int spool_valid) {
+    memset(checkpoint, 0, sizeof(TCP_Checkpoint));
+    pthread_mutex_init(&checkpoint->lock, NULL);
+    checkpoint->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (checkpoint->fd < 0) {
+        perror("open(2)");
+        return -1;
+    }
+
+    uint64_t image[3 + 2 * MAX_EXTENTS];
+    ssize_t size = spool_valid ? pread(checkpoint->fd, image, sizeof(image), 0) : 0;
+    if (size < 3 * (ssize_t)sizeof(uint64_t) || be64toh(image[0]) != CHECKPOINT_MAGIC)
+        return 0;
+    uint64_t count = be64toh(image[2]);
+    if (count > MAX_EXTENTS || size < (ssize_t)((3 + 2 * count) * sizeof(uint64_t)))
+        return 0;
+
+    checkpoint->file_id = be64toh(image[1]);
+    checkpoint->count = (int)count;
+    for (int i = 0; i < checkpoint->count; i++) {
+        checkpoint->extents[i].start = be64toh(image[3 + 2 * i]);
+        checkpoint->extents[i].end = be64toh(image[4 + 2 * i]);
+    }
+    return 0;
+}
+
+void tcp_checkpoint_add(TCP_Checkpoint *checkpoint, uint64_t start, uint64_t end) {
+    if (start >= end)
+        return;
+    pthread_mutex_lock(&checkpoint->lock);
+
+    // Swallow every range that overlaps or touches [start, end), then insert the union in order.
+    Extent merged = {start, end};
+    int kept = 0, position = 0;
+    for (int i = 0; i < checkpoint->count; i++) {
+        Extent extent = checkpoint->extents[i];
+        if (extent.end < merged.start || extent.start > merged.end) {
+            if (extent.end < merged.start)
+                position = kept + 1;
+            checkpoint->extents[kept++] = extent;
+        } else {
+            merged.start = extent.start < merged.start ? extent.start : merged.start;
+            merged.end = extent.end > merged.end ? extent.end : merged.end;
+        }
+    }
+    if (kept < MAX_EXTENTS) {
+        memmove(&checkpoint->extents[position + 1], &checkpoint->extents[position], (kept - position) * sizeof(Extent));
+        checkpoint->extents[position] = merged;
+        kept++;
+    }
+    checkpoint->count = kept;
+
+    checkpoint_write(checkpoint);
+    pthread_mutex_unlock(&checkpoint->lock);
+}
+
+size_t tcp_checkpoint_delivered(TCP_Checkpoint *checkpoint, uint64_t file_id, size_t offset, size_t length) {
+    size_t delivered = 0;
+    pthread_mutex_lock(&checkpoint->lock);
+    if (checkpoint->file_id != file_id) {
+        checkpoint->file_id = file_id;
+        checkpoint->count = 0;
+        checkpoint_write(checkpoint);
+    }
+    for (int i = 0; file_id != 0 && i < checkpoint->count; i++) {
+        Extent extent = checkpoint->extents[i];
+        if (extent.start <= offset && offset < extent.end) {
+            delivered = extent.end - offset < length ? extent.end - offset : length;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+    return delivered;
+}
+
+void tcp_checkpoint_clear(TCP_Checkpoint *checkpoint) {
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->file_id = 0;
+    checkpoint->count = 0;
+    checkpoint_write(checkpoint);
+    pthread_mutex_unlock(&checkpoint->lock);
+}
+
+void tcp_checkpoint_close(TCP_Checkpoint *checkpoint) {
+    close(checkpoint->fd);
+    pthread_mutex_destroy(&checkpoint->lock);
+}
+
+double tcp_elapsed_ms(const struct timeval *start, const struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
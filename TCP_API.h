@@ -0,0 +1,150 @@
+#ifndef TCP_API_H
+#define TCP_API_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "lz.h"
+
+#define BUFFER_SIZE (2 * 1024 * 1024)
+#define MAX_STREAMS 16
+
+// Stripes are sent and hashed in pieces of this size, so hashing overlaps with the transfer.
+#define DIGEST_CHUNK (64 * 1024)
+
+// Length of the reply to a stripe: "ACK" followed by the receiver's CRC-64 of the stripe.
+#define STREAM_ACK_SIZE (3 + sizeof(uint64_t))
+
+/*
+* Every stripe of a transfer starts with this header, sent in network byte order.
+* A single connection transfer is one stripe covering the whole file.
+* A header with length 0 tells the receiver that the sender is done.
+*/
+typedef struct {
+    uint32_t offset; // Offset of the stripe inside the file.
+    uint32_t length; // Number of file bytes that follow on this connection.
+    uint32_t flags;  // STREAM_* bits describing how the stripe is encoded.
+} Stream_Header;
+
+// The stripe is sent as a series of Chunk_Header frames, each holding one piece of up to DIGEST_CHUNK bytes.
+#define STREAM_COMPRESSED 1
+// The header is followed by the 8 byte ID of the file, and the receiver answers with the number of leading
+// stripe bytes its checkpoint already holds (8 bytes). Only the rest of the stripe is sent.
+#define STREAM_CONTINUE 2
+
+// Most disjoint received ranges a checkpoint records.
+#define MAX_EXTENTS 64
+// Stripe bytes a stream receives between two checkpoint saves. What arrived since the last save is recorded
+// when the stream ends, so only a receiver that dies has to receive it again.
+#define CHECKPOINT_SAVE_BYTES (256 * 1024)
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} Extent;
+
+/*
+* Receiver checkpoint of a resumable transfer: the byte ranges of a file already in the spool.
+* Each connection delivers its stripe in order, so a few ranges describe any interrupted transfer.
+*/
+typedef struct {
+    uint64_t file_id;                // File whose ranges are recorded, 0 if none.
+    int count;                       // Number of ranges.
+    Extent extents[MAX_EXTENTS];     // Sorted, disjoint and not touching.
+    int fd;                          // The checkpoint file.
+    pthread_mutex_t lock;            // Serializes the streams' updates.
+} TCP_Checkpoint;
+
+/*
+* Frame of one piece of a compressed stripe, followed by wire_length bytes of payload.
+* The payload is an lz block, or the raw piece when wire_length == raw_length.
+* Every frame decodes on its own, so pieces can be decompressed independently.
+*/
+typedef struct {
+    uint32_t raw_length;
+    uint32_t wire_length;
+} Chunk_Header;
+
+// Largest frame a DIGEST_CHUNK piece can turn into.
+#define CHUNK_FRAME_SIZE (sizeof(Chunk_Header) + LZ_COMPRESS_BOUND(DIGEST_CHUNK))
+
+/*
+* @brief Sends exactly size bytes, retrying on short writes.
+* @return size on success, -1 on error.
+*/
+ssize_t tcp_send_all(int sock, const void *data, size_t size);
+
+/*
+* @brief Receives exactly size bytes, retrying on short reads.
+* @return size on success, 0 if the peer closed the connection first, -1 on error.
+*/
+ssize_t tcp_recv_all(int sock, void *data, size_t size);
+
+/*
+* @brief Splits total bytes into streams stripes and returns the bounds of stripe index.
+* Both sides call this with the same arguments so they agree on the layout.
+*/
+void tcp_stripe(size_t total, int streams, int index, size_t *offset, size_t *length);
+
+int tcp_send_stream_header(int sock, size_t offset, size_t length, uint32_t flags);
+int tcp_recv_stream_header(int sock, size_t *offset, size_t *length, uint32_t *flags);
+
+/*
+* @brief Builds the frame of one piece into frame, compressed when that saves space.
+* @param frame At least CHUNK_FRAME_SIZE bytes.
+* @return The frame size.
+*/
+size_t tcp_pack_chunk(const char *data, size_t size, char *frame);
+
+/*
+* @brief Receives one frame into frame (at least CHUNK_FRAME_SIZE bytes).
+* @return The frame size, 0 if the peer closed the connection, -1 on error.
+*/
+ssize_t tcp_recv_chunk(int sock, char *frame);
+
+/*
+* @brief Decodes a frame into dest.
+* @return The piece size, or -1 if the frame is malformed or the piece does not fit in capacity.
+*/
+ssize_t tcp_unpack_chunk(const char *frame, size_t frame_size, char *dest, size_t capacity);
+
+// Builds the STREAM_ACK_SIZE byte reply that acknowledges a stripe with its digest.
+void tcp_pack_stream_ack(char *reply, uint64_t digest);
+int tcp_send_stream_ack(int sock, uint64_t digest);
+int tcp_recv_stream_ack(int sock, uint64_t *digest);
+
+int tcp_send_continue_request(int sock, uint64_t file_id, size_t *delivered);
+int tcp_recv_continue_request(int sock, uint64_t *file_id);
+int tcp_send_continue_reply(int sock, size_t delivered);
+
+// Identifies a file by its path, size, modification time and inode, so an edited file is never continued.
+uint64_t tcp_file_id(const char *path);
+
+/*
+* @brief Opens the checkpoint at path, loading what an earlier run recorded.
+* @param spool_valid Whether the data the recorded ranges went to survived; if not, the checkpoint starts empty.
+* @return 0 on success, -1 on error.
+*/
+int tcp_checkpoint_open(TCP_Checkpoint *checkpoint, const char *path, int spool_valid);
+
+// Records that [start, end) of the file arrived, and saves the checkpoint.
+void tcp_checkpoint_add(TCP_Checkpoint *checkpoint, uint64_t start, uint64_t end);
+
+/*
+* @brief Returns how many leading bytes of the stripe [offset, offset + length) of file_id the checkpoint holds.
+* A different file than the recorded one starts over with an empty checkpoint, and file_id 0 stands for a sender
+* that does not continue: the checkpoint then records its stripes, but never offers them.
+*/
+size_t tcp_checkpoint_delivered(TCP_Checkpoint *checkpoint, uint64_t file_id, size_t offset, size_t length);
+
+// Forgets the file once it was received completely.
+void tcp_checkpoint_clear(TCP_Checkpoint *checkpoint);
+void tcp_checkpoint_close(TCP_Checkpoint *checkpoint);
+
+// Returns the time between start and end in milliseconds.
+double tcp_elapsed_ms(const struct timeval *start, const struct timeval *end);
+
+#endif
@@ -1,61 +1,289 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "TCP_API.h"
+#include "crc64.h"
+#include "latency.h"
+#include "report.h"
+#include "writer.h"
+#include "placement.h"
 
 #define SERVER_IP "127.0.0.1"
-#define MAX_CLIENTS 1
-#define BUFFER_SIZE 2 * 1024 * 1024
+#define MAX_CLIENTS MAX_STREAMS
+// Size of the buffer every epoll worker reads into, shared by all of its connections.
+#define RECV_BUFFER_SIZE (256 * 1024)
+#define MAX_WORKERS 64
+#define MAX_EVENTS 64
+#define READ_BUDGET (4 * RECV_BUFFER_SIZE) // Bytes a worker reads from one connection before it serves the others.
 
 typedef struct {
     double time_taken;
     double bandwidth;
+    double digest_time;
+    double wire_bandwidth;
+    double decompress_time;
 } FileStats;
 
-int main(int argc, char *argv[]) {
+// Per-stream state handed to a receiver thread.
+typedef struct {
+    int sock;                // Accepted socket of this stream.
+    char *received_data;     // Reassembly buffer shared by all streams, NULL when writing to a file.
+    Writer *writer;          // With -o, the stripe is received into the blocks of this writer instead.
+    size_t offset;           // Stripe offset announced by the sender.
+    size_t length;           // Stripe length announced by the sender.
+    struct timeval start;    // Time the stripe header arrived.
+    struct timeval end;      // Time the last byte of the stripe arrived.
+    uint64_t digest;         // CRC-64 of the stripe, computed as it arrives.
+    double digest_ms;        // Time spent hashing.
+    size_t wire_bytes;       // Bytes of the stripe that came over the wire.
+    double decompress_ms;    // Time spent decompressing.
+    int timestamps;          // Collect kernel receive timestamps.
+    Latency_Samples kernel_to_app; // Kernel arrival of the last segment of each read until recvmsg() returned it.
+    TCP_Checkpoint *checkpoint;    // Records the received bytes, NULL if not checkpointing.
+    size_t resumed;          // Leading stripe bytes the checkpoint already held.
+    size_t progress;         // Leading stripe bytes received so far, the checkpoint is behind by less than
+                             // CHECKPOINT_SAVE_BYTES until the stream ends.
+    uint64_t bytes_counter;  // Stripe bytes received over all runs, sampled by the interval reports.
+    int cpu;                 // CPU the receiving thread is pinned to, -1 if not pinned.
+    int status;              // 1 stripe received, 0 sender is done, -1 error.
+} StreamArgs;
 
-    int server_port;
-    char *algorithm;
+// Receives one stripe into its place in the shared buffer and acknowledges it.
+void *receive_stream(void *arg) {
+    StreamArgs *stream = (StreamArgs *)arg;
+    stream->status = -1;
+    stream->progress = 0;
+    placement_pin(stream->cpu);
 
-    if(argc != 5){
-        fprintf(stderr, "Usage: %s -p <server_port> -algo <algorithm>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    uint32_t flags;
+    int header = tcp_recv_stream_header(stream->sock, &stream->offset, &stream->length, &flags);
+    if (header < 0) {
+        perror("recv(2)");
+        return NULL;
+    }
+    if (header == 0 || stream->length == 0) {
+        stream->status = 0;
+        return NULL;
+    }
+    if (stream->offset + stream->length > BUFFER_SIZE) {
+        fprintf(stderr, "Stripe %zu+%zu is out of bounds.\n", stream->offset, stream->length);
+        return NULL;
     }
 
-    for (size_t i = 0; i < argc; i++)
-    {
-        if (strcmp(argv[i], "-p") == 0)
-        {
-            server_port = atoi(argv[i+1]);
-        }
-        else if (strcmp(argv[i], "-algo") == 0)
-        {
-            algorithm = argv[i+1];
+    // A continuing sender names its file, and skips what the checkpoint already holds of the stripe. Any other
+    // sender moves the checkpoint off the file it held, its stripes must not be recorded under that file.
+    uint64_t file_id = 0;
+    if ((flags & STREAM_CONTINUE) && tcp_recv_continue_request(stream->sock, &file_id) < 0) {
+        perror("recv(2)");
+        return NULL;
+    }
+    stream->resumed = 0;
+    if (stream->checkpoint != NULL)
+        stream->resumed = tcp_checkpoint_delivered(stream->checkpoint, file_id, stream->offset, stream->length);
+    if ((flags & STREAM_CONTINUE) && tcp_send_continue_reply(stream->sock, stream->resumed) < 0) {
+        perror("send(2)");
+        return NULL;
+    }
+    stream->progress = stream->resumed;
+
+    //start the timer
+    gettimeofday(&stream->start, NULL);
+
+    char *frame = NULL;
+    if (flags & STREAM_COMPRESSED) {
+        frame = (char *)malloc(CHUNK_FRAME_SIZE);
+        if (frame == NULL) {
+            perror("malloc(3)");
+            return NULL;
         }
     }
 
+    // Receive the stripe, hashing every piece as soon as it is in the buffer
+    char *data = stream->received_data != NULL ? stream->received_data + stream->offset : NULL;
+    size_t total_bytes_received = stream->resumed, saved = stream->resumed;
+    stream->digest = crc64_update(0, data, stream->resumed);
+    stream->digest_ms = 0;
+    stream->wire_bytes = 0;
+    stream->decompress_ms = 0;
+    latency_reset(&stream->kernel_to_app);
+    char *block = NULL;      // Writer block being filled, from block_offset in the file on.
+    size_t block_size = 0;
+    off_t block_offset = 0;
+    while (total_bytes_received < stream->length) {
+        size_t remaining = stream->length - total_bytes_received;
+        char *target;
+        ssize_t bytes_received;
 
-    fprintf(stdout, "Starting Receiver...\n");
+        if (stream->writer != NULL) {
+            // A frame decodes whole, so a block takes it only if it has room for a full piece.
+            size_t piece = remaining < DIGEST_CHUNK ? remaining : DIGEST_CHUNK;
+            if (block != NULL && (frame != NULL ? WRITER_BLOCK_SIZE - block_size < piece : block_size == WRITER_BLOCK_SIZE)) {
+                writer_commit(stream->writer, block_size, block_offset);
+                block = NULL;
+            }
+            if (block == NULL) {
+                block = writer_block(stream->writer);
+                block_size = 0;
+                block_offset = (off_t)(stream->offset + total_bytes_received);
+            }
+            target = block + block_size;
+            if (remaining > WRITER_BLOCK_SIZE - block_size)
+                remaining = WRITER_BLOCK_SIZE - block_size;
+        } else {
+            target = data + total_bytes_received;
+        }
+
+        if (frame != NULL) {
+            // Every frame decodes on its own, straight into its place in the file.
+            ssize_t frame_size = tcp_recv_chunk(stream->sock, frame);
+            if (frame_size <= 0) {
+                perror("recv(2)");
+                free(frame);
+                return NULL;
+            }
+            stream->wire_bytes += frame_size;
 
-    // The variable to store the socket file descriptor.
-    int sock = -1;
+            struct timeval unpack_start, unpack_end;
+            gettimeofday(&unpack_start, NULL);
+            bytes_received = tcp_unpack_chunk(frame, frame_size, target, remaining);
+            gettimeofday(&unpack_end, NULL);
+            stream->decompress_ms += tcp_elapsed_ms(&unpack_start, &unpack_end);
+            if (bytes_received <= 0) {
+                fprintf(stderr, "Malformed frame at offset %zu.\n", stream->offset + total_bytes_received);
+                free(frame);
+                return NULL;
+            }
+        } else if (stream->timestamps) {
+            // recvmsg() hands over the kernel's timestamp of the newest segment in the read
+            char control[LATENCY_CONTROL_SIZE];
+            struct iovec iov = {.iov_base = target, .iov_len = remaining < DIGEST_CHUNK ? remaining : DIGEST_CHUNK};
+            struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+            bytes_received = recvmsg(stream->sock, &message, 0);
+            if (bytes_received <= 0) {
+                perror("recvmsg(2)");
+                return NULL;
+            }
+            int64_t app_time = latency_now_ns();
+            int64_t kernel_time = latency_rx_timestamp(&message);
+            if (kernel_time != 0)
+                latency_add(&stream->kernel_to_app, app_time - kernel_time);
+            stream->wire_bytes += bytes_received;
+        } else {
+            bytes_received = recv(stream->sock, target, remaining < DIGEST_CHUNK ? remaining : DIGEST_CHUNK, 0);
+            if (bytes_received <= 0) {
+                perror("recv(2)");
+                return NULL;
+            }
+            stream->wire_bytes += bytes_received;
+        }
 
-    // The variable to store the receiver's and sender's address.
-    struct sockaddr_in sender_addr, receiver_addr;
+        struct timeval hash_start, hash_end;
+        gettimeofday(&hash_start, NULL);
+        stream->digest = crc64_update(stream->digest, target, bytes_received);
+        gettimeofday(&hash_end, NULL);
+        stream->digest_ms += tcp_elapsed_ms(&hash_start, &hash_end);
 
-    // Stores the sender's structure length.
+        block_size += bytes_received;
+        total_bytes_received += bytes_received;
+        REPORT_ADD(stream->bytes_counter, bytes_received);
+        stream->progress = total_bytes_received;
+        if (stream->checkpoint != NULL && total_bytes_received - saved >= CHECKPOINT_SAVE_BYTES) {
+            tcp_checkpoint_add(stream->checkpoint, stream->offset, stream->offset + total_bytes_received);
+            saved = total_bytes_received;
+        }
+    }
+
+    // Stop the clock
+    gettimeofday(&stream->end, NULL);
+    free(frame);
+    if (block != NULL)
+        writer_commit(stream->writer, block_size, block_offset);
+
+    // Send acknowledgment back to the sender, with the digest of what was received
+    if (tcp_send_stream_ack(stream->sock, stream->digest) < 0) {
+        perror("send(2)");
+        return NULL;
+    }
+
+    stream->status = 1;
+    return NULL;
+}
+
+// Accepts a connection for every stream of the sender.
+// Returns 0 on success, -1 on error.
+int accept_streams(int sock, int *sender_socks, int streams, int timestamps) {
+    struct sockaddr_in sender_addr;
     socklen_t sender_addr_len = sizeof(sender_addr);
+    for (int i = 0; i < streams; i++) {
+        sender_socks[i] = accept(sock, (struct sockaddr *)&sender_addr, &sender_addr_len);
+        if (sender_socks[i] < 0){
+            perror("accept(2)");
+            return -1;
+        }
+        fprintf(stdout, "Connection accepted from %s:%d\n", inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
+        if (timestamps && latency_enable_rx(sender_socks[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-    // Reset the receiver and sender structures to zeros.
+// What the interval reports of the streams sample. TCP_INFO counts per connection, so the counts of a
+// connection that is replaced (or whose descriptor is reused) are carried over instead of going backwards.
+typedef struct {
+    StreamArgs *streams;
+    int count;
+    Report_Sample base[MAX_STREAMS]; // Counts of the streams' earlier connections.
+    Report_Sample last[MAX_STREAMS]; // Counts of the streams' current connections at the last sample.
+} StreamReport;
+
+void sample_streams(void *arg, Report_Sample *sample) {
+    StreamReport *report = (StreamReport *)arg;
+    for (int i = 0; i < report->count; i++) {
+        Report_Sample now = {0};
+        sample->bytes += REPORT_READ(report->streams[i].bytes_counter);
+        if (report_add_tcp_info(REPORT_READ(report->streams[i].sock), &now) < 0)
+            now = report->last[i];
+        if (now.packets < report->last[i].packets) {
+            report->base[i].packets += report->last[i].packets;
+            report->base[i].lost += report->last[i].lost;
+        }
+        report->last[i] = now;
+        sample->packets += report->base[i].packets + now.packets;
+        sample->lost += report->base[i].lost + now.lost;
+    }
+}
+
+/*
+* @brief Creates the listening socket of the receiver: address reuse, the congestion control algorithm,
+* bound to SERVER_IP:port. With reuse_port several sockets can listen on the same port and the kernel spreads
+* the incoming connections over them.
+* @return The socket, exits on error.
+*/
+int open_listener(int port, const char *algorithm, int reuse_port, int backlog) {
+    // The variable to store the receiver's address.
+    struct sockaddr_in receiver_addr;
+
+    // Reset the receiver structure to zeros.
     memset(&receiver_addr, 0, sizeof(receiver_addr));
-    memset(&sender_addr, 0, sizeof(sender_addr));
 
     // Try to create a TCP socket (IPv4).
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == -1){
         perror("socket(2)");
         exit(EXIT_FAILURE);
@@ -68,6 +296,11 @@ int main(int argc, char *argv[]) {
         close(sock);
         exit(EXIT_FAILURE);
     }
+    if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0){
+        perror("setsockopt(2)");
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
     // Set the congestion control algorithm.
     if(setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, algorithm, strlen(algorithm)) < 0){
@@ -85,7 +318,7 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     // Set the receiver's port number.
-    receiver_addr.sin_port = htons(server_port);
+    receiver_addr.sin_port = htons(port);
 
     // Bind the socket to the receiver's address.
     if (bind(sock, (struct sockaddr *)&receiver_addr, sizeof(receiver_addr)) < 0){
@@ -95,117 +328,897 @@ int main(int argc, char *argv[]) {
     }
 
     // Listen for incoming connections.
-    if (listen(sock, MAX_CLIENTS) < 0){
+    if (listen(sock, backlog) < 0){
         perror("listen(2)");
         close(sock);
         exit(EXIT_FAILURE);
     }
+    return sock;
+}
+
+/*
+* Event-driven server mode (-epoll): every worker thread owns a listening socket (SO_REUSEPORT when there are
+* several workers) and an edge-triggered epoll set of non-blocking connections. Each connection is an
+* independent sender stream, parsed by a small state machine, so any number of senders can be served at once.
+* Stripes are hashed and acknowledged as they arrive instead of being reassembled, so a worker needs only one
+* receive buffer however many connections it serves.
+*/
+
+typedef enum {
+    CONN_HEADER,       // Reading a Stream_Header.
+    CONN_CONTINUE,     // Reading the file ID of a continuing stripe.
+    CONN_DATA,         // Reading raw stripe bytes.
+    CONN_FRAME_HEADER, // Reading the Chunk_Header of a compressed piece.
+    CONN_FRAME,        // Reading the payload of a compressed piece.
+    CONN_DONE          // The sender finished or the connection failed, it is closed next.
+} ConnectionState;
+
+// State of one sender connection in the epoll server.
+typedef struct Connection {
+    struct Connection *next;           // The worker's open connections.
+    struct Connection *prev;
+    int sock;
+    char peer[INET_ADDRSTRLEN + 8];    // "address:port" of the sender.
+    ConnectionState state;
+    char field[sizeof(Stream_Header)]; // Header or file ID being assembled across reads.
+    size_t field_size;                 // Bytes the field needs.
+    size_t field_have;                 // Bytes of the field read so far.
+    char *frame;                       // Compressed frame being assembled, allocated by the first compressed stripe.
+    size_t frame_size;                 // Size of the whole frame, header included.
+    size_t frame_have;                 // Bytes of the frame read so far.
+    size_t offset;                     // Stripe offset announced by the sender.
+    size_t length;                     // Stripe length announced by the sender.
+    uint32_t flags;                    // STREAM_* bits of the stripe.
+    size_t received;                   // Stripe bytes received so far.
+    uint64_t digest;                   // CRC-64 of the stripe, computed as it arrives.
+    struct timeval start;              // Time the stripe header arrived.
+    char out[sizeof(uint64_t) + STREAM_ACK_SIZE]; // Replies the kernel has not taken yet.
+    size_t out_size;
+    size_t out_sent;
+    int finished;                      // The sender said it is done.
+    // Statistics over the life of the connection.
+    size_t stripes;                    // Stripes received completely.
+    size_t bytes;                      // Stripe bytes received.
+    size_t wire_bytes;                 // Bytes read from the socket.
+    double transfer_ms;                // Time from stripe headers to their last bytes.
+} Connection;
+
+// A worker thread of the epoll server and its totals.
+typedef struct {
+    int index;
+    int listener;       // This worker's listening socket.
+    int epoll_fd;
+    int stop_fd;        // eventfd shared by all workers, readable once the server stops.
+    char *buffer;       // The worker's receive buffer, RECV_BUFFER_SIZE bytes.
+    char *piece;        // Decompressed piece, DIGEST_CHUNK bytes.
+    Connection *open;   // Open connections, closed when the server stops.
+    size_t connections; // Connections accepted.
+    size_t interrupted; // Connections that closed in the middle of a stripe.
+    size_t stripes;
+    uint64_t bytes;     // Stripe bytes received, sampled by the interval reports.
+    size_t wire_bytes;
+    int cpu;            // CPU the worker is pinned to, -1 if not pinned.
+    int status;         // 0 on success, -1 on error.
+} Worker;
+
+typedef struct {
+    Worker *workers;
+    int count;
+} WorkerReport;
+
+void sample_workers(void *arg, Report_Sample *sample) {
+    WorkerReport *report = (WorkerReport *)arg;
+    for (int i = 0; i < report->count; i++)
+        sample->bytes += REPORT_READ(report->workers[i].bytes);
+}
+
+// Starts assembling a field of size bytes (a header or file ID) in the given state.
+static void connection_expect(Connection *conn, ConnectionState state, size_t size) {
+    conn->state = state;
+    conn->field_size = size;
+    conn->field_have = 0;
+}
+
+// Hands the queued replies to the kernel, as far as it takes them.
+// Returns 0 when done or the socket is full (EPOLLOUT resumes it), -1 on error.
+static int connection_flush(Connection *conn) {
+    while (conn->out_sent < conn->out_size) {
+        ssize_t sent = send(conn->sock, conn->out + conn->out_sent, conn->out_size - conn->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->out_sent += sent;
+    }
+    conn->out_size = conn->out_sent = 0;
+    return 0;
+}
+
+static int connection_reply(Connection *conn, const void *data, size_t size) {
+    if (conn->out_size + size > sizeof(conn->out)) {
+        fprintf(stderr, "%s: too many replies pending.\n", conn->peer);
+        return -1;
+    }
+    memcpy(conn->out + conn->out_size, data, size);
+    conn->out_size += size;
+    return connection_flush(conn);
+}
+
+static void connection_begin_stripe(Connection *conn) {
+    gettimeofday(&conn->start, NULL);
+    conn->received = 0;
+    conn->digest = 0;
+    if (conn->flags & STREAM_COMPRESSED)
+        connection_expect(conn, CONN_FRAME_HEADER, sizeof(Chunk_Header));
+    else
+        conn->state = CONN_DATA;
+}
+
+// Adds a piece of the stripe to its digest, and acknowledges the stripe once it is complete.
+static int connection_stripe_data(Worker *worker, Connection *conn, const char *data, size_t size) {
+    conn->digest = crc64_update(conn->digest, data, size);
+    conn->received += size;
+    REPORT_ADD(worker->bytes, size);
+    if (conn->received < conn->length)
+        return 0;
+
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    double time_taken = tcp_elapsed_ms(&conn->start, &end);
+    conn->transfer_ms += time_taken;
+    conn->stripes++;
+    conn->bytes += conn->length;
+    worker->stripes++;
+    fprintf(stdout, "%s: stripe %zu+%zu received, CRC-64 %016" PRIx64 ", Time = %.2f ms\n",
+            conn->peer, conn->offset, conn->length, conn->digest, time_taken);
+
+    char reply[STREAM_ACK_SIZE];
+    tcp_pack_stream_ack(reply, conn->digest);
+    connection_expect(conn, CONN_HEADER, sizeof(Stream_Header));
+    return connection_reply(conn, reply, sizeof(reply));
+}
+
+// A complete field arrived in the header, continue or frame header state.
+static int connection_field(Worker *worker, Connection *conn) {
+    if (conn->state == CONN_HEADER) {
+        Stream_Header header;
+        memcpy(&header, conn->field, sizeof(header));
+        conn->offset = ntohl(header.offset);
+        conn->length = ntohl(header.length);
+        conn->flags = ntohl(header.flags);
+        if (conn->length == 0) {
+            conn->finished = 1;
+            conn->state = CONN_DONE;
+        } else if (conn->flags & STREAM_CONTINUE) {
+            connection_expect(conn, CONN_CONTINUE, sizeof(uint64_t));
+        } else {
+            connection_begin_stripe(conn);
+        }
+        return 0;
+    }
+
+    if (conn->state == CONN_CONTINUE) {
+        // The server keeps no checkpoint, a continuing sender sends the whole stripe.
+        uint64_t delivered = 0;
+        connection_begin_stripe(conn);
+        return connection_reply(conn, &delivered, sizeof(delivered));
+    }
+
+    // CONN_FRAME_HEADER: the frame is assembled whole, it only decodes as a unit.
+    Chunk_Header header;
+    memcpy(&header, conn->field, sizeof(header));
+    size_t wire_length = ntohl(header.wire_length);
+    if (wire_length == 0 || wire_length > CHUNK_FRAME_SIZE - sizeof(header)) {
+        fprintf(stderr, "%s: malformed frame at offset %zu.\n", conn->peer, conn->offset + conn->received);
+        return -1;
+    }
+    if (conn->frame == NULL && (conn->frame = (char *)malloc(CHUNK_FRAME_SIZE)) == NULL) {
+        perror("malloc(3)");
+        return -1;
+    }
+    memcpy(conn->frame, &header, sizeof(header));
+    conn->frame_size = sizeof(header) + wire_length;
+    conn->frame_have = sizeof(header);
+    conn->state = CONN_FRAME;
+    return 0;
+}
+
+/*
+* @brief Runs bytes read from the connection through its state machine.
+* @return 0 on success, -1 if the sender broke the protocol or a reply failed.
+*/
+static int connection_consume(Worker *worker, Connection *conn, const char *data, size_t size) {
+    while (size > 0 && conn->state != CONN_DONE) {
+        size_t take;
+        switch (conn->state) {
+        case CONN_DATA:
+            take = conn->length - conn->received < size ? conn->length - conn->received : size;
+            if (connection_stripe_data(worker, conn, data, take) < 0)
+                return -1;
+            break;
+        case CONN_FRAME:
+            take = conn->frame_size - conn->frame_have < size ? conn->frame_size - conn->frame_have : size;
+            memcpy(conn->frame + conn->frame_have, data, take);
+            conn->frame_have += take;
+            if (conn->frame_have == conn->frame_size) {
+                size_t remaining = conn->length - conn->received;
+                ssize_t piece = tcp_unpack_chunk(conn->frame, conn->frame_size, worker->piece,
+                                                 remaining < DIGEST_CHUNK ? remaining : DIGEST_CHUNK);
+                if (piece <= 0) {
+                    fprintf(stderr, "%s: malformed frame at offset %zu.\n", conn->peer, conn->offset + conn->received);
+                    return -1;
+                }
+                connection_expect(conn, CONN_FRAME_HEADER, sizeof(Chunk_Header));
+                if (connection_stripe_data(worker, conn, worker->piece, piece) < 0)
+                    return -1;
+            }
+            break;
+        default:
+            take = conn->field_size - conn->field_have < size ? conn->field_size - conn->field_have : size;
+            memcpy(conn->field + conn->field_have, data, take);
+            conn->field_have += take;
+            if (conn->field_have == conn->field_size && connection_field(worker, conn) < 0)
+                return -1;
+            break;
+        }
+        data += take;
+        size -= take;
+    }
+    return 0;
+}
+
+/*
+* @brief Reads what the socket holds, up to READ_BUDGET bytes so a fast sender does not starve the worker's other
+* connections. Edge-triggered epoll reports no new data on a socket that was not drained, so a connection left with
+* data is re-armed: the modification queues a fresh event behind the ones already ready.
+* @return 0 while the connection stays open, -1 once it should be closed.
+*/
+static int connection_read(Worker *worker, Connection *conn) {
+    size_t budget = READ_BUDGET;
+    while (conn->state != CONN_DONE) {
+        if (budget == 0) {
+            struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = conn};
+            if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->sock, &event) < 0) {
+                perror("epoll_ctl(2)");
+                return -1;
+            }
+            return 0;
+        }
+        ssize_t received = recv(conn->sock, worker->buffer, budget < RECV_BUFFER_SIZE ? budget : RECV_BUFFER_SIZE, 0);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            perror("recv(2)");
+            return -1;
+        }
+        if (received == 0)
+            return -1;
+        conn->wire_bytes += received;
+        worker->wire_bytes += received;
+        budget -= received;
+        if (connection_consume(worker, conn, worker->buffer, received) < 0)
+            return -1;
+    }
+    return -1;
+}
+
+static void connection_close(Worker *worker, Connection *conn) {
+    // A clean end is a finished sender, or a close between stripes.
+    if (!conn->finished && (conn->state != CONN_HEADER || conn->field_have > 0)) {
+        worker->interrupted++;
+        fprintf(stdout, "%s: connection lost in the middle of a stripe.\n", conn->peer);
+    }
+    fprintf(stdout, "%s: closed after %zu stripe(s), %zu bytes (wire %zu), Speed = %.2f MB/s\n", conn->peer,
+            conn->stripes, conn->bytes, conn->wire_bytes,
+            conn->transfer_ms > 0 ? (conn->bytes / (conn->transfer_ms / 1000)) / (1024 * 1024) : 0);
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        worker->open = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->sock, NULL);
+    close(conn->sock);
+    free(conn->frame);
+    free(conn);
+}
+
+// Accepts every pending connection of the worker's listener.
+static void worker_accept(Worker *worker) {
+    while (1) {
+        struct sockaddr_in sender_addr;
+        socklen_t sender_addr_len = sizeof(sender_addr);
+        int sock = accept4(worker->listener, (struct sockaddr *)&sender_addr, &sender_addr_len, SOCK_NONBLOCK);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept4(2)");
+            return;
+        }
+
+        Connection *conn = (Connection *)calloc(1, sizeof(Connection));
+        if (conn == NULL) {
+            perror("calloc(3)");
+            close(sock);
+            continue;
+        }
+        conn->sock = sock;
+        snprintf(conn->peer, sizeof(conn->peer), "%s:%d", inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
+        connection_expect(conn, CONN_HEADER, sizeof(Stream_Header));
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = conn};
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+            perror("epoll_ctl(2)");
+            close(sock);
+            free(conn);
+            continue;
+        }
+        conn->next = worker->open;
+        if (worker->open != NULL)
+            worker->open->prev = conn;
+        worker->open = conn;
+        worker->connections++;
+        fprintf(stdout, "Connection accepted from %s (worker %d)\n", conn->peer, worker->index + 1);
+    }
+}
+
+// Serves the worker's connections until the stop eventfd becomes readable.
+void *serve_worker(void *arg) {
+    Worker *worker = (Worker *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    worker->status = -1;
+    placement_pin(worker->cpu);
+
+    while (1) {
+        int ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait(2)");
+            return NULL;
+        }
+        for (int i = 0; i < ready; i++) {
+            // The listener is registered with the worker itself, the stop eventfd with NULL.
+            if (events[i].data.ptr == NULL) {
+                while (worker->open != NULL)
+                    connection_close(worker, worker->open);
+                worker->status = 0;
+                return NULL;
+            }
+            if (events[i].data.ptr == worker) {
+                worker_accept(worker);
+                continue;
+            }
+
+            Connection *conn = (Connection *)events[i].data.ptr;
+            if (connection_flush(conn) < 0 || connection_read(worker, conn) < 0)
+                connection_close(worker, conn);
+        }
+    }
+}
+
+/*
+* @brief Runs the epoll server with the given number of workers until SIGINT or SIGTERM, then prints its totals.
+* @param interval_ms Period of the interval reports, 0 for none.
+* @param placement Where the workers' receive buffers go, first_cpu the CPU of the first worker (-1 not pinned).
+* @return The exit status.
+*/
+int serve(int port, const char *algorithm, int workers, uint32_t interval_ms, Placement *placement, int first_cpu) {
+    Worker worker_args[MAX_WORKERS];
+    pthread_t threads[MAX_WORKERS];
+    int cpus[MAX_WORKERS];
+
+    // The workers leave the signals to the main thread, which stops them through the eventfd.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    int stop_fd = eventfd(0, 0);
+    if (stop_fd < 0) {
+        perror("eventfd(2)");
+        return EXIT_FAILURE;
+    }
+
+    memset(worker_args, 0, sizeof(worker_args));
+    for (int i = 0; i < workers; i++) {
+        Worker *worker = &worker_args[i];
+        worker->index = i;
+        worker->stop_fd = stop_fd;
+        worker->cpu = cpus[i] = placement_cpu(first_cpu, i);
+        worker->listener = open_listener(port, algorithm, workers > 1, SOMAXCONN);
+        worker->epoll_fd = epoll_create1(0);
+        if (worker->epoll_fd < 0) {
+            perror("epoll_create1(2)");
+            return EXIT_FAILURE;
+        }
+        worker->buffer = (char *)placement_alloc(placement, RECV_BUFFER_SIZE);
+        worker->piece = (char *)placement_alloc(placement, DIGEST_CHUNK);
+        if (worker->buffer == NULL || worker->piece == NULL)
+            return EXIT_FAILURE;
+        if (fcntl(worker->listener, F_SETFL, fcntl(worker->listener, F_GETFL) | O_NONBLOCK) < 0) {
+            perror("fcntl(2)");
+            return EXIT_FAILURE;
+        }
+
+        struct epoll_event listen_event = {.events = EPOLLIN | EPOLLET, .data.ptr = worker};
+        struct epoll_event stop_event = {.events = EPOLLIN, .data.ptr = NULL};
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->listener, &listen_event) < 0 ||
+            epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, stop_fd, &stop_event) < 0) {
+            perror("epoll_ctl(2)");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, serve_worker, &worker_args[i]) != 0) {
+            perror("pthread_create(3)");
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(stdout, "Serving senders with %d worker(s), press Ctrl+C to stop...\n", workers);
+
+    Reporter reporter;
+    WorkerReport worker_report = {worker_args, workers};
+    if (interval_ms > 0 && report_start(&reporter, interval_ms, 0, sample_workers, &worker_report) < 0)
+        return EXIT_FAILURE;
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+        perror("write(2)");
+    for (int i = 0; i < workers; i++)
+        pthread_join(threads[i], NULL);
+    if (interval_ms > 0)
+        report_stop(&reporter);
+
+    int failed = 0;
+    size_t connections = 0, interrupted = 0, stripes = 0, wire_bytes = 0;
+    uint64_t bytes = 0;
+    fprintf(stdout, "\n-----------------------\n");
+    fprintf(stdout, "Server Statistics:\n");
+    for (int i = 0; i < workers; i++) {
+        Worker *worker = &worker_args[i];
+        failed |= worker->status < 0;
+        fprintf(stdout, "Worker %d: %zu connection(s), %zu stripe(s), %" PRIu64 " bytes (wire %zu), %zu interrupted\n",
+                i + 1, worker->connections, worker->stripes, worker->bytes, worker->wire_bytes, worker->interrupted);
+        connections += worker->connections;
+        interrupted += worker->interrupted;
+        stripes += worker->stripes;
+        bytes += worker->bytes;
+        wire_bytes += worker->wire_bytes;
+        close(worker->epoll_fd);
+        close(worker->listener);
+        placement_free(placement, worker->buffer, RECV_BUFFER_SIZE);
+        placement_free(placement, worker->piece, DIGEST_CHUNK);
+    }
+    fprintf(stdout, "Total: %zu connection(s), %zu stripe(s), %" PRIu64 " bytes (wire %zu), %zu interrupted\n",
+            connections, stripes, bytes, wire_bytes, interrupted);
+    placement_print(stdout, placement, cpus, workers);
+    fprintf(stdout, "-----------------------\n");
+    fprintf(stdout, "Receiver end\n");
+    close(stop_fd);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Returns the value of the flag at argv[*i] and steps over it. Exits if the command line ends with the flag.
+static char *option_value(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "Missing value for %s\n", argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    return argv[++*i];
+}
+
+int main(int argc, char *argv[]) {
+
+    int server_port;
+    char *algorithm;
+    int streams = 1;
+    int timestamps = 0;
+    int checkpointing = 0;
+    int event_driven = 0;
+    int workers = 1;
+    uint32_t interval_ms = 0;
+    char *output_path = NULL;
+    int ring_blocks = WRITER_BLOCKS;
+    int writer_flags = 0;
+    int hugepages = 0;
+    int first_cpu = -1;
+    char *numa = NULL;
+
+    if(argc < 5){
+        fprintf(stderr, "Usage: %s -p <server_port> -algo <algorithm> [-streams <count>] [-timestamps] [-checkpoint] [-epoll [-workers <count>]] [-interval <ms>] [-o <file> [-ring <blocks>] [-sync]] [-hugepages] [-cpu <first cpu>] [-numa <node|interface>]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0)
+        {
+            server_port = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-algo") == 0)
+        {
+            algorithm = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-streams") == 0)
+        {
+            streams = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-timestamps") == 0)
+        {
+            timestamps = 1;
+        }
+        else if (strcmp(argv[i], "-checkpoint") == 0)
+        {
+            checkpointing = 1;
+        }
+        else if (strcmp(argv[i], "-epoll") == 0)
+        {
+            event_driven = 1;
+        }
+        else if (strcmp(argv[i], "-workers") == 0)
+        {
+            workers = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-interval") == 0)
+        {
+            interval_ms = (uint32_t)atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            output_path = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-ring") == 0)
+        {
+            ring_blocks = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-sync") == 0)
+        {
+            writer_flags |= WRITER_SYNC;
+        }
+        else if (strcmp(argv[i], "-hugepages") == 0)
+        {
+            hugepages = 1;
+        }
+        else if (strcmp(argv[i], "-cpu") == 0)
+        {
+            first_cpu = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-numa") == 0)
+        {
+            numa = option_value(argc, argv, &i);
+        }
+    }
+
+    if (streams < 1 || streams > MAX_STREAMS) {
+        fprintf(stderr, "The number of streams must be between 1 and %d\n", MAX_STREAMS);
+        exit(EXIT_FAILURE);
+    }
+    if (workers < 1 || workers > MAX_WORKERS) {
+        fprintf(stderr, "The number of workers must be between 1 and %d\n", MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+    if (ring_blocks < 1 || ring_blocks > WRITER_MAX_BLOCKS) {
+        fprintf(stderr, "The number of ring blocks must be between 1 and %d\n", WRITER_MAX_BLOCKS);
+        exit(EXIT_FAILURE);
+    }
+    // The checkpoint spool already keeps the file on disk.
+    if (output_path != NULL && checkpointing) {
+        fprintf(stderr, "-o does not support -checkpoint\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Huge pages and the NUMA node apply to the reassembly buffer, the writer rings and the epoll receive buffers.
+    Placement placement;
+    int node = -1;
+    if (numa != NULL && placement_node(numa, &node) < 0)
+        exit(EXIT_FAILURE);
+    if (numa != NULL && node < 0)
+        fprintf(stdout, "%s has no NUMA node, the buffers are not bound.\n", numa);
+    placement_init(&placement, hugepages, node);
+
+
+    fprintf(stdout, "Starting Receiver...\n");
+
+    if (event_driven) {
+        // Every connection is served on its own, so there is no file to reassemble, checkpoint or timestamp.
+        if (checkpointing || timestamps || output_path != NULL) {
+            fprintf(stderr, "-epoll serves every connection on its own and does not support -checkpoint, -timestamps or -o\n");
+            exit(EXIT_FAILURE);
+        }
+        return serve(server_port, algorithm, workers, interval_ms, &placement, first_cpu);
+    }
+
+    int sock = open_listener(server_port, algorithm, 0, MAX_CLIENTS);
     fprintf(stdout, "Waiting for TCP connection...\n");
-    
-    //accept connection from an incoming client
-    int sender_sock = accept(sock, (struct sockaddr *)&sender_addr, &sender_addr_len);
-    if (sender_sock < 0){
-        perror("accept(2)");
+
+    // The streams reassemble the file into this buffer. With -checkpoint it is a shared mapping of a spool file
+    // (which is not placed), so the bytes the checkpoint lists are still there after the receiver restarts. With -o
+    // there is no buffer, every stream receives into the ring of its writer and the memory in flight stays at a
+    // ring per stream.
+    char *received_data = NULL;
+    TCP_Checkpoint checkpoint;
+    int output_fd = -1;
+    if (output_path != NULL) {
+        output_fd = writer_open(output_path, BUFFER_SIZE);
+        if (output_fd < 0) {
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+    } else if (checkpointing) {
+        char path[64], spool_path[80];
+        snprintf(path, sizeof(path), ".tcp_checkpoint_%d", server_port);
+        snprintf(spool_path, sizeof(spool_path), "%s.part", path);
+        int spool = open(spool_path, O_RDWR | O_CREAT, 0644);
+        struct stat info;
+        if (spool < 0 || fstat(spool, &info) < 0 || ftruncate(spool, BUFFER_SIZE) < 0) {
+            perror("open(2)");
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+        received_data = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, spool, 0);
+        close(spool);
+        if (received_data == MAP_FAILED) {
+            perror("mmap(2)");
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+        if (tcp_checkpoint_open(&checkpoint, path, info.st_size == BUFFER_SIZE) < 0) {
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        received_data = (char *)placement_alloc(&placement, BUFFER_SIZE);
+        if (received_data == NULL) {
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    //accept a connection for every stream of the sender
+    int sender_socks[MAX_STREAMS];
+    if (accept_streams(sock, sender_socks, streams, timestamps) < 0) {
         close(sock);
         exit(EXIT_FAILURE);
     }
-    fprintf(stdout, "Connection accepted from %s:%d\n", inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
 
-    char received_data[BUFFER_SIZE];
     FileStats *fileStats = NULL;
     int fileStatsCount = 0;
     double total_time_taken = 0;
     double total_bandwidth = 0;
 
-    while(1){
-        
-        clock_t start, end;
-        int total_bytes_received = 0;
-
-        //start the timer
-        start = clock();
-        do{
-            // Receive the file
-            int bytes_received = recv(sender_sock, received_data, BUFFER_SIZE, 0);
-            if (bytes_received < 0){
-                perror("recv(2)");
-                close(sender_sock);
-                close(sock);
-                free(fileStats);
-                exit(EXIT_FAILURE);
-            }else if (bytes_received == 0){
-                fprintf(stdout, "Connection closed by sender.\n");
-                close(sender_sock);
-                close(sock);
-                break;
-            }
-            total_bytes_received += bytes_received;
+    StreamArgs stream_args[MAX_STREAMS];
+    pthread_t threads[MAX_STREAMS];
+    Writer writers[MAX_STREAMS];
+    int cpus[MAX_STREAMS];
+    memset(stream_args, 0, sizeof(stream_args));
+    Latency_Samples kernel_to_app = {0};
+    size_t total_bytes_transferred = 0;
 
-            // Check if received_data contains the end-of-file marker
-            if (total_bytes_received == BUFFER_SIZE){
-                // Stop the clock
-                end = clock();
+    // The interval reports sample the streams' counters while they receive.
+    Reporter reporter;
+    StreamReport stream_report = {.streams = stream_args, .count = streams};
+    for (int i = 0; i < streams; i++)
+        stream_args[i].sock = sender_socks[i];
+    if (interval_ms > 0 && report_start(&reporter, interval_ms, REPORT_PACKETS | REPORT_LOST, sample_streams, &stream_report) < 0) {
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
 
-                //measure the time in milliseconds taken to receive the file
-                double time_taken = ((double)(end - start)) / (CLOCKS_PER_SEC / 1000);
-                total_time_taken += time_taken;
+    // The rings are allocated once and serve every file received.
+    for (int i = 0; i < streams && output_fd >= 0; i++) {
+        if (writer_init(&writers[i], ring_blocks, &placement) < 0)
+            exit(EXIT_FAILURE);
+    }
 
-                //calculate the bandwidth in MB/s
-                double bandwidth = (BUFFER_SIZE / (time_taken / 1000)) / (1024 * 1024);
-                total_bandwidth += bandwidth;
+    while(1){
 
-                fileStatsCount++;
-                fileStats = realloc(fileStats, fileStatsCount * sizeof(FileStats));
-                if (fileStats == NULL) {
-                    perror("realloc(3)");
-                    close(sender_sock);
-                    close(sock);
-                    free(fileStats);
+        for (int i = 0; i < streams; i++) {
+            stream_args[i].sock = sender_socks[i];
+            stream_args[i].received_data = received_data;
+            stream_args[i].timestamps = timestamps;
+            stream_args[i].checkpoint = checkpointing ? &checkpoint : NULL;
+            stream_args[i].writer = NULL;
+            stream_args[i].cpu = cpus[i] = placement_cpu(first_cpu, i);
+            if (output_fd >= 0) {
+                if (writer_start(&writers[i], output_fd, writer_flags) < 0)
                     exit(EXIT_FAILURE);
-                }
-                //store the file statistics
-                fileStats[fileStatsCount - 1].time_taken = time_taken;
-                fileStats[fileStatsCount - 1].bandwidth = bandwidth;
+                stream_args[i].writer = &writers[i];
+            }
+            if (pthread_create(&threads[i], NULL, receive_stream, &stream_args[i]) != 0) {
+                perror("pthread_create(3)");
+                exit(EXIT_FAILURE);
+            }
+        }
 
-                // Send acknowledgment back to the sender
-                send(sender_sock, "ACK", 3, 0);
+        int done = 0, failed = 0;
+        for (int i = 0; i < streams; i++) {
+            pthread_join(threads[i], NULL);
+            if (stream_args[i].status == 0)
+                done = 1;
+            else if (stream_args[i].status < 0)
+                failed = 1;
+        }
+        for (int i = 0; i < streams && output_fd >= 0; i++) {
+            if (writer_stop(&writers[i]) < 0) {
+                perror("pwritev(2)");
+                failed = 1;
+            }
+        }
 
-                break; 
+        if (failed && checkpointing) {
+            // Record what arrived since the streams' last saves, and wait for the sender to come back and continue.
+            for (int i = 0; i < streams; i++)
+                tcp_checkpoint_add(&checkpoint, stream_args[i].offset, stream_args[i].offset + stream_args[i].progress);
+            fprintf(stdout, "Transfer interrupted, waiting for the sender to continue...\n");
+            for (int i = 0; i < streams; i++)
+                close(sender_socks[i]);
+            if (accept_streams(sock, sender_socks, streams, timestamps) < 0) {
+                close(sock);
+                exit(EXIT_FAILURE);
             }
+            continue;
+        }
 
-        } while (1);
+        if (failed) {
+            for (int i = 0; i < streams; i++)
+                close(sender_socks[i]);
+            close(sock);
+            placement_free(&placement, received_data, BUFFER_SIZE);
+            free(fileStats);
+            exit(EXIT_FAILURE);
+        }
 
-        if(strcmp(received_data, "exit") == 0){
+        if (done) {
             fprintf(stdout, "Sender sent exit message.\n");
-            close(sender_sock);
+            for (int i = 0; i < streams; i++)
+                close(sender_socks[i]);
             close(sock);
             break;
         }
 
-        fprintf(stdout, "File received. Bytes received: %d\n", total_bytes_received);
-        
+        // The file took from the first stripe header to the last stripe byte.
+        size_t total_bytes_received = 0;
+        uint64_t digest = 0;
+        double digest_time = 0, decompress_time = 0;
+        size_t wire_bytes = 0, resumed = 0;
+        struct timeval start = stream_args[0].start, end = stream_args[0].end;
+        for (int i = 0; i < streams; i++) {
+            total_bytes_received += stream_args[i].length;
+            resumed += stream_args[i].resumed;
+            digest_time += stream_args[i].digest_ms;
+            wire_bytes += stream_args[i].wire_bytes;
+            decompress_time += stream_args[i].decompress_ms;
+            if (timercmp(&stream_args[i].start, &start, <))
+                start = stream_args[i].start;
+            if (timercmp(&stream_args[i].end, &end, >))
+                end = stream_args[i].end;
+        }
+
+        // The file digest merges the stripe digests in file order, whichever connection carried them.
+        for (size_t next = 0; next < total_bytes_received;) {
+            int i = 0;
+            while (i < streams && stream_args[i].offset != next)
+                i++;
+            if (i == streams) {
+                fprintf(stderr, "The stripes do not cover the file.\n");
+                break;
+            }
+            digest = crc64_combine(digest, stream_args[i].digest, stream_args[i].length);
+            next += stream_args[i].length;
+        }
+
+        //measure the time in milliseconds taken to receive the file
+        double time_taken = tcp_elapsed_ms(&start, &end);
+        total_time_taken += time_taken;
+
+        // The file is complete, the next transfer starts from an empty checkpoint.
+        if (checkpointing)
+            tcp_checkpoint_clear(&checkpoint);
+
+        //calculate the bandwidth in MB/s, over the bytes that crossed the network in this run
+        double bandwidth = time_taken > 0 ? ((total_bytes_received - resumed) / (time_taken / 1000)) / (1024 * 1024) : 0;
+        total_bandwidth += bandwidth;
+        total_bytes_transferred += total_bytes_received - resumed;
+
+        fileStatsCount++;
+        fileStats = realloc(fileStats, fileStatsCount * sizeof(FileStats));
+        if (fileStats == NULL) {
+            perror("realloc(3)");
+            for (int i = 0; i < streams; i++)
+                close(sender_socks[i]);
+            close(sock);
+            if (!checkpointing)
+                placement_free(&placement, received_data, BUFFER_SIZE);
+            exit(EXIT_FAILURE);
+        }
+        //store the file statistics
+        fileStats[fileStatsCount - 1].time_taken = time_taken;
+        fileStats[fileStatsCount - 1].bandwidth = bandwidth;
+        fileStats[fileStatsCount - 1].digest_time = digest_time;
+        fileStats[fileStatsCount - 1].wire_bandwidth = time_taken > 0 ? (wire_bytes / (time_taken / 1000)) / (1024 * 1024) : 0;
+        fileStats[fileStatsCount - 1].decompress_time = decompress_time;
+
+        fprintf(stdout, "File received. Bytes received: %zu\n", total_bytes_received);
+        fprintf(stdout, "CRC-64: %016" PRIx64 "\n", digest);
+        if (resumed > 0)
+            fprintf(stdout, "Continued from checkpoint: %zu bytes were already received, %zu bytes transferred\n",
+                    resumed, total_bytes_received - resumed);
+        if (streams > 1) {
+            for (int i = 0; i < streams; i++) {
+                double stream_time = tcp_elapsed_ms(&stream_args[i].start, &stream_args[i].end);
+                fprintf(stdout, "  Stream %d: %zu bytes, Time = %.2f ms, Speed = %.2f MB/s\n", i + 1, stream_args[i].length,
+                        stream_time, stream_time > 0 ? (stream_args[i].length / (stream_time / 1000)) / (1024 * 1024) : 0);
+            }
+        }
+        if (timestamps) {
+            // TCP carries no sender timestamp, so only the user-space side of the latency is measured here
+            latency_reset(&kernel_to_app);
+            for (int i = 0; i < streams; i++)
+                latency_merge(&kernel_to_app, &stream_args[i].kernel_to_app);
+            latency_print(stdout, "Kernel-to-app latency", &kernel_to_app);
+        }
+        if (output_fd >= 0) {
+            const Writer *stream_writers[MAX_STREAMS];
+            for (int i = 0; i < streams; i++)
+                stream_writers[i] = &writers[i];
+            fprintf(stdout, "Written to %s\n", output_path);
+            writer_print_stats(stdout, stream_writers, streams);
+        }
+
         fprintf(stdout, "Waiting for Sender response...\n");
     }
-    
+
+    if (interval_ms > 0)
+        report_stop(&reporter);
+
     // Print the file statistics
+    double total_wire_bandwidth = 0;
     fprintf(stdout, "-----------------------\n");
     fprintf(stdout, "File Statistics:\n");
     for (size_t i = 0; i < fileStatsCount; i++)
     {
         double bandwidth = fileStats[i].bandwidth;
         double time = fileStats[i].time_taken;
-        fprintf(stdout, "Run %zu: Time = %.2f ms, Speed = %.2f MB/s\n", i + 1, time, bandwidth);
+        fprintf(stdout, "Run %zu: Time = %.2f ms, Speed = %.2f MB/s (wire %.2f MB/s), Hashing = %.2f ms, Decompression = %.2f ms\n",
+                i + 1, time, bandwidth, fileStats[i].wire_bandwidth, fileStats[i].digest_time, fileStats[i].decompress_time);
+        total_wire_bandwidth += fileStats[i].wire_bandwidth;
     }
 
-        // Print the average file statistics
-        fprintf(stdout, "Average time: %.2f ms\n", total_time_taken / fileStatsCount);
-        fprintf(stdout, "Average bandwidth: %.2f MB/s\n", total_bandwidth / fileStatsCount);
-        
-        fprintf(stdout, "-----------------------\n");
-        
+    // Print the average file statistics
+    fprintf(stdout, "Average time: %.2f ms\n", total_time_taken / fileStatsCount);
+    fprintf(stdout, "Average bandwidth: %.2f MB/s\n", total_bandwidth / fileStatsCount);
+    // The mean of the runs' rates weighs a short run like a long one, the aggregate is bytes over time.
+    fprintf(stdout, "Aggregate bandwidth: %.2f MB/s (%zu bytes in %.2f ms)\n", total_time_taken > 0 ?
+            (total_bytes_transferred / (total_time_taken / 1000)) / (1024 * 1024) : 0, total_bytes_transferred, total_time_taken);
+    fprintf(stdout, "Average wire bandwidth: %.2f MB/s\n", total_wire_bandwidth / fileStatsCount);
+    fprintf(stdout, "Streams: %d\n", streams);
+    placement_print(stdout, &placement, cpus, streams);
+
+    fprintf(stdout, "-----------------------\n");
 
-    
     fprintf(stdout, "Receiver end\n");
+    for (int i = 0; i < streams; i++)
+        latency_free(&stream_args[i].kernel_to_app);
+    latency_free(&kernel_to_app);
+    for (int i = 0; i < streams && output_fd >= 0; i++)
+        writer_free(&writers[i]);
+    if (output_fd >= 0)
+        close(output_fd);
+    if (checkpointing) {
+        tcp_checkpoint_close(&checkpoint);
+        munmap(received_data, BUFFER_SIZE);
+    } else {
+        placement_free(&placement, received_data, BUFFER_SIZE);
+    }
     free(fileStats);
     return 0;
-}
\ No newline at end of file
+}
@@ -3,46 +3,240 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
 
+#include "TCP_API.h"
+#include "crc64.h"
+#include "reader.h"
+#include "placement.h"
 
-#define BUFFER_SIZE 2 * 1024 * 1024
+#define FILE_NAME "data.txt"
+
+// Per-stream state handed to a sender thread.
+typedef struct {
+    int sock;          // Connected socket of this stream.
+    int index;         // Stream number, 0 based.
+    Reader reader;     // Reads the stripe from the file while it is sent.
+    size_t offset;     // Stripe offset inside the file.
+    size_t length;     // Stripe length.
+    uint64_t digest;          // CRC-64 of the stripe, computed while sending it.
+    uint64_t receiver_digest; // CRC-64 of the stripe as the receiver got it.
+    double digest_ms;         // Time spent hashing.
+    int compress;             // Send the stripe as compressed frames.
+    size_t wire_bytes;        // Bytes of the stripe that went on the wire.
+    double compress_ms;       // Time spent compressing.
+    uint64_t file_id;         // File to continue from the receiver's checkpoint, 0 to send the whole stripe.
+    size_t skipped;           // Leading stripe bytes the receiver already had.
+    int cpu;                  // CPU the sending thread is pinned to, -1 if not pinned.
+    int status;        // 0 on success, -1 on error.
+} StreamArgs;
+
+// Sends one stripe of the file and waits for the receiver's acknowledgment.
+void *send_stream(void *arg) {
+    StreamArgs *stream = (StreamArgs *)arg;
+    stream->status = -1;
+    placement_pin(stream->cpu);
+
+    char *frame = NULL;
+    if (stream->compress) {
+        frame = (char *)malloc(CHUNK_FRAME_SIZE);
+        if (frame == NULL) {
+            perror("malloc(3)");
+            return NULL;
+        }
+    }
+
+    uint32_t flags = (stream->compress ? STREAM_COMPRESSED : 0) | (stream->file_id != 0 ? STREAM_CONTINUE : 0);
+    if (tcp_send_stream_header(stream->sock, stream->offset, stream->length, flags) < 0) {
+        perror("send(2)");
+        free(frame);
+        return NULL;
+    }
+
+    // Ask the receiver how much of the stripe it kept from an interrupted transfer.
+    stream->skipped = 0;
+    if (stream->file_id != 0) {
+        if (tcp_send_continue_request(stream->sock, stream->file_id, &stream->skipped) < 0 || stream->skipped > stream->length) {
+            perror("recv(2)");
+            free(frame);
+            return NULL;
+        }
+    }
+
+    // Send the stripe block by block as the reader thread brings it in from the disk.
+    // Hash every piece right after handing it to the kernel, while it is still on the wire.
+    // The bytes the receiver already has are hashed without being sent.
+    stream->digest = 0;
+    stream->digest_ms = 0;
+    stream->wire_bytes = 0;
+    stream->compress_ms = 0;
+    size_t position = 0;
+    const char *block;
+    size_t block_size;
+    while ((block = reader_next(&stream->reader, &block_size)) != NULL) {
+        size_t used = 0;
+        if (position < stream->skipped) {
+            used = stream->skipped - position < block_size ? stream->skipped - position : block_size;
+            stream->digest = crc64_update(stream->digest, block, used);
+        }
+
+        while (used < block_size) {
+            size_t piece = block_size - used < DIGEST_CHUNK ? block_size - used : DIGEST_CHUNK;
+            const char *wire = block + used;
+            size_t wire_size = piece;
+
+            if (stream->compress) {
+                struct timeval pack_start, pack_end;
+                gettimeofday(&pack_start, NULL);
+                wire_size = tcp_pack_chunk(block + used, piece, frame);
+                gettimeofday(&pack_end, NULL);
+                stream->compress_ms += tcp_elapsed_ms(&pack_start, &pack_end);
+                wire = frame;
+            }
+
+            if (tcp_send_all(stream->sock, wire, wire_size) < 0) {
+                perror("send(2)");
+                free(frame);
+                return NULL;
+            }
+            stream->wire_bytes += wire_size;
+
+            struct timeval hash_start, hash_end;
+            gettimeofday(&hash_start, NULL);
+            stream->digest = crc64_update(stream->digest, block + used, piece);
+            gettimeofday(&hash_end, NULL);
+            stream->digest_ms += tcp_elapsed_ms(&hash_start, &hash_end);
+
+            used += piece;
+        }
+
+        reader_release(&stream->reader);
+        position += block_size;
+    }
+
+    free(frame);
+    if (position < stream->length) {
+        errno = stream->reader.error;
+        perror("read(2)");
+        return NULL;
+    }
+
+    //Receive response from the receiver, it carries the receiver's digest of the stripe
+    if (tcp_recv_stream_ack(stream->sock, &stream->receiver_digest) < 0) {
+        perror("recv(2)");
+        return NULL;
+    }
+
+    stream->status = 0;
+    return NULL;
+}
+
+// Returns the value of the flag at argv[*i] and steps over it. Exits if the command line ends with the flag.
+static char *option_value(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "Missing value for %s\n", argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    return argv[++*i];
+}
 
 int main(int argc, char *argv[]) {
 
     char *server_ip;
     char *algorithm;
     int server_port;
+    int streams = 1;
+    int compress = 0;
+    int continuing = 0;
+    int ring = READER_BLOCKS;
+    int read_flags = 0;
+    int hugepages = 0;
+    int first_cpu = -1;
+    char *numa = NULL;
 
 
-    if(argc != 7){
-        fprintf(stderr, "Usage: %s -ip <server_ip> -p <server_port> -algo <algorithm>\n", argv[0]);
+    if(argc < 7){
+        fprintf(stderr, "Usage: %s -ip <server_ip> -p <server_port> -algo <algorithm> [-streams <count>] [-compress] [-continue] [-ring <blocks>] [-direct] [-hugepages] [-cpu <first cpu>] [-numa <node|interface>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    for (size_t i = 0; i < argc; i++)
+    for (int i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "-ip") == 0)
         {
-            server_ip = argv[i+1];
+            server_ip = option_value(argc, argv, &i);
         }
         else if (strcmp(argv[i], "-p") == 0)
         {
-            server_port = atoi(argv[i+1]);
+            server_port = atoi(option_value(argc, argv, &i));
         }else if (strcmp(argv[i], "-algo") == 0)
         {
-            algorithm = argv[i+1];
+            algorithm = option_value(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "-streams") == 0)
+        {
+            streams = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-compress") == 0)
+        {
+            compress = 1;
+        }
+        else if (strcmp(argv[i], "-continue") == 0)
+        {
+            continuing = 1;
+        }
+        else if (strcmp(argv[i], "-ring") == 0)
+        {
+            ring = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-direct") == 0)
+        {
+            read_flags |= READER_DIRECT;
+        }
+        else if (strcmp(argv[i], "-hugepages") == 0)
+        {
+            hugepages = 1;
+        }
+        else if (strcmp(argv[i], "-cpu") == 0)
+        {
+            first_cpu = atoi(option_value(argc, argv, &i));
+        }
+        else if (strcmp(argv[i], "-numa") == 0)
+        {
+            numa = option_value(argc, argv, &i);
         }
     }
-    
+
+    if (streams < 1 || streams > MAX_STREAMS) {
+        fprintf(stderr, "The number of streams must be between 1 and %d\n", MAX_STREAMS);
+        exit(EXIT_FAILURE);
+    }
+    if (ring < 1 || ring > READER_MAX_BLOCKS) {
+        fprintf(stderr, "The ring must have between 1 and %d blocks\n", READER_MAX_BLOCKS);
+        exit(EXIT_FAILURE);
+    }
+
+    // The reader rings are the transfer buffers: huge pages and the NUMA node apply to them.
+    Placement placement;
+    int node = -1;
+    if (numa != NULL && placement_node(numa, &node) < 0)
+        exit(EXIT_FAILURE);
+    if (numa != NULL && node < 0)
+        fprintf(stdout, "%s has no NUMA node, the buffers are not bound.\n", numa);
+    placement_init(&placement, hugepages, node);
+
 
     fprintf(stdout, "Starting Sender...\n");
 
-    
-    // The variable to store the socket file descriptor.
-    int sock = -1;
+
+    // The socket file descriptors, one per stream.
+    int socks[MAX_STREAMS];
 
     // The variable to store the server's address.
     struct sockaddr_in receiver_addr;
@@ -50,114 +244,157 @@ int main(int argc, char *argv[]) {
     // Reset the receiver_addr to zero
     memset(&receiver_addr, 0, sizeof(receiver_addr));
 
-    // buffer to store the file
-    char *file_data = (char *)calloc(BUFFER_SIZE, sizeof(char));
-
-    // Open the file 
-    FILE *file = fopen("data.txt", "r");
-    if (file == NULL) {
-        perror("fopen(3)");
-        free(file_data);
+    // The file is not read up front: every stream reads its stripe while sending it, see send_stream().
+    struct stat file_info;
+    if (stat(FILE_NAME, &file_info) < 0) {
+        perror("stat(2)");
         exit(EXIT_FAILURE);
     }
-
-    // read the file into a buffer
-    int bytes_read;
-    if ((bytes_read = fread(file_data, sizeof(char), BUFFER_SIZE, file)) != BUFFER_SIZE) {
-        perror("fread(3)");
-        fclose(file);
-        free(file_data);
-        exit(EXIT_FAILURE);
-    }
-    fprintf(stdout, "bytes read: %d.\n", bytes_read);
-
-    // Close the file
-    fclose(file);
-
-
-    // Create socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock <= 0) {
-        perror("socket(2)");
+    if (file_info.st_size < BUFFER_SIZE) {
+        fprintf(stderr, "%s holds %lld bytes, the receiver expects %d\n", FILE_NAME, (long long)file_info.st_size, BUFFER_SIZE);
         exit(EXIT_FAILURE);
     }
+    int bytes_read = BUFFER_SIZE;
+    fprintf(stdout, "Sending %d bytes of %s, read through a ring of %d x %d KB blocks per stream%s.\n",
+            bytes_read, FILE_NAME, ring, READER_BLOCK_SIZE / 1024, read_flags & READER_DIRECT ? " with O_DIRECT" : "");
 
     // Conver the IP address from text to binary form
     if (inet_pton(AF_INET, server_ip, &receiver_addr.sin_addr) <= 0) {
         perror("inet_pton(3)");
-        close(sock);
         exit(EXIT_FAILURE);
     }
 
-    // Set the congestion control algorithm.
-    if(setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, algorithm, strlen(algorithm)) < 0){
-        perror("setsockopt(2)");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
-    
     // Set the server's address family to AF_INET (IPv4).
     receiver_addr.sin_family = AF_INET;
     // Set the server's port number.
     receiver_addr.sin_port = htons(server_port);
 
     fprintf(stdout, "Waiting for TCP connection...\n");
-    // Connect to receiver
-    if (connect(sock, (struct sockaddr *)&receiver_addr, sizeof(receiver_addr)) < 0) {
-        perror("Connect(2)");
-        close(sock);
-        exit(EXIT_FAILURE);
+
+    for (int i = 0; i < streams; i++) {
+        // Create socket
+        socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (socks[i] <= 0) {
+            perror("socket(2)");
+            exit(EXIT_FAILURE);
+        }
+
+        // Set the congestion control algorithm.
+        if(setsockopt(socks[i], IPPROTO_TCP, TCP_CONGESTION, algorithm, strlen(algorithm)) < 0){
+            perror("setsockopt(2)");
+            close(socks[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Connect to receiver
+        if (connect(socks[i], (struct sockaddr *)&receiver_addr, sizeof(receiver_addr)) < 0) {
+            perror("Connect(2)");
+            close(socks[i]);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    fprintf(stdout, "Receiver connected, beginning to receive file...\n");
+    fprintf(stdout, "Receiver connected over %d stream(s), beginning to send file...\n", streams);
+
+    StreamArgs stream_args[MAX_STREAMS];
+    const Reader *readers[MAX_STREAMS];
+    pthread_t threads[MAX_STREAMS];
+    int cpus[MAX_STREAMS];
+
+    // With -continue every stripe header names the file, and the receiver skips what its checkpoint holds.
+    uint64_t file_id = continuing ? tcp_file_id(FILE_NAME) : 0;
+
+    // The rings are allocated once and serve every time the file is sent.
+    for (int i = 0; i < streams; i++) {
+        if (reader_init(&stream_args[i].reader, ring, &placement) < 0)
+            exit(EXIT_FAILURE);
+    }
 
     char decision;
     do {
-        
-        // Send the file
-        int bytes_sent = send(sock, file_data, BUFFER_SIZE, 0);
-        if (bytes_sent <= 0) {
-            perror("send(2)");
-            close(sock);
-            free(file_data);
-            exit(EXIT_FAILURE);
+
+        // Send the file, every stream sends its own stripe in parallel, each from its own reader.
+        for (int i = 0; i < streams; i++) {
+            stream_args[i].sock = socks[i];
+            stream_args[i].index = i;
+            stream_args[i].compress = compress;
+            stream_args[i].file_id = file_id;
+            stream_args[i].cpu = cpus[i] = placement_cpu(first_cpu, i);
+            tcp_stripe(bytes_read, streams, i, &stream_args[i].offset, &stream_args[i].length);
+            if (reader_start(&stream_args[i].reader, FILE_NAME, (off_t)stream_args[i].offset, stream_args[i].length, read_flags) < 0)
+                exit(EXIT_FAILURE);
+            readers[i] = &stream_args[i].reader;
+            if (pthread_create(&threads[i], NULL, send_stream, &stream_args[i]) != 0) {
+                perror("pthread_create(3)");
+                exit(EXIT_FAILURE);
+            }
         }
-    
-        fprintf(stdout, "File sent.\n");
-        fprintf(stdout, "Bytes sent: %d\n", bytes_sent);
-        fprintf(stdout, "Waiting for Receiver response...\n");
 
-        //Receive response from the receiver
-        char rec_buffer[1024];
-        int bytes_received = recv(sock, rec_buffer, 1024, 0);
-        if (bytes_received <= 0) {
-            perror("recv(2)");
-            close(sock);
-            free(file_data);
+        int failed = 0;
+        for (int i = 0; i < streams; i++) {
+            pthread_join(threads[i], NULL);
+            reader_stop(&stream_args[i].reader);
+            if (stream_args[i].status != 0)
+                failed = 1;
+        }
+        if (failed) {
+            fprintf(stderr, "Failed to send the file.\n");
+            for (int i = 0; i < streams; i++)
+                close(socks[i]);
             exit(EXIT_FAILURE);
         }
 
+        // Merge the stripe digests in file order.
+        uint64_t digest = 0, receiver_digest = 0;
+        double digest_ms = 0, compress_ms = 0;
+        size_t wire_bytes = 0, skipped = 0;
+        for (int i = 0; i < streams; i++) {
+            wire_bytes += stream_args[i].wire_bytes;
+            skipped += stream_args[i].skipped;
+            compress_ms += stream_args[i].compress_ms;
+            digest = crc64_combine(digest, stream_args[i].digest, stream_args[i].length);
+            receiver_digest = crc64_combine(receiver_digest, stream_args[i].receiver_digest, stream_args[i].length);
+            digest_ms += stream_args[i].digest_ms;
+        }
+
+        fprintf(stdout, "File sent.\n");
+        fprintf(stdout, "Bytes sent: %zu\n", bytes_read - skipped);
+        if (skipped > 0)
+            fprintf(stdout, "Continued a transfer: skipped %zu bytes the receiver already had\n", skipped);
+        if (compress) {
+            fprintf(stdout, "Bytes on the wire: %zu (%.1f%% of the file, compression took %.2f ms)\n",
+                    wire_bytes, 100.0 * wire_bytes / bytes_read, compress_ms);
+        }
+        fprintf(stdout, "CRC-64: %016" PRIx64 " (%s, hashing took %.2f ms)\n", digest, crc64_kernel(), digest_ms);
+        reader_print_stats(stdout, readers, streams);
+        placement_print(stdout, &placement, cpus, streams);
+        if (receiver_digest != digest) {
+            fprintf(stderr, "Integrity check failed: the receiver got CRC-64 %016" PRIx64 "\n", receiver_digest);
+        } else {
+            fprintf(stdout, "Integrity check passed.\n");
+        }
+
         //User decision: Send the file again or close the connection
         fprintf(stdout, "Do you want to send the file again? (y/n): ");
         scanf(" %c", &decision);
 
         } while (decision == 'Y' || decision == 'y');
-        
-    free(file_data);
 
-    //Send an exit message to the receiver
-    const char *exit_message = "exit";
-    if (send(sock, exit_message, strlen(exit_message) + 1, 0) < 0) {
-        perror("send(2)");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
+    //Send an exit message (an empty stripe) to the receiver on every stream
+    for (int i = 0; i < streams; i++) {
+        if (tcp_send_stream_header(socks[i], 0, 0, 0) < 0) {
+            perror("send(2)");
+            close(socks[i]);
+            exit(EXIT_FAILURE);
+        }
 
-    //Close the TCP connection
-    close(sock);
+        //Close the TCP connection
+        close(socks[i]);
+        reader_free(&stream_args[i].reader);
+    }
     fprintf(stdout, "Connection closed\n");
     fprintf(stdout, "Sender end\n");
-    
+
     return 0;
 }
 
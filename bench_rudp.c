@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "rudp.h"
+
+/*
+* Microbenchmarks of librudp. Every benchmark runs a fixed number of iterations after a warmup, so runs are
+* comparable between builds, and prints one CSV row:
+*   benchmark,size,iterations,ns_per_op,mb_per_s,ops_per_s
+* size is the bytes handled by one operation.
+*/
+
+#define WARMUP 3
+#define BUFFER_SIZE (2 * 1024 * 1024)      // Bytes of the data the benchmarks draw from, one whole transfer.
+#define CHECKSUM_BYTES (256 * 1024 * 1024) // Bytes checksummed per size.
+#define SEND_ITERATIONS 64                 // Ranges packetized into a sink socket.
+#define LOOPBACK_SIZE (1024 * 1024)        // One range across loopback, small enough for the receive buffer.
+#define LOOPBACK_ITERATIONS 32
+#define HEADER_ITERATIONS (64 * 1024 * 1024)
+
+// Returns the CLOCK_MONOTONIC time in nanoseconds.
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void print_row(const char *benchmark, size_t size, size_t iterations, int64_t elapsed_ns) {
+    double ns_per_op = (double)elapsed_ns / iterations;
+    double mb_per_s = size / ns_per_op * 1e9 / (1024 * 1024);
+    printf("%s,%zu,%zu,%.1f,%.2f,%.0f\n", benchmark, size, iterations, ns_per_op, mb_per_s, 1e9 / ns_per_op);
+}
+
+// Checksums size byte blocks, the per-chunk cost on both ends of a transfer.
+static void bench_checksum(char *data, size_t size) {
+    size_t iterations = CHECKSUM_BYTES / size;
+    volatile unsigned short int sink = 0;
+
+    for (size_t i = 0; i < WARMUP * 1024; i++)
+        sink ^= calculate_checksum(data, size);
+
+    int64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++)
+        sink ^= calculate_checksum(data + (i & 7), size);
+    print_row("checksum", size, iterations, now_ns() - start);
+}
+
+// The header as it went on the wire before the versioned format: the in-memory struct, padding and host byte
+// order included.
+typedef struct {
+    uint32_t checksum;
+    uint16_t length;
+    uint16_t sequence_number;
+    uint16_t acknowledgment_number;
+    uint16_t stream_id;
+    uint8_t flags;
+    int64_t send_time;
+} Legacy_Header;
+
+/*
+* @brief Header handling per packet: the legacy struct copied as is, then rudp_header_encode() and
+* rudp_header_decode() of the versioned format.
+*/
+static void bench_header(void) {
+    Legacy_Header legacy = {.flags = PUSH, .send_time = 1};
+    RUDP_Header header = {.flags = PUSH, .connection_id = 0x12345678, .send_time = 1};
+    uint8_t wire[sizeof(Legacy_Header) > RUDP_HEADER_SIZE ? sizeof(Legacy_Header) : RUDP_HEADER_SIZE];
+    volatile uint32_t sink = 0;
+
+    int64_t start = now_ns();
+    for (uint32_t i = 0; i < HEADER_ITERATIONS; i++) {
+        legacy.sequence_number = (uint16_t)i;
+        memcpy(wire, &legacy, sizeof(legacy));
+        __asm__ volatile("" : : "r"(wire) : "memory");
+        sink ^= wire[i & 7];
+    }
+    print_row("header_cast", sizeof(Legacy_Header), HEADER_ITERATIONS, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < HEADER_ITERATIONS; i++) {
+        header.sequence_number = i;
+        rudp_header_encode(&header, wire);
+        __asm__ volatile("" : : "r"(wire) : "memory");
+        sink ^= wire[i & 7];
+    }
+    print_row("header_encode", RUDP_HEADER_SIZE, HEADER_ITERATIONS, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < HEADER_ITERATIONS; i++) {
+        wire[9] = (uint8_t)i;
+        __asm__ volatile("" : : "r"(wire) : "memory");
+        sink ^= (uint32_t)rudp_header_decode(wire, RUDP_HEADER_SIZE + i % 64, &header) ^ header.sequence_number;
+    }
+    print_row("header_decode", RUDP_HEADER_SIZE, HEADER_ITERATIONS, now_ns() - start);
+}
+
+// Binds a receiving socket to an ephemeral loopback port and points sender and receiver at each other, without a
+// handshake. The receiver only takes datagrams from its peer, so the sender is bound to a known port as well.
+static RUDP_Socket *bench_pair(RUDP_Socket *sender) {
+    RUDP_Socket *receiver = rudp_socket(true, 0);
+    struct sockaddr_in loopback = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(sender->dest_addr);
+    if (bind(sender->socket_fd, (struct sockaddr *)&loopback, sizeof(loopback)) < 0) {
+        perror("bind(2)");
+        exit(EXIT_FAILURE);
+    }
+    if (getsockname(receiver->socket_fd, (struct sockaddr *)&sender->dest_addr, &length) < 0 ||
+        getsockname(sender->socket_fd, (struct sockaddr *)&receiver->dest_addr, &length) < 0) {
+        perror("getsockname(2)");
+        exit(EXIT_FAILURE);
+    }
+    receiver->connection_id = sender->connection_id;
+    sender->isConnected = true;
+    receiver->isConnected = true;
+    return receiver;
+}
+
+// Packetizes a whole buffer into a socket nobody reads: checksums, headers and sendto() without a receiver.
+static void bench_send(char *data, size_t size) {
+    RUDP_Socket *sender = rudp_socket(false, 0);
+    RUDP_Socket *sink = bench_pair(sender);
+
+    for (int i = 0; i < WARMUP; i++)
+        rudp_send(sender, PUSH, data, size);
+
+    int64_t start = now_ns();
+    for (int i = 0; i < SEND_ITERATIONS; i++) {
+        if (rudp_send(sender, PUSH, data, size) < 0) {
+            perror("sendto(2)");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int64_t elapsed = now_ns() - start;
+    print_row("send", size, SEND_ITERATIONS, elapsed);
+
+    size_t packets = (size + CHUNK_SIZE - 1) / CHUNK_SIZE * SEND_ITERATIONS;
+    print_row("send_packet", CHUNK_SIZE, packets, elapsed);
+
+    rudp_close(sink);
+    rudp_close(sender);
+}
+
+typedef struct {
+    RUDP_Socket *sock;
+    RUDP_Range range;
+    int status;
+} ReceiverArgs;
+
+static void *receive_loop(void *arg) {
+    ReceiverArgs *args = (ReceiverArgs *)arg;
+    args->status = rudp_receive_range(args->sock, &args->range);
+    return NULL;
+}
+
+/*
+* @brief Moves one range from a sender to a receiver thread over loopback, the end-to-end path of a flow.
+* Nothing retransmits, so a run that loses datagrams stops at the receive timeout and is reported as lost.
+*/
+static void bench_loopback(char *data, size_t size) {
+    RUDP_Socket *sender = rudp_socket(false, 0);
+    RUDP_Socket *receiver = bench_pair(sender);
+    char *buffer = malloc(size);
+    struct timeval timeout = {1, 0};
+    size_t lost = 0;
+    int64_t elapsed = 0;
+
+    if (buffer == NULL) {
+        perror("malloc(3)");
+        exit(EXIT_FAILURE);
+    }
+    if (setsockopt(receiver->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        perror("setsockopt(2)");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < WARMUP + LOOPBACK_ITERATIONS; i++) {
+        ReceiverArgs args = {.sock = receiver};
+        RUDP_Range range = {.buffer = data, .size = size};
+        pthread_t thread;
+
+        if (rudp_range_init(&args.range, buffer, size, 0) < 0)
+            exit(EXIT_FAILURE);
+        if (pthread_create(&thread, NULL, receive_loop, &args) != 0) {
+            perror("pthread_create(3)");
+            exit(EXIT_FAILURE);
+        }
+
+        int64_t start = now_ns();
+        if (rudp_send_range(sender, &range) < 0) {
+            perror("sendto(2)");
+            exit(EXIT_FAILURE);
+        }
+        pthread_join(thread, NULL);
+        if (i >= WARMUP) {
+            elapsed += now_ns() - start;
+            if (args.status != (int)size)
+                lost++;
+        }
+        rudp_range_free(&args.range);
+    }
+
+    print_row("loopback", size, LOOPBACK_ITERATIONS, elapsed);
+    if (lost > 0)
+        fprintf(stderr, "loopback: %zu of %d runs lost datagrams, their time includes the receive timeout\n", lost, LOOPBACK_ITERATIONS);
+
+    free(buffer);
+    rudp_close(receiver);
+    rudp_close(sender);
+}
+
+int main(void) {
+    static const size_t checksum_sizes[] = {64, 256, 1024, 1472};
+    char *data = malloc(BUFFER_SIZE + 8);
+
+    if (data == NULL) {
+        perror("malloc(3)");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < BUFFER_SIZE + 8; i++)
+        data[i] = (char)(i * 2654435761U >> 24);
+
+    printf("benchmark,size,iterations,ns_per_op,mb_per_s,ops_per_s\n");
+    for (size_t i = 0; i < sizeof(checksum_sizes) / sizeof(checksum_sizes[0]); i++)
+        bench_checksum(data, checksum_sizes[i]);
+    bench_header();
+    bench_send(data, BUFFER_SIZE);
+    bench_loopback(data, LOOPBACK_SIZE);
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc64.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC64_HAVE_PCLMUL 1
+#endif
+
+// ECMA-182 polynomial, bit reversed.
+#define CRC64_POLY 0xC96C5795D7870F42ULL
+
+// In the reflected representation bit 63 is x^0, bit 62 is x^1, and so on.
+#define CRC64_X0 (1ULL << 63)
+
+static uint64_t crc64_table[8][256];
+static uint64_t x2n_table[64];
+static pthread_once_t crc64_once = PTHREAD_ONCE_INIT;
+
+#ifdef CRC64_HAVE_PCLMUL
+static int use_pclmul;
+// Folding constants, see crc64_fold_pclmul().
+static uint64_t fold_128[2], fold_256[2], fold_384[2], fold_512[2];
+#endif
+
+// Returns a * b mod p, both operands reflected.
+static uint64_t multmodp(uint64_t a, uint64_t b) {
+    uint64_t m = CRC64_X0, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC64_POLY : b >> 1;
+    }
+    return p;
+}
+
+// Returns x^(n * 2^k) mod p.
+static uint64_t x2nmodp(uint64_t n, unsigned k) {
+    uint64_t p = CRC64_X0;
+    while (n) {
+        if (n & 1)
+            p = multmodp(x2n_table[k & 63], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static void crc64_init(void) {
+    for (int n = 0; n < 256; n++) {
+        uint64_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC64_POLY : c >> 1;
+        crc64_table[0][n] = c;
+    }
+    for (int n = 0; n < 256; n++) {
+        uint64_t c = crc64_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            c = crc64_table[0][c & 0xff] ^ (c >> 8);
+            crc64_table[k][n] = c;
+        }
+    }
+
+    // x2n_table[k] = x^(2^k) mod p
+    uint64_t p = CRC64_X0 >> 1;
+    for (int k = 0; k < 64; k++) {
+        x2n_table[k] = p;
+        p = multmodp(p, p);
+    }
+
+#ifdef CRC64_HAVE_PCLMUL
+    use_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+
+    // Folding a 128 bit block forward by d bits multiplies its high-degree half by x^(d+64) and its
+    // low-degree half by x^d. A reflected carry-less multiply adds one more factor of x, hence the -1.
+    uint64_t *folds[] = {fold_128, fold_256, fold_384, fold_512};
+    for (int i = 0; i < 4; i++) {
+        uint64_t d = 128 * (i + 1);
+        folds[i][0] = x2nmodp(d + 64 - 1, 0);
+        folds[i][1] = x2nmodp(d - 1, 0);
+    }
+#endif
+}
+
+// Table driven CRC without the initial and final inversion, eight bytes per step.
+static uint64_t crc64_slice8(uint64_t c, const unsigned char *p, size_t size) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        c ^= word;
+        c = crc64_table[7][c & 0xff] ^ crc64_table[6][(c >> 8) & 0xff] ^
+            crc64_table[5][(c >> 16) & 0xff] ^ crc64_table[4][(c >> 24) & 0xff] ^
+            crc64_table[3][(c >> 32) & 0xff] ^ crc64_table[2][(c >> 40) & 0xff] ^
+            crc64_table[1][(c >> 48) & 0xff] ^ crc64_table[0][c >> 56];
+        p += 8;
+        size -= 8;
+    }
+#endif
+    while (size--)
+        c = crc64_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+#ifdef CRC64_HAVE_PCLMUL
+__attribute__((target("pclmul,sse2")))
+static inline __m128i fold(__m128i block, const uint64_t *k) {
+    __m128i constants = _mm_set_epi64x((long long)k[1], (long long)k[0]);
+    return _mm_xor_si128(_mm_clmulepi64_si128(block, constants, 0x00),
+                         _mm_clmulepi64_si128(block, constants, 0x11));
+}
+
+/*
+* Carry-less multiply folding over 64 byte strides with four independent accumulators.
+* Each accumulator is kept congruent (mod p) to the data it absorbed, so the CRC of the
+* final 16 byte accumulator equals the CRC of everything folded into it.
+* size must be a multiple of 64 and at least 64.
+*/
+__attribute__((target("pclmul,sse2")))
+static uint64_t crc64_fold_pclmul(uint64_t c, const unsigned char *p, size_t size) {
+    __m128i acc0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_cvtsi64_si128((long long)c));
+    __m128i acc1 = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i acc2 = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i acc3 = _mm_loadu_si128((const __m128i *)(p + 48));
+
+    for (p += 64, size -= 64; size >= 64; p += 64, size -= 64) {
+        acc0 = _mm_xor_si128(fold(acc0, fold_512), _mm_loadu_si128((const __m128i *)p));
+        acc1 = _mm_xor_si128(fold(acc1, fold_512), _mm_loadu_si128((const __m128i *)(p + 16)));
+        acc2 = _mm_xor_si128(fold(acc2, fold_512), _mm_loadu_si128((const __m128i *)(p + 32)));
+        acc3 = _mm_xor_si128(fold(acc3, fold_512), _mm_loadu_si128((const __m128i *)(p + 48)));
+    }
+
+    // Merge the accumulators into the last one.
+    __m128i acc = _mm_xor_si128(_mm_xor_si128(fold(acc0, fold_384), fold(acc1, fold_256)),
+                                _mm_xor_si128(fold(acc2, fold_128), acc3));
+
+    unsigned char tail[16];
+    _mm_storeu_si128((__m128i *)tail, acc);
+    return crc64_slice8(0, tail, sizeof(tail));
+}
+#endif
+
+uint64_t crc64_update(uint64_t crc, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t c = ~crc;
+
+    pthread_once(&crc64_once, crc64_init);
+
+#ifdef CRC64_HAVE_PCLMUL
+    if (use_pclmul && size >= 128) {
+        size_t folded = size & ~(size_t)63;
+        c = crc64_fold_pclmul(c, p, folded);
+        p += folded;
+        size -= folded;
+    }
+#endif
+
+    return ~crc64_slice8(c, p, size);
+}
+
+uint64_t crc64_combine(uint64_t crc_a, uint64_t crc_b, size_t size_b) {
+    pthread_once(&crc64_once, crc64_init);
+    return multmodp(x2nmodp(size_b, 3), crc_a) ^ crc_b;
+}
+
+const char *crc64_kernel(void) {
+    pthread_once(&crc64_once, crc64_init);
+#ifdef CRC64_HAVE_PCLMUL
+    if (use_pclmul)
+        return "pclmul";
+#endif
+    return "slice-by-8";
+}
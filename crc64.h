@@ -0,0 +1,24 @@
+#ifndef CRC64_H
+#define CRC64_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* CRC-64/XZ (ECMA-182 polynomial, reflected, initial value and final xor of all ones).
+* Used as the end-to-end digest of a transfer.
+* crc64_update() may be called on consecutive pieces of the data as they arrive:
+*   crc = 0; crc = crc64_update(crc, piece1, n1); crc = crc64_update(crc, piece2, n2); ...
+*/
+uint64_t crc64_update(uint64_t crc, const void *data, size_t size);
+
+/*
+* @brief Returns the CRC of A followed by B, given crc(A), crc(B) and the length of B.
+* Lets independent stripes be hashed in parallel and merged in file order.
+*/
+uint64_t crc64_combine(uint64_t crc_a, uint64_t crc_b, size_t size_b);
+
+// Returns the name of the kernel crc64_update() uses on this CPU.
+const char *crc64_kernel(void);
+
+#endif
@@ -1,51 +1,320 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
+#define FILE_SIZE 2 * 1024 * 1024
+// The file is generated in blocks, each seeded from (seed, block index), so the output does not depend on the thread count.
+#define BLOCK_SIZE (1024 * 1024)
+// Independent xoshiro256++ generators run side by side so the compiler can keep them in vector registers.
+#define LANES 4
+#define MAX_THREADS 256
+
+typedef enum {
+    MODE_RANDOM,
+    MODE_TEXT,
+    MODE_ENTROPY
+} Mode;
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+    "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+    "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+    "more", "when", "will", "would", "who", "so", "no", "packet", "sender", "receiver", "socket",
+    "buffer", "network", "transfer", "sequence", "checksum", "connection", "protocol", "timeout",
+    "bandwidth", "congestion", "window", "acknowledgment", "throughput", "latency", "datagram"};
+
+// State of LANES interleaved xoshiro256++ generators, s[i][lane].
+typedef struct {
+    uint64_t s[4][LANES];
+} Generator;
+
+// Work shared by the generator threads.
+typedef struct {
+    char *data;          // The mapped output file.
+    uint64_t size;       // Size of the file.
+    uint64_t seed;
+    Mode mode;
+    int bits;            // Entropy per byte in MODE_ENTROPY.
+    int threads;
+    int index;           // Thread number, the thread fills blocks index, index + threads, ...
+} GeneratorArgs;
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void generator_seed(Generator *generator, uint64_t seed, uint64_t block) {
+    uint64_t state = seed ^ (block * 0xD1B54A32D192ED03ULL);
+    for (int i = 0; i < 4; i++)
+        for (int lane = 0; lane < LANES; lane++)
+            generator->s[i][lane] = splitmix64(&state);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/*
+* @brief Fills out with count 64 bit words, LANES words per step.
+* count must be a multiple of LANES.
+*/
+static void generator_fill(Generator *generator, uint64_t *out, size_t count) {
+    uint64_t (*s)[LANES] = generator->s;
+    for (size_t i = 0; i < count; i += LANES) {
+        for (int lane = 0; lane < LANES; lane++) {
+            out[i + lane] = rotl(s[0][lane] + s[3][lane], 23) + s[0][lane];
+
+            uint64_t t = s[1][lane] << 17;
+            s[2][lane] ^= s[0][lane];
+            s[3][lane] ^= s[1][lane];
+            s[1][lane] ^= s[2][lane];
+            s[0][lane] ^= s[3][lane];
+            s[2][lane] ^= t;
+            s[3][lane] = rotl(s[3][lane], 45);
+        }
+    }
+}
+
+/*
+* @brief Fills a block with uniformly random bytes.
+*/
+static void util_generate_random_data(Generator *generator, char *block, size_t size) {
+    uint64_t words_buffer[LANES * 64];
+    for (size_t done = 0; done < size;) {
+        generator_fill(generator, words_buffer, LANES * 64);
+        size_t piece = size - done < sizeof(words_buffer) ? size - done : sizeof(words_buffer);
+        memcpy(block + done, words_buffer, piece);
+        done += piece;
+    }
+}
+
+/*
+* @brief Fills a block with bytes drawn uniformly from an alphabet of 2^bits symbols, i.e. bits of entropy per byte.
+* Alphabets of up to 64 symbols use printable characters starting at '!'.
+*/
+static void util_generate_entropy_data(Generator *generator, char *block, size_t size, int bits) {
+    uint64_t words_buffer[LANES * 64];
+    uint64_t symbols = 1ULL << bits;
+    // Masking and offsetting all eight bytes of a word at once, no byte can carry into the next.
+    uint64_t mask = 0x0101010101010101ULL * (symbols - 1);
+    uint64_t offset = symbols <= 64 ? 0x0101010101010101ULL * '!' : 0;
+
+    for (size_t done = 0; done < size;) {
+        generator_fill(generator, words_buffer, LANES * 64);
+        for (size_t i = 0; i < LANES * 64; i++)
+            words_buffer[i] = (words_buffer[i] & mask) + offset;
+        size_t piece = size - done < sizeof(words_buffer) ? size - done : sizeof(words_buffer);
+        memcpy(block + done, words_buffer, piece);
+        done += piece;
+    }
+}
 
 /*
-* @brief A random data generator function based on srand() and rand().
-* @param size The size of the data to generate (up to 2^32 bytes).
-* @return A pointer to the buffer.
+* @brief Fills a block with English-like text: sentences of words drawn with a skewed (roughly Zipf) frequency.
 */
-char *util_generate_random_data(unsigned int size) {
-    char *buffer = NULL;
-    // Argument check.
-    if (size == 0){
-        return NULL;
+static void util_generate_text_data(Generator *generator, char *block, size_t size) {
+    size_t word_count = sizeof(words) / sizeof(words[0]);
+    uint64_t random[LANES * 64];
+    size_t used = LANES * 64;
+    size_t i = 0;
+    int sentence_words = 0;
+
+    while (i < size) {
+        if (used == LANES * 64) {
+            generator_fill(generator, random, LANES * 64);
+            used = 0;
+        }
+        uint64_t r = random[used++];
+
+        // r % ((r >> 32) % n + 1) favors the first (most common) words.
+        const char *word = words[(r & 0xffffffff) % ((r >> 32) % word_count + 1)];
+        for (size_t j = 0; word[j] != '\0' && i < size; j++)
+            block[i++] = (sentence_words == 0 && j == 0) ? word[j] - 'a' + 'A' : word[j];
+        sentence_words++;
+
+        if (i < size && sentence_words > 4 && (r >> 61) == 0) {
+            block[i++] = '.';
+            sentence_words = 0;
+            if (i < size)
+                block[i++] = (r >> 58) % 5 == 0 ? '\n' : ' ';
+        } else if (i < size) {
+            block[i++] = ' ';
+        }
     }
+}
+
+// Generates every threads-th block of the file, starting at block index.
+void *generate_blocks(void *arg) {
+    GeneratorArgs *args = (GeneratorArgs *)arg;
+    Generator generator;
+    uint64_t blocks = (args->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-    buffer = (char *)calloc(size, sizeof(char));
+    for (uint64_t block = args->index; block < blocks; block += args->threads) {
+        uint64_t offset = block * BLOCK_SIZE;
+        size_t size = args->size - offset < BLOCK_SIZE ? args->size - offset : BLOCK_SIZE;
+        char *data = args->data + offset;
 
-    // Error checking.
-    if (buffer == NULL){
-        return NULL;
+        generator_seed(&generator, args->seed, block);
+        switch (args->mode) {
+        case MODE_RANDOM:
+            util_generate_random_data(&generator, data, size);
+            break;
+        case MODE_TEXT:
+            util_generate_text_data(&generator, data, size);
+            break;
+        case MODE_ENTROPY:
+            util_generate_entropy_data(&generator, data, size, args->bits);
+            break;
+        }
     }
-    
-    // Randomize the seed of the random number generator.
-    srand(time(NULL));
+    return NULL;
+}
 
-    for (unsigned int i = 0; i < size; i++){
-        *(buffer + i) = ((unsigned int)rand() % 256);
+/*
+* @brief Parses a size such as 4096, 512K, 100M or 8G.
+* @return The size in bytes, 0 if it is not a valid size.
+*/
+static uint64_t parse_size(const char *text) {
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+    switch (*end) {
+    case 'G': case 'g': size <<= 10; /* fall through */
+    case 'M': case 'm': size <<= 10; /* fall through */
+    case 'K': case 'k': size <<= 10; end++; break;
+    case '\0': break;
+    default: return 0;
     }
-    
-    return buffer;
+    return *end == '\0' ? size : 0;
 }
 
-int main(void){
-    //create file with random data
-    char *data = util_generate_random_data(2 * 1024 * 1024);
+int main(int argc, char *argv[]){
+    Mode mode = MODE_RANDOM;
+    int bits = 8;
+    uint64_t size = FILE_SIZE;
+    uint64_t seed;
+    int seeded = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char *path = "data.txt";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "Usage: %s [-size <bytes[K|M|G]>] [-seed <number>] [-threads <count>] [-mode random|text|entropy] [-entropy <bits per byte, 0-8>] [-o <file>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(argv[i], "-mode") == 0)
+        {
+            char *name = argv[++i];
+            if (strcmp(name, "random") == 0)
+                mode = MODE_RANDOM;
+            else if (strcmp(name, "text") == 0)
+                mode = MODE_TEXT;
+            else if (strcmp(name, "entropy") == 0)
+                mode = MODE_ENTROPY;
+            else
+            {
+                fprintf(stderr, "Unknown mode: %s\n", name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "-entropy") == 0)
+        {
+            bits = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-size") == 0)
+        {
+            size = parse_size(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-seed") == 0)
+        {
+            seed = strtoull(argv[++i], NULL, 0);
+            seeded = 1;
+        }
+        else if (strcmp(argv[i], "-threads") == 0)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (size == 0 || bits < 0 || bits > 8) {
+        fprintf(stderr, "Invalid size or entropy.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if (!seeded) {
+        // Print the seed, so any run can be reproduced with -seed.
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        seed = ((uint64_t)now.tv_sec << 20) ^ (uint64_t)now.tv_usec ^ ((uint64_t)getpid() << 40);
+    }
+
+    // The file is sized up front and mapped, the threads write straight into the page cache.
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open(2)");
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, (off_t)size) < 0) {
+        perror("ftruncate(2)");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap(2)");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
 
-    FILE *file = fopen("data.txt", "w");
-    if (file == NULL) {
-        perror("fopen(3)");
-        free(data);
+    pthread_t thread_ids[MAX_THREADS];
+    GeneratorArgs args[MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        args[i] = (GeneratorArgs){.data = data, .size = size, .seed = seed, .mode = mode, .bits = bits, .threads = threads, .index = i};
+        if (pthread_create(&thread_ids[i], NULL, generate_blocks, &args[i]) != 0) {
+            perror("pthread_create(3)");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_join(thread_ids[i], NULL);
+
+    if (munmap(data, size) < 0) {
+        perror("munmap(2)");
+        close(fd);
         exit(EXIT_FAILURE);
     }
+    close(fd);
 
-    fwrite(data, sizeof(char), 2 * 1024 * 1024, file);
-    fclose(file);
-    free(data);
+    gettimeofday(&end, NULL);
+    double time_taken = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+    fprintf(stdout, "Generated %" PRIu64 " bytes into %s in %.2f ms (%.2f MB/s, %d threads, seed %" PRIu64 ")\n",
+            size, path, time_taken, (size / (time_taken / 1000)) / (1024 * 1024), threads, seed);
     return 0;
-}
\ No newline at end of file
+}
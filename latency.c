@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "latency.h"
+
+int64_t latency_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int latency_enable_rx(int sock) {
+    int optval = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &optval, sizeof(optval)) < 0) {
+        perror("setsockopt(2)");
+        return -1;
+    }
+    return 0;
+}
+
+int latency_enable_tx(int sock) {
+    // OPT_TSONLY keeps the datagram itself off the error queue, OPT_ID numbers the timestamps.
+    int optval = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &optval, sizeof(optval)) < 0) {
+        perror("setsockopt(2)");
+        return -1;
+    }
+    return 0;
+}
+
+int64_t latency_rx_timestamp(struct msghdr *message) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            return (int64_t)stamp.tv_sec * 1000000000 + stamp.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+int latency_tx_timestamp(int sock, uint32_t *index, int64_t *timestamp) {
+    char control[LATENCY_CONTROL_SIZE];
+    struct msghdr message = {.msg_control = control, .msg_controllen = sizeof(control)};
+    int found = 0;
+
+    if (recvmsg(sock, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    // The timestamp and the index arrive as two control messages of the same error. Anything else on the queue,
+    // or a control message cut short, is skipped.
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+            struct scm_timestamping stamps;
+            if (cmsg->cmsg_len < CMSG_LEN(sizeof(stamps)))
+                continue;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            *timestamp = (int64_t)stamps.ts[0].tv_sec * 1000000000 + stamps.ts[0].tv_nsec;
+            found |= 1;
+        } else if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                   (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+            struct sock_extended_err error;
+            if (cmsg->cmsg_len < CMSG_LEN(sizeof(error)))
+                continue;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                *index = error.ee_data;
+                found |= 2;
+            }
+        }
+    }
+    return found == 3 ? 1 : 0;
+}
+
+void latency_add(Latency_Samples *latency, int64_t sample) {
+    if (latency->count == latency->capacity) {
+        size_t capacity = latency->capacity > 0 ? latency->capacity * 2 : 1024;
+        int64_t *samples = realloc(latency->samples, capacity * sizeof(int64_t));
+        if (samples == NULL)
+            return;
+        latency->samples = samples;
+        latency->capacity = capacity;
+    }
+    latency->samples[latency->count++] = sample;
+}
+
+void latency_merge(Latency_Samples *latency, const Latency_Samples *other) {
+    for (size_t i = 0; i < other->count; i++)
+        latency_add(latency, other->samples[i]);
+}
+
+void latency_reset(Latency_Samples *latency) {
+    latency->count = 0;
+}
+
+void latency_free(Latency_Samples *latency) {
+    free(latency->samples);
+    memset(latency, 0, sizeof(Latency_Samples));
+}
+
+static int compare_samples(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void latency_print(FILE *stream, const char *label, Latency_Samples *latency) {
+    if (latency->count == 0) {
+        fprintf(stream, "%s: no samples\n", label);
+        return;
+    }
+
+    qsort(latency->samples, latency->count, sizeof(int64_t), compare_samples);
+    double sum = 0;
+    for (size_t i = 0; i < latency->count; i++)
+        sum += latency->samples[i];
+
+    int64_t *s = latency->samples;
+    size_t n = latency->count;
+    fprintf(stream, "%s: n = %zu, min %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us, mean %.1f us\n",
+            label, n, s[0] / 1000.0, s[n / 2] / 1000.0, s[n * 9 / 10] / 1000.0, s[n * 99 / 100] / 1000.0,
+            s[n - 1] / 1000.0, sum / n / 1000.0);
+}
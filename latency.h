@@ -0,0 +1,62 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*
+* Per-packet latency samples taken from kernel timestamps (SO_TIMESTAMPNS on receive, SO_TIMESTAMPING for
+* software transmit timestamps). All times are CLOCK_REALTIME nanoseconds, the clock the kernel stamps with,
+* so one-way delays between hosts are only as good as their clock synchronization.
+*/
+typedef struct {
+    int64_t *samples;
+    size_t count;
+    size_t capacity;
+} Latency_Samples;
+
+// Room for a control message with one timestamp of either kind.
+#define LATENCY_CONTROL_SIZE 128
+
+// Returns the current CLOCK_REALTIME time in nanoseconds.
+int64_t latency_now_ns(void);
+
+/*
+* @brief Turns on kernel receive timestamps (SO_TIMESTAMPNS) on sock.
+* @return 0 on success, -1 on error.
+*/
+int latency_enable_rx(int sock);
+
+/*
+* @brief Turns on software transmit timestamps (SO_TIMESTAMPING) on sock. Every datagram sent afterwards gets a
+* timestamp on the socket's error queue, tagged with its index counted from 0.
+* @return 0 on success, -1 on error.
+*/
+int latency_enable_tx(int sock);
+
+/*
+* @brief Finds the SO_TIMESTAMPNS receive timestamp among the control messages of a recvmsg(2) call.
+* @return The timestamp in nanoseconds, 0 if the message carries none.
+*/
+int64_t latency_rx_timestamp(struct msghdr *message);
+
+/*
+* @brief Reads one transmit timestamp from the error queue of sock without blocking.
+* @return 1 and fills in the datagram index and timestamp, 0 if the queue is empty, -1 on error.
+*/
+int latency_tx_timestamp(int sock, uint32_t *index, int64_t *timestamp);
+
+void latency_add(Latency_Samples *latency, int64_t sample);
+void latency_merge(Latency_Samples *latency, const Latency_Samples *other);
+void latency_reset(Latency_Samples *latency);
+void latency_free(Latency_Samples *latency);
+
+/*
+* @brief Prints the distribution of the samples on one line: count, min, p50, p90, p99, max and mean in microseconds.
+* Sorts the samples in place.
+*/
+void latency_print(FILE *stream, const char *label, Latency_Samples *latency);
+
+#endif
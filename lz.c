@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define HASH_LOG 12
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// The format requires the last 5 bytes to be literals and the last match to start 12 bytes before the end.
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+#define RUN_MASK 15
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash32(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Returns how many bytes starting at p and ref are equal, without reading p past limit.
+static size_t common_length(const unsigned char *p, const unsigned char *ref, const unsigned char *limit) {
+    const unsigned char *start = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Compare eight bytes at a time, the lowest differing bit locates the first differing byte.
+    while (p + sizeof(uint64_t) <= limit) {
+        uint64_t a, b;
+        memcpy(&a, p, sizeof(a));
+        memcpy(&b, ref, sizeof(b));
+        if (a != b)
+            return p - start + (__builtin_ctzll(a ^ b) >> 3);
+        p += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+#endif
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return p - start;
+}
+
+// Writes the 255-continued remainder of a length that did not fit in its 4 bit token field.
+static unsigned char *write_length(unsigned char *op, size_t length) {
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char *write_sequence(unsigned char *op, const unsigned char *literals, size_t literal_length) {
+    unsigned char *token = op++;
+    if (literal_length >= RUN_MASK) {
+        *token = RUN_MASK << 4;
+        op = write_length(op, literal_length - RUN_MASK);
+    } else {
+        *token = (unsigned char)(literal_length << 4);
+    }
+    memcpy(op, literals, literal_length);
+    return op + literal_length;
+}
+
+int lz_compress(const char *source, int source_size, char *dest, int capacity) {
+    const unsigned char *src = (const unsigned char *)source;
+    const unsigned char *ip = src, *anchor = src;
+    const unsigned char *iend = src + source_size;
+    unsigned char *op = (unsigned char *)dest;
+    unsigned char *oend = op + capacity;
+    uint32_t table[1 << HASH_LOG];
+
+    if (source_size < 0)
+        return 0;
+
+    if (source_size > MATCH_FIND_LIMIT) {
+        const unsigned char *mflimit = iend - MATCH_FIND_LIMIT;
+        const unsigned char *matchlimit = iend - LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+        ip++;
+        while (ip < mflimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash32(sequence);
+            const unsigned char *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != sequence) {
+                // Step faster through data that does not compress.
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // Extend the match backwards over pending literals, then forwards.
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *match_end = ip + MIN_MATCH, *ref_end = ref + MIN_MATCH;
+            match_end += common_length(match_end, ref_end, matchlimit);
+
+            size_t literal_length = ip - anchor;
+            size_t match_length = match_end - ip - MIN_MATCH;
+            if (op + 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1 > oend)
+                return 0;
+
+            unsigned char *token = op;
+            op = write_sequence(op, anchor, literal_length);
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (unsigned char)(offset & 0xff);
+            *op++ = (unsigned char)(offset >> 8);
+
+            if (match_length >= RUN_MASK) {
+                *token |= RUN_MASK;
+                op = write_length(op, match_length - RUN_MASK);
+            } else {
+                *token |= (unsigned char)match_length;
+            }
+
+            ip = anchor = match_end;
+            if (ip - 2 > src)
+                table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    // The rest of the block is one run of literals.
+    size_t literal_length = iend - anchor;
+    if (op + 1 + literal_length / 255 + 1 + literal_length > oend)
+        return 0;
+    op = write_sequence(op, anchor, literal_length);
+
+    return (int)(op - (unsigned char *)dest);
+}
+
+// Reads the 255-continued remainder of a length. Returns -1 if the block ends first.
+static int read_length(const unsigned char **ip, const unsigned char *iend, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= iend)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz_decompress(const char *source, int source_size, char *dest, int capacity) {
+    const unsigned char *ip = (const unsigned char *)source;
+    const unsigned char *iend = ip + source_size;
+    unsigned char *out = (unsigned char *)dest;
+    unsigned char *op = out;
+    unsigned char *oend = out + capacity;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == RUN_MASK && read_length(&ip, iend, &literal_length) < 0)
+            return -1;
+        if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        // The last sequence has no match part.
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out))
+            return -1;
+
+        size_t match_length = token & RUN_MASK;
+        if (match_length == RUN_MASK && read_length(&ip, iend, &match_length) < 0)
+            return -1;
+        match_length += MIN_MATCH;
+        if (match_length > (size_t)(oend - op))
+            return -1;
+
+        const unsigned char *match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            // Overlapping copy repeats the last offset bytes.
+            while (match_length--)
+                *op++ = *match++;
+        }
+    }
+
+    return (int)(op - out);
+}
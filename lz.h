@@ -0,0 +1,24 @@
+#ifndef LZ_H
+#define LZ_H
+
+/*
+* A small LZ77 codec that reads and writes the LZ4 block format (greedy parser, 4096 entry hash table).
+* Every call handles one self-contained block, so blocks can be decoded independently and in any order.
+*/
+
+// Maximum size of a compressed block for an input of size bytes.
+#define LZ_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+/*
+* @brief Compresses source into dest.
+* @return The compressed size, or 0 if it would not fit in capacity bytes (store the block raw instead).
+*/
+int lz_compress(const char *source, int source_size, char *dest, int capacity);
+
+/*
+* @brief Decompresses a block produced by lz_compress().
+* @return The decompressed size, or -1 if the block is malformed or larger than capacity.
+*/
+int lz_decompress(const char *source, int source_size, char *dest, int capacity);
+
+#endif
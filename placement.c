@@ -0,0 +1,200 @@
+#define _GNU_SOURCE // pthread_setaffinity_np()
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/mempolicy.h>
+
+#include "placement.h"
+
+#define NODE_MASK_WORDS (PLACEMENT_MAX_NODE / (8 * sizeof(unsigned long)) + 1)
+
+void placement_init(Placement *placement, int hugepages, int node) {
+    memset(placement, 0, sizeof(Placement));
+    placement->hugepages = hugepages;
+    placement->node = node;
+}
+
+int placement_node(const char *name, int *node) {
+    char path[128];
+    char *end;
+    long number = strtol(name, &end, 10);
+
+    if (*name != '\0' && *end == '\0') {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld", number);
+        if (number < 0 || number > PLACEMENT_MAX_NODE || access(path, F_OK) < 0) {
+            fprintf(stderr, "NUMA node %s does not exist\n", name);
+            return -1;
+        }
+        *node = (int)number;
+        return 0;
+    }
+
+    if (strlen(name) >= IF_NAMESIZE) {
+        fprintf(stderr, "Network interface %s does not exist\n", name);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s", name);
+    if (access(path, F_OK) < 0) {
+        fprintf(stderr, "Network interface %s does not exist\n", name);
+        return -1;
+    }
+    // Only a NIC on a bus has a device node, and the kernel reports -1 for it on a machine with a single node
+    *node = -1;
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+    FILE *file = fopen(path, "r");
+    if (file != NULL) {
+        if (fscanf(file, "%d", node) != 1)
+            *node = -1;
+        fclose(file);
+    }
+    return 0;
+}
+
+// Bytes a buffer of size bytes takes: whole huge pages with -hugepages, whole pages otherwise.
+static size_t placement_length(const Placement *placement, size_t size) {
+    size_t page = placement != NULL && placement->hugepages ? PLACEMENT_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    size = size > 0 ? size : 1;
+    return (size + page - 1) / page * page;
+}
+
+void *placement_alloc(Placement *placement, size_t size) {
+    int hugepages = placement != NULL && placement->hugepages;
+    size_t length = placement_length(placement, size);
+    size_t *kind = placement != NULL ? &placement->page_bytes : NULL;
+    char *buffer = MAP_FAILED;
+
+    if (hugepages) {
+        // Fails right away unless the huge page pool (vm.nr_hugepages) can back the whole buffer
+        buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buffer != MAP_FAILED)
+            kind = &placement->hugetlb_bytes;
+    }
+    if (buffer == MAP_FAILED) {
+        // Transparent huge pages back only huge page aligned memory: map a huge page more and trim it to alignment
+        size_t map_length = hugepages ? length + PLACEMENT_HUGE_PAGE : length;
+        char *region = mmap(NULL, map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("mmap(2)");
+            return NULL;
+        }
+        buffer = region;
+        if (hugepages) {
+            buffer = (char *)(((uintptr_t)region + PLACEMENT_HUGE_PAGE - 1) & ~(uintptr_t)(PLACEMENT_HUGE_PAGE - 1));
+            if (buffer > region)
+                munmap(region, buffer - region);
+            if (region + map_length > buffer + length)
+                munmap(buffer + length, region + map_length - (buffer + length));
+            if (madvise(buffer, length, MADV_HUGEPAGE) == 0)
+                kind = &placement->thp_bytes;
+        }
+    }
+
+    // Bind before the first touch, the pages are then allocated on the node
+    if (placement != NULL && placement->node >= 0) {
+        unsigned long mask[NODE_MASK_WORDS] = {0};
+        mask[placement->node / (8 * sizeof(unsigned long))] |= 1UL << (placement->node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_mbind, buffer, length, MPOL_BIND, mask, sizeof(mask) * 8 + 1, 0) == 0)
+            __atomic_fetch_add(&placement->bound_bytes, length, __ATOMIC_RELAXED);
+        else
+            __atomic_store_n(&placement->bind_error, errno, __ATOMIC_RELAXED);
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(buffer, length, MADV_POPULATE_WRITE) < 0)
+        memset(buffer, 0, length);
+#else
+    memset(buffer, 0, length);
+#endif
+
+    if (kind != NULL)
+        __atomic_fetch_add(kind, length, __ATOMIC_RELAXED);
+    return buffer;
+}
+
+void placement_free(Placement *placement, void *buffer, size_t size) {
+    if (buffer != NULL)
+        munmap(buffer, placement_length(placement, size));
+}
+
+int placement_cpu(int first_cpu, int index) {
+    if (first_cpu < 0)
+        return -1;
+
+    // Only the CPUs the process may run on (taskset, cgroup cpusets), in order; first_cpu counts from the first
+    // allowed one at or above it
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int count = 0;
+    int first = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return first_cpu + index;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        if (cpu < first_cpu)
+            first = count + 1;
+        cpus[count++] = cpu;
+    }
+    if (count == 0)
+        return first_cpu + index;
+    return cpus[(first + index) % count];
+}
+
+int placement_pin(int cpu) {
+    if (cpu < 0)
+        return 0;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0) {
+        fprintf(stderr, "Failed to pin a thread to CPU %d: %s\n", cpu, strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+void placement_print(FILE *out, const Placement *placement, const int *cpus, int count) {
+    size_t total = placement->hugetlb_bytes + placement->thp_bytes + placement->page_bytes;
+
+    fprintf(out, "Placement: buffers ");
+    if (total == 0) {
+        fprintf(out, "none");
+    } else {
+        fprintf(out, "%.0f%% MAP_HUGETLB huge pages, %.0f%% transparent huge pages, %.0f%% %ld KB pages",
+                100.0 * placement->hugetlb_bytes / total, 100.0 * placement->thp_bytes / total,
+                100.0 * placement->page_bytes / total, sysconf(_SC_PAGESIZE) / 1024);
+    }
+    if (placement->node >= 0) {
+        fprintf(out, ", %.0f%% bound to NUMA node %d", total > 0 ? 100.0 * placement->bound_bytes / total : 0, placement->node);
+        int bind_error = __atomic_load_n(&placement->bind_error, __ATOMIC_RELAXED);
+        if (bind_error != 0)
+            fprintf(out, " (mbind: %s)", strerror(bind_error));
+    } else {
+        fprintf(out, ", not bound to a NUMA node");
+    }
+
+    int pinned = 0;
+    for (int i = 0; i < count; i++)
+        pinned += cpus[i] >= 0;
+    if (pinned == 0) {
+        fprintf(out, "; threads not pinned\n");
+        return;
+    }
+    fprintf(out, "; threads pinned to CPUs");
+    for (int i = 0; i < count; i++) {
+        if (cpus[i] >= 0)
+            fprintf(out, "%s%d", i > 0 ? ", " : " ", cpus[i]);
+        else
+            fprintf(out, "%s-", i > 0 ? ", " : " ");
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,59 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+* Where the transfer buffers and the transfer threads live. Buffers can be backed by huge pages, so a 2 MB
+* transfer buffer takes one TLB entry instead of 512, and bound to a NUMA node, usually the NIC's, so the data
+* does not cross sockets on its way between the NIC and the buffers. Threads can be pinned to CPUs.
+*/
+
+#define PLACEMENT_HUGE_PAGE (2 * 1024 * 1024) // Size of the huge pages buffers are rounded up to.
+#define PLACEMENT_MAX_NODE 1023               // Highest NUMA node a buffer can be bound to.
+
+typedef struct {
+    int hugepages;        // Back the buffers with huge pages: MAP_HUGETLB, or advised transparent huge pages
+                          // when the huge page pool is empty.
+    int node;             // NUMA node to bind the buffers to, -1 to leave them to the default policy.
+    // Bytes of the buffers allocated so far, by what backs them. Updated atomically, buffers are allocated by
+    // the transfer threads too.
+    size_t hugetlb_bytes; // MAP_HUGETLB pages.
+    size_t thp_bytes;     // Transparent huge pages, advised with MADV_HUGEPAGE.
+    size_t page_bytes;    // Base pages.
+    size_t bound_bytes;   // Bound to node.
+    int bind_error;       // errno of the last failed mbind(), 0 if none failed. Stored atomically too.
+} Placement;
+
+// Starts a placement with no buffers allocated yet.
+void placement_init(Placement *placement, int hugepages, int node);
+
+/*
+* @brief Resolves a -numa argument: a node number, or the name of a network interface, which stands for the node
+* its NIC is attached to. A virtual interface, or a NIC of a machine with a single node, has none: node is then -1.
+* @return 0 on success, -1 if the node or interface does not exist.
+*/
+int placement_node(const char *name, int *node);
+
+/*
+* @brief Maps a page aligned buffer of size bytes, placed as placement asks (NULL for plain pages), and faults it
+* in, so the pages are on their node before the transfer and the transfer does not stop to fault them.
+* @return The buffer, NULL on error.
+*/
+void *placement_alloc(Placement *placement, size_t size);
+
+// Unmaps a buffer of placement_alloc(), with the same placement and size.
+void placement_free(Placement *placement, void *buffer, size_t size);
+
+// Returns the CPU of thread index when the threads are pinned from first_cpu on, wrapping around the CPUs
+// sched_getaffinity() allows the process, -1 if first_cpu is -1 (not pinned).
+int placement_cpu(int first_cpu, int index);
+
+// Pins the calling thread to cpu, nothing if cpu is -1. Returns 0 on success, -1 on error.
+int placement_pin(int cpu);
+
+// Prints where the buffers were placed, and the CPUs of count threads (-1 for a thread that is not pinned).
+void placement_print(FILE *out, const Placement *placement, const int *cpus, int count);
+
+#endif
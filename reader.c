@@ -0,0 +1,212 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+// A slot has room for a block that starts up to READER_ALIGN - 1 bytes into its first aligned sector, and for the
+// rounding up of its end.
+#define SLOT_SIZE (READER_BLOCK_SIZE + 2 * READER_ALIGN)
+
+static double reader_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/*
+* @brief Reads size bytes at position into slot. O_DIRECT reads cover whole sectors, the data then starts skew
+* bytes into the slot.
+* @return 0 on success, an errno value on error.
+*/
+static int reader_read(Reader *reader, int slot, off_t position, size_t size) {
+    char *base = reader->ring + (size_t)slot * SLOT_SIZE;
+    size_t skew = reader->direct ? (size_t)(position % READER_ALIGN) : 0;
+    size_t need = skew + size;
+    size_t request = reader->direct ? (need + READER_ALIGN - 1) / READER_ALIGN * READER_ALIGN : need;
+    off_t start = position - (off_t)skew;
+    size_t got = 0;
+
+    double read_start = reader_now_ms();
+    while (got < need) {
+        ssize_t n = pread(reader->fd, base + got, request - got, start + (off_t)got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno;
+        if (n == 0)
+            return EIO; // the file shrank under the transfer
+        got += n;
+    }
+    reader->read_ms += reader_now_ms() - read_start;
+
+    reader->data[slot] = base + skew;
+    reader->sizes[slot] = size;
+    return 0;
+}
+
+static void *reader_loop(void *arg) {
+    Reader *reader = (Reader *)arg;
+
+    for (size_t done = 0; done < reader->length;) {
+        pthread_mutex_lock(&reader->lock);
+        if (!reader->stopping && reader->filled - reader->drained == (uint64_t)reader->blocks)
+            reader->reader_waits++;
+        while (!reader->stopping && reader->filled - reader->drained == (uint64_t)reader->blocks)
+            pthread_cond_wait(&reader->not_full, &reader->lock);
+        int slot = (int)(reader->filled % reader->blocks);
+        int stopping = reader->stopping;
+        pthread_mutex_unlock(&reader->lock);
+        if (stopping)
+            break;
+
+        // The slot is free, only this thread touches it until it is published below.
+        size_t size = reader->length - done < READER_BLOCK_SIZE ? reader->length - done : READER_BLOCK_SIZE;
+        int error = reader_read(reader, slot, reader->offset + (off_t)done, size);
+
+        pthread_mutex_lock(&reader->lock);
+        if (error != 0) {
+            reader->error = error;
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+        reader->filled++;
+        pthread_cond_signal(&reader->not_empty);
+        pthread_mutex_unlock(&reader->lock);
+        done += size;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->finished = 1;
+    pthread_cond_signal(&reader->not_empty);
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+int reader_init(Reader *reader, int blocks, Placement *placement) {
+    memset(reader, 0, sizeof(Reader));
+    reader->fd = -1;
+    reader->placement = placement;
+    reader->blocks = blocks < 1 ? 1 : blocks > READER_MAX_BLOCKS ? READER_MAX_BLOCKS : blocks;
+
+    // Whole pages, so aligned for O_DIRECT
+    reader->ring = (char *)placement_alloc(placement, (size_t)reader->blocks * SLOT_SIZE);
+    return reader->ring != NULL ? 0 : -1;
+}
+
+int reader_start(Reader *reader, const char *path, off_t offset, size_t length, int flags) {
+    // Everything but the ring starts over
+    char *ring = reader->ring;
+    int blocks = reader->blocks;
+    Placement *placement = reader->placement;
+    memset(reader, 0, sizeof(Reader));
+    reader->ring = ring;
+    reader->blocks = blocks;
+    reader->placement = placement;
+    reader->offset = offset;
+    reader->length = length;
+
+    reader->fd = -1;
+    if (flags & READER_DIRECT) {
+        // tmpfs and some other file systems refuse O_DIRECT, read through the page cache there
+        reader->fd = open(path, O_RDONLY | O_DIRECT);
+        reader->direct = reader->fd >= 0;
+    }
+    if (reader->fd < 0)
+        reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        perror("open(2)");
+        return -1;
+    }
+    if (!reader->direct)
+        posix_fadvise(reader->fd, offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->not_empty, NULL);
+    pthread_cond_init(&reader->not_full, NULL);
+    if (pthread_create(&reader->thread, NULL, reader_loop, reader) != 0) {
+        perror("pthread_create(3)");
+        pthread_cond_destroy(&reader->not_full);
+        pthread_cond_destroy(&reader->not_empty);
+        pthread_mutex_destroy(&reader->lock);
+        close(reader->fd);
+        reader->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+const char *reader_next(Reader *reader, size_t *size) {
+    const char *block = NULL;
+
+    *size = 0;
+    pthread_mutex_lock(&reader->lock);
+    if (reader->filled == reader->drained && !reader->finished)
+        reader->sender_waits++;
+    while (reader->filled == reader->drained && !reader->finished)
+        pthread_cond_wait(&reader->not_empty, &reader->lock);
+    if (reader->filled > reader->drained) {
+        int slot = (int)(reader->drained % reader->blocks);
+        block = reader->data[slot];
+        *size = reader->sizes[slot];
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return block;
+}
+
+void reader_release(Reader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    if (reader->drained < reader->filled) {
+        reader->drained++;
+        pthread_cond_signal(&reader->not_full);
+    }
+    pthread_mutex_unlock(&reader->lock);
+}
+
+int reader_stop(Reader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stopping = 1;
+    pthread_cond_signal(&reader->not_full);
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_join(reader->thread, NULL);
+    pthread_cond_destroy(&reader->not_full);
+    pthread_cond_destroy(&reader->not_empty);
+    pthread_mutex_destroy(&reader->lock);
+    close(reader->fd);
+    reader->fd = -1;
+
+    if (reader->error != 0) {
+        errno = reader->error;
+        return -1;
+    }
+    return 0;
+}
+
+void reader_free(Reader *reader) {
+    placement_free(reader->placement, reader->ring, (size_t)reader->blocks * SLOT_SIZE);
+    reader->ring = NULL;
+}
+
+void reader_print_stats(FILE *out, const Reader *const *readers, int count) {
+    size_t bytes = 0;
+    double read_ms = 0;
+    uint64_t reader_waits = 0, sender_waits = 0;
+    int direct = 0;
+
+    for (int i = 0; i < count; i++) {
+        bytes += readers[i]->length;
+        read_ms += readers[i]->read_ms;
+        reader_waits += readers[i]->reader_waits;
+        sender_waits += readers[i]->sender_waits;
+        direct += readers[i]->direct;
+    }
+    fprintf(out, "Disk reads: %zu bytes in %.2f ms (%s, %d x %d KB blocks per reader), waits for the disk: %llu, waits for the network: %llu\n",
+            bytes, read_ms, direct == count ? "O_DIRECT" : direct > 0 ? "partly O_DIRECT" : "page cache",
+            count > 0 ? readers[0]->blocks : 0, READER_BLOCK_SIZE / 1024,
+            (unsigned long long)sender_waits, (unsigned long long)reader_waits);
+}
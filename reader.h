@@ -0,0 +1,87 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "placement.h"
+
+/*
+* Disk-to-socket pipeline. A reader thread reads one part of a file in order into a ring of aligned blocks while
+* the sending thread drains them, so reading the file overlaps sending it and the ring bounds the memory in
+* flight. The reader waits while every block is full and the sender waits while every block is empty: the slower
+* side sets the pace, and a transfer takes about as long as the slower of the disk and the network.
+*/
+
+#define READER_BLOCK_SIZE (256 * 1024) // Bytes per block, a multiple of the page size and of every chunk size.
+#define READER_BLOCKS 4                // Default number of blocks in a ring.
+#define READER_MAX_BLOCKS 64
+#define READER_ALIGN 4096              // O_DIRECT alignment of file offsets, lengths and buffers.
+
+// reader_start() flags.
+#define READER_DIRECT 1 // Read with O_DIRECT, around the page cache. Falls back to buffered reads where unsupported.
+
+typedef struct {
+    int fd;
+    int direct;                      // 1 if the reads bypass the page cache.
+    off_t offset;                    // The part of the file to read.
+    size_t length;
+    int blocks;                      // Blocks in the ring.
+    char *ring;                      // The slots, READER_ALIGN aligned.
+    Placement *placement;            // Where the ring was allocated, NULL for plain pages.
+    char *data[READER_MAX_BLOCKS];   // Start of the file data in each slot, an O_DIRECT read may start before it.
+    size_t sizes[READER_MAX_BLOCKS]; // Bytes of file data in each slot.
+    uint64_t filled;                 // Blocks read so far.
+    uint64_t drained;                // Blocks the sender released so far.
+    int finished;                    // Set once the reader read its last block or failed.
+    int error;                       // errno of a failed read, 0 if none.
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;        // Signaled when a block is filled, and when the reader finishes.
+    pthread_cond_t not_full;         // Signaled when a block is released, and on stop.
+    double read_ms;                  // Time spent in pread().
+    uint64_t reader_waits;           // Times the reader found the ring full: the network is the bottleneck.
+    uint64_t sender_waits;           // Times the sender found the ring empty: the disk is the bottleneck.
+} Reader;
+
+/*
+* @brief Allocates a ring of blocks READER_BLOCK_SIZE bytes each, as placement asks (NULL for plain pages). The
+* ring serves every reader_start() until reader_free(), so a transfer of many files allocates it once.
+* @return 0 on success, -1 on error.
+*/
+int reader_init(Reader *reader, int blocks, Placement *placement);
+
+/*
+* @brief Starts a thread reading length bytes of the file at path from offset on into the ring, a block at a time
+* (the last one may be shorter). The statistics start over.
+* @return 0 on success, -1 on error.
+*/
+int reader_start(Reader *reader, const char *path, off_t offset, size_t length, int flags);
+
+/*
+* @brief Waits for the next block of the file. It stays valid until reader_release().
+* @return The block and its size in size, or NULL once the whole part was read (size 0) or a read failed
+* (reader->error holds its errno).
+*/
+const char *reader_next(Reader *reader, size_t *size);
+
+// Hands the block returned by reader_next() back to the reader thread.
+void reader_release(Reader *reader);
+
+/*
+* @brief Stops the thread. The ring stays for the next reader_start(), the statistics stay in the structure.
+* @return 0 on success, -1 with errno set if a read failed.
+*/
+int reader_stop(Reader *reader);
+
+// Frees the ring of reader_init().
+void reader_free(Reader *reader);
+
+// Prints the combined statistics of count readers: time spent reading and which side of the pipeline waited.
+void reader_print_stats(FILE *out, const Reader *const *readers, int count);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/tcp.h>
+
+#include "report.h"
+
+// Returns the CLOCK_MONOTONIC time in nanoseconds.
+static uint64_t report_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Prints one line for the interval [from_ns, to_ns), counted from the start of the reports.
+static void report_line(const Reporter *reporter, uint64_t from_ns, uint64_t to_ns, const Report_Sample *from, const Report_Sample *to) {
+    uint64_t bytes = to->bytes - from->bytes;
+    double seconds = (to_ns - from_ns) / 1e9;
+    char line[256];
+    int length = snprintf(line, sizeof(line), "[%8.3f-%8.3f s] %10.2f MB %10.2f MB/s", from_ns / 1e9, to_ns / 1e9,
+                          bytes / (1024.0 * 1024.0), seconds > 0 ? bytes / seconds / (1024 * 1024) : 0);
+
+    if (reporter->fields & REPORT_PACKETS)
+        length += snprintf(line + length, sizeof(line) - length, " %10llu packets", (unsigned long long)(to->packets - from->packets));
+    if (reporter->fields & REPORT_LOST)
+        length += snprintf(line + length, sizeof(line) - length, " %8llu lost", (unsigned long long)(to->lost - from->lost));
+    if (reporter->fields & REPORT_RETRANSMITS)
+        snprintf(line + length, sizeof(line) - length, " %8llu retransmits", (unsigned long long)(to->retransmits - from->retransmits));
+    fprintf(stdout, "%s\n", line);
+}
+
+static void *report_loop(void *arg) {
+    Reporter *reporter = (Reporter *)arg;
+    Report_Sample first = {0}, last, now;
+    uint64_t start_ns = report_now_ns(), last_ns = start_ns, now_ns;
+    int stopping = 0;
+
+    reporter->sampler(reporter->arg, &first);
+    last = first;
+    while (!stopping) {
+        // Intervals are kept on the grid start + k * interval, however late the thread wakes.
+        uint64_t due_ns = last_ns + (uint64_t)reporter->interval_ms * 1000000;
+        struct timespec deadline = {.tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000};
+
+        pthread_mutex_lock(&reporter->lock);
+        while (!reporter->stopping && report_now_ns() < due_ns)
+            pthread_cond_timedwait(&reporter->wake, &reporter->lock, &deadline);
+        stopping = reporter->stopping;
+        pthread_mutex_unlock(&reporter->lock);
+
+        now_ns = stopping ? report_now_ns() : due_ns;
+        memset(&now, 0, sizeof(now));
+        reporter->sampler(reporter->arg, &now);
+
+        // Idle intervals, e.g. while the sender waits for its user, are not printed.
+        if (now.bytes != last.bytes || now.packets != last.packets)
+            report_line(reporter, last_ns - start_ns, now_ns - start_ns, &last, &now);
+        last = now;
+        last_ns = now_ns;
+    }
+
+    fprintf(stdout, "Interval reports total:\n");
+    report_line(reporter, 0, last_ns - start_ns, &first, &last);
+    return NULL;
+}
+
+int report_start(Reporter *reporter, uint32_t interval_ms, int fields, Report_Sampler sampler, void *arg) {
+    pthread_condattr_t attributes;
+
+    memset(reporter, 0, sizeof(Reporter));
+    reporter->sampler = sampler;
+    reporter->arg = arg;
+    reporter->fields = fields;
+    reporter->interval_ms = interval_ms > 0 ? interval_ms : 1;
+    pthread_mutex_init(&reporter->lock, NULL);
+    // The deadlines are CLOCK_MONOTONIC, so a clock change does not stall or flood the reports.
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&reporter->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    if (pthread_create(&reporter->thread, NULL, report_loop, reporter) != 0) {
+        perror("pthread_create(3)");
+        return -1;
+    }
+    return 0;
+}
+
+void report_stop(Reporter *reporter) {
+    pthread_mutex_lock(&reporter->lock);
+    reporter->stopping = 1;
+    pthread_cond_signal(&reporter->wake);
+    pthread_mutex_unlock(&reporter->lock);
+
+    pthread_join(reporter->thread, NULL);
+    pthread_cond_destroy(&reporter->wake);
+    pthread_mutex_destroy(&reporter->lock);
+}
+
+int report_add_tcp_info(int sock, Report_Sample *sample) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+
+    // Older kernels fill in a shorter structure, the fields they lack stay 0.
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) < 0)
+        return -1;
+    sample->packets += info.tcpi_segs_in;
+    sample->lost += info.tcpi_rcv_ooopack;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+* iperf style interval reports. The receive loops keep cumulative counters, and a reporter thread samples them
+* every interval and prints what changed since the last sample. Every counter has a single writer that updates
+* it with REPORT_ADD, so the receive path pays plain stores and no locked instructions.
+*/
+
+// Adds n to a counter owned by the calling thread, in a way other threads can read while it changes.
+#define REPORT_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+// Reads a counter another thread updates with REPORT_ADD.
+#define REPORT_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// Which fields of a sample the sampler fills in, bytes are always there.
+#define REPORT_PACKETS 1
+#define REPORT_LOST 2
+#define REPORT_RETRANSMITS 4
+
+// Cumulative totals at the time of a sample.
+typedef struct {
+    uint64_t bytes;       // Payload bytes received.
+    uint64_t packets;     // Datagrams or TCP segments received.
+    uint64_t lost;        // Packets that arrived out of order after a gap: lost, or at least reordered.
+    uint64_t retransmits; // Packets that arrived more than once.
+} Report_Sample;
+
+// Fills in the totals of everything it reports on, called from the reporter thread.
+typedef void (*Report_Sampler)(void *arg, Report_Sample *sample);
+
+typedef struct {
+    Report_Sampler sampler;
+    void *arg;
+    int fields;            // REPORT_* fields the sampler fills in.
+    uint32_t interval_ms;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;   // Signaled by report_stop().
+    int stopping;
+} Reporter;
+
+/*
+* @brief Starts a thread that prints a report line every interval_ms milliseconds in which anything arrived.
+* @return 0 on success, -1 on error.
+*/
+int report_start(Reporter *reporter, uint32_t interval_ms, int fields, Report_Sampler sampler, void *arg);
+
+// Prints the last partial interval, stops the thread and prints the totals over the whole reporting time.
+void report_stop(Reporter *reporter);
+
+/*
+* @brief Adds the kernel's TCP_INFO counters of a connected TCP socket to a sample: segments received and
+* segments that arrived out of order. The sender's retransmissions are not visible to the receiver.
+* @return 0 on success, -1 if the socket is gone.
+*/
+int report_add_tcp_info(int sock, Report_Sample *sample);
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef RUDP_H
+#define RUDP_H
+
+/*
+* Reliable UDP: a connection handshake, checksummed and sequenced chunks, and flows that each carry a
+* chunk-aligned stripe of a transfer. Build with librudp.a or librudp.so (see the Makefile).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "latency.h"
+
+#define CHUNK_SIZE 1024
+#define SYN 1
+#define SYN_ACK 3
+#define ACK 2
+#define FIN 4
+#define FIN_ACK 6
+#define PUSH 16
+#define RESUME 32
+#define RESUME_ACK 34    // RESUME | ACK: the server took the ticket, the payload is the next one.
+#define RESUME_REJECT 36 // RESUME | FIN: the server refused the ticket, the client falls back to a handshake.
+#define KEEPALIVE 64
+#define MAX_FLOWS 16
+#define MAX_STREAMS 64
+#define TICKET_VERSION 2
+
+// Timer wheel geometry: TIMER_LEVELS levels of TIMER_SLOTS slots, one tick per millisecond at level 0.
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
+// Receivers keep their checkpoint in CHECKPOINT_PREFIX_<port> and the received data in CHECKPOINT_PREFIX_<port>.part.
+#define CHECKPOINT_PREFIX ".rudp_checkpoint"
+
+/*
+* Wire format of a packet, all fields big endian:
+*
+*   0  version (high 4 bits) | options (low 4 bits)
+*   1  flags
+*   2  checksum (16 bits) of the header, with this field zeroed, and of everything after it, see calculate_checksum()
+*   4  stream ID (16 bits)
+*   6  sequence number (32 bits), counted within the stream for a multiplexed chunk
+*   10 acknowledgment number (32 bits)
+*   14 connection ID (32 bits)
+*   18 payload
+*
+* With RUDP_OPTION_TIMESTAMP the payload is followed by the sender's send time (64 bits). A trailer rather than a
+* header field, so the header has one size and the payload can be read and written in place.
+* The datagram length is the UDP length, it is not repeated in the header.
+*/
+#define RUDP_VERSION 1
+#define RUDP_HEADER_SIZE 18
+#define RUDP_OPTION_TIMESTAMP 1
+#define RUDP_TIMESTAMP_SIZE 8
+
+// RUDP header, decoded. rudp_header_encode() and rudp_header_decode() convert it from and to the wire format.
+typedef struct
+{
+    uint16_t checksum;
+    uint16_t length;                // Size of the header and payload it arrived with (the trailer not included).
+    uint32_t sequence_number;
+    uint32_t acknowledgment_number;
+    uint32_t connection_id;         // Picked by the client, carried by every packet of the connection.
+    uint16_t stream_id;             // Stream the chunk belongs to, see RUDP_Stream (0 outside multiplexed transfers).
+    uint8_t flags;
+    int64_t send_time;              // Sender's clock (CLOCK_REALTIME ns) right before the packet was sent, 0 if the packet carried none.
+} RUDP_Header;
+
+/*
+* Session ticket. The server hands one out in the SYN-ACK payload, and a returning client presents it in a
+* RESUME packet instead of repeating the handshake, in front of its first chunk. The ticket authenticates itself
+* with a keyed hash, under a key shared by all receivers on the host. It is good for one RESUME: the receiver
+* remembers the tickets it took until they expire, and answers the RESUME with the next ticket (RESUME_ACK).
+* All fields are in network byte order.
+*/
+typedef struct
+{
+    uint64_t mac;         // SipHash-2-4 of the fields below.
+    uint32_t issued;      // Issue time, seconds since the epoch.
+    uint32_t client_addr; // IPv4 address the ticket was issued to.
+    uint16_t chunk_size;  // Negotiated chunk size.
+    uint16_t version;     // TICKET_VERSION.
+    uint32_t lifetime;    // Seconds the ticket stays valid.
+    uint64_t nonce;       // Random, tells apart the tickets issued to one client in the same second.
+} RUDP_Ticket;
+
+// rudp packet
+typedef struct
+{
+    RUDP_Header header;
+    // The payload, with room for the ticket a RESUME puts in front of a chunk and for the send time trailer while it is decoded.
+    char data[sizeof(RUDP_Ticket) + CHUNK_SIZE + RUDP_TIMESTAMP_SIZE];
+} RUDP_Packet;
+
+typedef struct RUDP_Timer RUDP_Timer;
+
+// A timer of a wheel. It is owned by the caller (usually embedded in a socket), the wheel only links it in.
+struct RUDP_Timer
+{
+    RUDP_Timer *next;                            // Next timer in the same slot.
+    RUDP_Timer **pprev;                          // The pointer to this timer, NULL if the timer is not pending.
+    uint64_t expires;                            // Tick (millisecond) the timer fires at.
+    void (*callback)(RUDP_Timer *timer, void *arg);
+    void *arg;
+};
+
+/*
+* Hierarchical timing wheel (Varghese and Lauck). Level l has TIMER_SLOTS slots of TIMER_SLOTS^l ticks each.
+* A timer goes into the lowest level whose span covers its delay, and moves down a level whenever the level
+* below wraps around, so starting and cancelling a timer are O(1) however many timers are pending.
+* Every socket owns one wheel, allocated by rudp_socket() and freed by rudp_close(), and runs it from the thread
+* that receives on it. The timers cost no syscalls: the wheel is advanced from the socket's receive loop with the
+* vDSO clock, and only bounds the poll() that loop sleeps in anyway.
+*/
+typedef struct
+{
+    uint64_t now;                                 // Last tick the wheel was advanced to.
+    size_t pending;                               // Number of pending timers.
+    RUDP_Timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+} RUDP_Timer_Wheel;
+
+/*
+* Receiver checkpoint of a resumable transfer: which chunks of which file are already in the spool.
+* Saved as a header and one bit per chunk, so a restarted sender (or receiver) only moves the missing chunks. The
+* bits are set in the file's image as the chunks arrive, and a save writes only the blocks of it that changed.
+*/
+typedef struct
+{
+    uint64_t file_id;      // File whose chunks are recorded, 0 if none.
+    size_t chunks;         // Chunks in the file.
+    uint8_t *chunk_map;    // One byte per chunk of the file, set by the flows' ranges as their chunks arrive. Read
+                           // and written with relaxed atomic byte loads and stores, the flows share it.
+    uint8_t *image;        // The file's contents, kept current as the chunks arrive (atomic byte ORs).
+    uint8_t *dirty;        // One flag per CHECKPOINT_BLOCK bytes of image, set if they changed since the last save.
+    int fd;                // The checkpoint file.
+    pthread_mutex_t lock;  // Serializes saves and file changes between the flows.
+} RUDP_Checkpoint;
+
+/*
+* Receive counters of a socket over its lifetime, for interval reports. Only the receiving thread updates them,
+* with relaxed atomic stores, so another thread may sample them with relaxed atomic loads at any time.
+*/
+typedef struct
+{
+    uint64_t bytes;      // Payload bytes of new chunks.
+    uint64_t packets;    // PUSH packets that passed the checksum.
+    uint64_t lost;       // Chunks a later chunk overtook (lost, or at least reordered), plus corrupt packets.
+    uint64_t duplicates; // PUSH packets whose chunk had already arrived, i.e. retransmissions.
+} RUDP_Counters;
+
+// A struct that represents RUDP Socket
+typedef struct
+{
+    int socket_fd;                // UDP socket file descriptor
+    bool isServer;                // True if the RUDP socket acts like a server, false for client.
+    bool isConnected;             // True if there is an active connection, false otherwise.
+    struct sockaddr_in dest_addr; // Destination address. Client fills it when it connects via rudp_connect(), server fills it when it accepts a connection via rudp_accept().
+    uint32_t rtt_us;              // Round trip time measured during the handshake, or cached from an earlier session (0 if unknown).
+    bool isResumed;               // True if the connection was resumed from a session ticket, without a handshake.
+    bool isContinued;             // Server: the handshake announced the file the checkpoint holds, the next receive continues it.
+    bool hasTicket;               // True if the server issued a session ticket during the handshake.
+    RUDP_Ticket ticket;           // The ticket to present on the next connection to the same server.
+    bool resumePending;           // Client: resumed, the ticket goes out in front of the first packet sent.
+    RUDP_Packet early;            // Server: the first chunk, which came with the RESUME, for the next receive.
+    int early_size;               // Server: payload bytes of early, -1 if none is waiting.
+    bool timestamps;              // True if kernel timestamps are collected, see rudp_enable_timestamps().
+    uint32_t tx_index;            // Number of datagrams sent since transmit timestamps were turned on.
+    uint32_t busy_poll_us;        // Spin budget of a busy-polling receive before it sleeps, 0 for blocking receives.
+    int epoll_fd;                 // Where a busy-polling receive sleeps once the budget is spent (-1 if unused).
+    size_t spin_hits;             // Datagrams a busy-polling receive found while spinning.
+    size_t sleeps;                // Times a busy-polling receive ran out of budget and slept in epoll_wait().
+    uint64_t file_id;             // File to continue, announced in the SYN (0 for none). Server: as of the last handshake.
+    uint8_t *delivered;           // Client: one byte per chunk of the file, set if the server's checkpoint has it (NULL if none).
+    size_t delivered_chunks;      // Client: number of entries in delivered.
+    RUDP_Checkpoint *checkpoint;  // Server: checkpoint offered to clients that announce a file (NULL if not checkpointing).
+    RUDP_Timer_Wheel *timers;     // The socket's own wheel, runs the timers below while the socket waits for datagrams.
+    bool timed_out;               // Set by a timer to end the current wait with ETIMEDOUT.
+    RUDP_Timer retransmit;        // Resends the pending control packet until it is answered.
+    RUDP_Packet pending;          // The control packet waiting for an answer.
+    size_t pending_size;          // Payload bytes of pending.
+    int retries;                  // Retransmissions of pending so far.
+    uint32_t base_rto_ms;         // Retransmission timeout of a first transmission, from the round trip time once known.
+    uint32_t rto_ms;              // Retransmission timeout of the pending control packet, doubled on every retransmission
+                                  // up to RTO_MAX_MS, and back to base_rto_ms for the next packet.
+    RUDP_Timer response;          // Client: bounds the wait for an answer from the server.
+    uint32_t chunks_received;     // Server: chunks received on the connection (wraps), reported by progress ACKs.
+    uint32_t unacked;             // Server: chunks received since the last progress ACK, which goes out once the queue runs dry.
+    uint64_t last_ack_ms;         // Server: tick the last progress ACK went out.
+    size_t progress_acks;         // Client: progress ACKs received while waiting for the completion ACK.
+    RUDP_Timer keepalive;         // Server: probes a quiet peer.
+    RUDP_Timer idle;              // Server: closes the connection once the peer has been quiet for idle_ms.
+    uint32_t idle_ms;             // Idle timeout, 0 to keep quiet connections open.
+    uint64_t last_heard_ms;       // Tick the last datagram arrived.
+    bool idle_closed;             // True if the connection was closed for being idle.
+    RUDP_Counters counters;       // Server: what the receive functions took in.
+    uint32_t connection_id;       // Random for a client, the accepted client's for a server. Chunks of other connections are dropped.
+} RUDP_Socket;
+
+// Reassembly state of one flow's share of a striped transfer.
+typedef struct
+{
+    char *buffer;            // Chunk i of the range lands at buffer + i * CHUNK_SIZE.
+    size_t size;             // Number of bytes expected in the range.
+    uint32_t first_sequence; // Sequence number of the first chunk of the range.
+    size_t received;         // Bytes received so far (duplicates are not counted).
+    uint8_t *chunk_map;      // One byte per chunk, set once the chunk arrived. A sender skips the chunks set here.
+    struct timeval start;    // Arrival time of the first chunk.
+    struct timeval end;      // Arrival time of the last chunk.
+    uint64_t digest;         // CRC-64 of the range, extended chunk by chunk as the range fills in order.
+    size_t digested;         // Number of leading chunks already folded into digest.
+    size_t next_index;       // Receiver: one past the highest chunk stored, chunks below it that are missing were overtaken.
+    double digest_ms;        // Time spent hashing.
+    Latency_Samples one_way;       // Receiver: kernel arrival time minus the sender's timestamp, per chunk.
+    Latency_Samples kernel_to_app; // Receiver: kernel arrival until rudp_receive_range() read the chunk.
+    Latency_Samples send_to_wire;  // Sender: sendto() call until the kernel's transmit timestamp.
+    size_t resumed;                // Bytes the receiver already had: skipped by the sender, found in the checkpoint by the receiver.
+    RUDP_Checkpoint *checkpoint;   // Receiver: the checkpoint that records the range's chunks too (NULL if none).
+    // Receiver: called with every run of chunks as soon as the range holds it in order, offset counted from the start
+    // of the range, e.g. to write the range out while the rest of it arrives. NULL if not needed.
+    void (*deliver)(void *arg, const char *data, size_t length, size_t offset);
+    void *deliver_arg;
+} RUDP_Range;
+
+/*
+* One of several streams multiplexed over a single connection, e.g. one file of a batch. The payload is whatever
+* buffer range describes. Every stream has its own sequence space, its chunks are numbered from 0, and its own
+* reassembly state: a stream is delivered and digested as soon as it is complete, whether the others are or not.
+* Chunks are not retransmitted, so a lost chunk still keeps its stream, and the transfer, from completing.
+*/
+typedef struct
+{
+    uint16_t id;        // Carried in the header of every chunk of the stream. Must be unique on the connection.
+    uint8_t priority;   // Sender: lower values are sent first, streams of equal priority share the connection round robin.
+    RUDP_Range range;   // The stream's payload and reassembly state. range.first_sequence places it in the file, for
+                        // the checkpoint, it is not sent.
+    size_t next_chunk;  // Sender: next chunk of the range to send.
+    bool complete;      // Receiver: the whole range arrived, range.end is when it was delivered.
+} RUDP_Stream;
+
+// Returns the internet checksum (RFC 1071) of bytes bytes of data: the ones' complement of the ones' complement sum
+// of its big endian 16 bit words, an odd last byte padded with a zero. The same on hosts of either byte order.
+unsigned short int calculate_checksum(const void *data, unsigned int bytes);
+
+// Writes the RUDP_HEADER_SIZE byte wire form of header to wire. The timestamp option is set if header->send_time is.
+void rudp_header_encode(const RUDP_Header *header, uint8_t *wire);
+
+/*
+* @brief Decodes the header of a size byte datagram. The send time trailer, if any, is left to the caller.
+* @return The options of the header, or -1 if the datagram is too short or of another version.
+*/
+int rudp_header_decode(const uint8_t *wire, size_t size, RUDP_Header *header);
+
+// Returns the time between start and end in milliseconds.
+double rudp_elapsed_ms(const struct timeval *start, const struct timeval *end);
+
+// Sockets and connections.
+RUDP_Socket *rudp_socket(bool isServer, unsigned short int listen_port);
+int rudp_connect(RUDP_Socket *sockfd, const char *dest_ip, unsigned short int dest_port);
+int rudp_accept(RUDP_Socket *sockfd);
+int rudp_resume(RUDP_Socket *sockfd, const char *dest_ip, unsigned short int dest_port);
+void rudp_forget_session(const char *dest_ip, unsigned short int dest_port);
+/*
+* @brief Keeps the ticket key and the session caches in dir, created if missing. Call it before the first socket.
+* Without it they go to $RUDP_STATE_DIR, else $XDG_STATE_HOME/rudp, else ~/.local/state/rudp.
+* @return 0 on success, -1 on error.
+*/
+int rudp_set_state_dir(const char *dir);
+int rudp_disconnect(RUDP_Socket *sockfd);
+int rudp_close(RUDP_Socket *sockfd);
+
+// Timers.
+uint64_t rudp_now_ms(void);
+void rudp_timer_start(RUDP_Timer_Wheel *wheel, RUDP_Timer *timer, uint32_t delay_ms, void (*callback)(RUDP_Timer *, void *), void *arg);
+void rudp_timer_cancel(RUDP_Timer_Wheel *wheel, RUDP_Timer *timer);
+void rudp_timers_run(RUDP_Timer_Wheel *wheel, uint64_t now);
+int64_t rudp_timers_next(RUDP_Timer_Wheel *wheel);
+void rudp_set_idle_timeout(RUDP_Socket *sockfd, uint32_t idle_ms);
+
+// Receive modes and measurements.
+int rudp_enable_timestamps(RUDP_Socket *sockfd);
+int rudp_enable_busy_poll(RUDP_Socket *sockfd, uint32_t budget_us);
+
+// Control packets and whole buffers.
+int rudp_send(RUDP_Socket *rudp_socket, uint8_t flags, char *data, size_t data_size);
+int rudp_receive(RUDP_Socket *rudp_socket, RUDP_Packet *packet);
+
+// Striped transfers.
+void rudp_stripe(size_t total, int flows, int index, size_t *offset, size_t *length);
+int rudp_range_init(RUDP_Range *range, char *buffer, size_t size, uint32_t first_sequence);
+void rudp_range_reset(RUDP_Range *range);
+void rudp_range_free(RUDP_Range *range);
+int rudp_send_range(RUDP_Socket *rudp_socket, RUDP_Range *range);
+int rudp_receive_range(RUDP_Socket *rudp_socket, RUDP_Range *range);
+
+// Multiplexed transfers, count streams over one connection.
+int rudp_send_streams(RUDP_Socket *rudp_socket, RUDP_Stream *streams, int count);
+int rudp_receive_streams(RUDP_Socket *rudp_socket, RUDP_Stream *streams, int count);
+
+// Resumable transfers.
+uint64_t rudp_file_id(const char *path);
+int rudp_checkpoint_open(RUDP_Checkpoint *checkpoint, const char *path, size_t size, bool spool_valid);
+void rudp_checkpoint_save(RUDP_Checkpoint *checkpoint);
+void rudp_checkpoint_clear(RUDP_Checkpoint *checkpoint);
+void rudp_checkpoint_close(RUDP_Checkpoint *checkpoint);
+void rudp_range_checkpoint(RUDP_Range *range, RUDP_Checkpoint *checkpoint);
+
+#endif
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE // fallocate(), sync_file_range()
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "writer.h"
+
+static double writer_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+int writer_open(const char *path, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open(2)");
+        return -1;
+    }
+    if (size > 0 && fallocate(fd, 0, 0, (off_t)size) < 0) {
+        // Some file systems cannot reserve space, the file is then only sized (sparse)
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            perror("fallocate(2)");
+            close(fd);
+            return -1;
+        }
+        if (ftruncate(fd, (off_t)size) < 0) {
+            perror("ftruncate(2)");
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/*
+* @brief Writes one batch of count blocks, size bytes from offset on, and throttles the writeback with WRITER_SYNC.
+* @return 0 on success, an errno value on error.
+*/
+static int writer_flush(Writer *writer, struct iovec *iov, int count, off_t offset, size_t size) {
+    double write_start = writer_now_ms();
+
+    for (size_t done = 0; done < size;) {
+        ssize_t n = pwritev(writer->fd, iov, count, offset + (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno;
+        done += n;
+        // A short write continues from the first block it did not finish
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    if (writer->flags & WRITER_SYNC) {
+        // Start writing this batch back, then wait for the previous one and drop it from the page cache
+        if (sync_file_range(writer->fd, offset, (off_t)size, SYNC_FILE_RANGE_WRITE) < 0)
+            return errno;
+        if (writer->synced_size > 0) {
+            if (sync_file_range(writer->fd, writer->synced_offset, (off_t)writer->synced_size,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+                return errno;
+            posix_fadvise(writer->fd, writer->synced_offset, (off_t)writer->synced_size, POSIX_FADV_DONTNEED);
+        }
+        writer->synced_offset = offset;
+        writer->synced_size = size;
+    }
+
+    writer->write_ms += writer_now_ms() - write_start;
+    writer->bytes += size;
+    writer->batches++;
+    return 0;
+}
+
+/*
+* @brief Finds a source with bytes to write: a block's worth, the rest of a source that is ready as a whole, or
+* anything once the writer is stopping. Called with the lock held.
+* @return The source's number, -1 if none has.
+*/
+static int writer_next_source(const Writer *writer) {
+    for (int i = 0; i < writer->source_count; i++) {
+        const Writer_Source *source = &writer->sources[i];
+        size_t pending = source->ready - source->written;
+        if (pending > 0 && (pending >= WRITER_BLOCK_SIZE || source->ready == source->size || writer->stopping))
+            return i;
+    }
+    return -1;
+}
+
+static void *writer_loop(void *arg) {
+    Writer *writer = (Writer *)arg;
+    struct iovec iov[WRITER_MAX_BLOCKS];
+
+    while (1) {
+        pthread_mutex_lock(&writer->lock);
+        int source = writer_next_source(writer);
+        if (!writer->stopping && writer->committed == writer->written && source < 0)
+            writer->writer_waits++;
+        while (!writer->stopping && writer->committed == writer->written && (source = writer_next_source(writer)) < 0)
+            pthread_cond_wait(&writer->not_empty, &writer->lock);
+        source = writer_next_source(writer);
+        uint64_t first = writer->written, last = writer->committed;
+        size_t from = source >= 0 ? writer->sources[source].written : 0;
+        size_t to = source >= 0 ? writer->sources[source].ready : 0;
+        pthread_mutex_unlock(&writer->lock);
+        if (first == last && source < 0)
+            break; // stopping, and everything is written
+
+        if (first == last) {
+            // A source is written straight from its buffer, everything it has ready at once
+            Writer_Source *ready = &writer->sources[source];
+            iov[0].iov_base = (char *)ready->data + from;
+            iov[0].iov_len = to - from;
+            int error = writer->error == 0 ? writer_flush(writer, iov, 1, ready->offset + (off_t)from, to - from) : 0;
+
+            pthread_mutex_lock(&writer->lock);
+            if (error != 0 && writer->error == 0)
+                writer->error = error;
+            ready->written = to;
+            pthread_mutex_unlock(&writer->lock);
+            continue;
+        }
+
+        // The committed blocks are left alone until they are marked written below. A batch is every committed
+        // block that continues the file where the one before it ends.
+        int count = 0;
+        off_t offset = writer->offsets[first % writer->blocks];
+        size_t size = 0;
+        for (uint64_t block = first; block < last; block++) {
+            int slot = (int)(block % writer->blocks);
+            if (writer->offsets[slot] != offset + (off_t)size)
+                break;
+            iov[count].iov_base = writer->ring + (size_t)slot * WRITER_BLOCK_SIZE;
+            iov[count].iov_len = writer->sizes[slot];
+            size += writer->sizes[slot];
+            count++;
+        }
+
+        // After a failed write the blocks are still taken off the ring, so the receiver never waits forever
+        int error = writer->error == 0 ? writer_flush(writer, iov, count, offset, size) : 0;
+
+        pthread_mutex_lock(&writer->lock);
+        if (error != 0 && writer->error == 0)
+            writer->error = error;
+        writer->written += count;
+        pthread_cond_signal(&writer->not_full);
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    if ((writer->flags & WRITER_SYNC) && writer->error == 0 && writer->synced_size > 0) {
+        double sync_start = writer_now_ms();
+        if (sync_file_range(writer->fd, writer->synced_offset, (off_t)writer->synced_size,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+            writer->error = errno;
+        else
+            posix_fadvise(writer->fd, writer->synced_offset, (off_t)writer->synced_size, POSIX_FADV_DONTNEED);
+        writer->write_ms += writer_now_ms() - sync_start;
+    }
+    return NULL;
+}
+
+int writer_init(Writer *writer, int blocks, Placement *placement) {
+    memset(writer, 0, sizeof(Writer));
+    writer->fd = -1;
+    writer->placement = placement;
+    writer->blocks = blocks < 0 ? 0 : blocks > WRITER_MAX_BLOCKS ? WRITER_MAX_BLOCKS : blocks;
+
+    if (writer->blocks > 0) {
+        writer->ring = (char *)placement_alloc(placement, (size_t)writer->blocks * WRITER_BLOCK_SIZE);
+        if (writer->ring == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+int writer_start(Writer *writer, int fd, int flags) {
+    // Everything but the ring starts over
+    char *ring = writer->ring;
+    int blocks = writer->blocks;
+    Placement *placement = writer->placement;
+    memset(writer, 0, sizeof(Writer));
+    writer->ring = ring;
+    writer->blocks = blocks;
+    writer->placement = placement;
+    writer->fd = fd;
+    writer->flags = flags;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->not_empty, NULL);
+    pthread_cond_init(&writer->not_full, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_loop, writer) != 0) {
+        perror("pthread_create(3)");
+        pthread_cond_destroy(&writer->not_full);
+        pthread_cond_destroy(&writer->not_empty);
+        pthread_mutex_destroy(&writer->lock);
+        return -1;
+    }
+    return 0;
+}
+
+char *writer_block(Writer *writer) {
+    pthread_mutex_lock(&writer->lock);
+    if (writer->committed - writer->written == (uint64_t)writer->blocks)
+        writer->receiver_waits++;
+    while (writer->committed - writer->written == (uint64_t)writer->blocks)
+        pthread_cond_wait(&writer->not_full, &writer->lock);
+    char *block = writer->ring + (size_t)(writer->committed % writer->blocks) * WRITER_BLOCK_SIZE;
+    pthread_mutex_unlock(&writer->lock);
+    return block;
+}
+
+void writer_commit(Writer *writer, size_t size, off_t offset) {
+    if (size == 0)
+        return;
+    pthread_mutex_lock(&writer->lock);
+    int slot = (int)(writer->committed % writer->blocks);
+    writer->sizes[slot] = size;
+    writer->offsets[slot] = offset;
+    writer->committed++;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+void writer_write(Writer *writer, const char *data, size_t size, off_t offset) {
+    if (writer->pending != NULL && writer->pending_offset + (off_t)writer->pending_size != offset) {
+        writer_commit(writer, writer->pending_size, writer->pending_offset);
+        writer->pending = NULL;
+    }
+    while (size > 0) {
+        if (writer->pending == NULL) {
+            writer->pending = writer_block(writer);
+            writer->pending_size = 0;
+            writer->pending_offset = offset;
+        }
+        size_t take = WRITER_BLOCK_SIZE - writer->pending_size < size ? WRITER_BLOCK_SIZE - writer->pending_size : size;
+        memcpy(writer->pending + writer->pending_size, data, take);
+        writer->pending_size += take;
+        data += take;
+        size -= take;
+        offset += (off_t)take;
+        if (writer->pending_size == WRITER_BLOCK_SIZE) {
+            writer_commit(writer, writer->pending_size, writer->pending_offset);
+            writer->pending = NULL;
+        }
+    }
+}
+
+int writer_source(Writer *writer, const char *data, size_t size, off_t offset) {
+    pthread_mutex_lock(&writer->lock);
+    int source = writer->source_count < WRITER_MAX_SOURCES ? writer->source_count++ : -1;
+    if (source >= 0) {
+        Writer_Source *added = &writer->sources[source];
+        added->data = data;
+        added->size = size;
+        added->offset = offset;
+        added->ready = 0;
+        added->written = 0;
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return source;
+}
+
+void writer_ready(Writer *writer, int source, size_t ready) {
+    pthread_mutex_lock(&writer->lock);
+    Writer_Source *updated = &writer->sources[source];
+    // A range that starts over (a restarted sender) hands over what it had again
+    if (ready > updated->ready)
+        updated->ready = ready;
+    // The writer only wakes up for a full block, or the end of the source
+    if (ready - updated->written >= WRITER_BLOCK_SIZE || ready == updated->size)
+        pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+int writer_stop(Writer *writer) {
+    if (writer->pending != NULL) {
+        writer_commit(writer, writer->pending_size, writer->pending_offset);
+        writer->pending = NULL;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->not_full);
+    pthread_cond_destroy(&writer->not_empty);
+    pthread_mutex_destroy(&writer->lock);
+    writer->source_count = 0;
+
+    if (writer->error != 0) {
+        errno = writer->error;
+        return -1;
+    }
+    return 0;
+}
+
+void writer_free(Writer *writer) {
+    placement_free(writer->placement, writer->ring, (size_t)writer->blocks * WRITER_BLOCK_SIZE);
+    writer->ring = NULL;
+}
+
+void writer_print_stats(FILE *out, const Writer *const *writers, int count) {
+    size_t bytes = 0;
+    double write_ms = 0;
+    uint64_t batches = 0, writer_waits = 0, receiver_waits = 0;
+
+    for (int i = 0; i < count; i++) {
+        bytes += writers[i]->bytes;
+        write_ms += writers[i]->write_ms;
+        batches += writers[i]->batches;
+        writer_waits += writers[i]->writer_waits;
+        receiver_waits += writers[i]->receiver_waits;
+    }
+    char ring[64];
+    if (count > 0 && writers[0]->blocks > 0)
+        snprintf(ring, sizeof(ring), "%d x %d KB blocks per writer", writers[0]->blocks, WRITER_BLOCK_SIZE / 1024);
+    else
+        snprintf(ring, sizeof(ring), "written in place from the receive buffers");
+    fprintf(out, "Disk writes: %zu bytes in %.2f ms (%llu pwritev() batches of %.0f KB on average%s, %s), waits for the disk: %llu, waits for the network: %llu\n",
+            bytes, write_ms, (unsigned long long)batches, batches > 0 ? bytes / 1024.0 / batches : 0,
+            count > 0 && (writers[0]->flags & WRITER_SYNC) ? ", sync_file_range() throttled" : "", ring,
+            (unsigned long long)receiver_waits, (unsigned long long)writer_waits);
+}
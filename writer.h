@@ -0,0 +1,128 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "placement.h"
+
+/*
+* Socket-to-disk pipeline, the receiving side of reader.h. The receiving thread fills the blocks of a ring and
+* commits them with their file offsets, a writer thread writes the committed blocks out, as many file-contiguous
+* blocks at once as there are with one pwritev(). The receiver only waits for the disk while every block of the
+* ring is committed, so the ring bounds the memory a transfer holds and a slow disk slows the network loop down
+* only once it falls a whole ring behind.
+* A receiver that already holds the data in a buffer of its own registers that buffer as a source instead, and
+* only tells the writer how much of it is ready: the writer writes it in place, nothing is copied and the receiver
+* never waits for the disk.
+*/
+
+#define WRITER_BLOCK_SIZE (256 * 1024) // Bytes per block, a multiple of the page size and of every chunk size.
+#define WRITER_BLOCKS 4                // Default number of blocks in a ring.
+#define WRITER_MAX_BLOCKS 64
+#define WRITER_MAX_SOURCES 64          // Buffers a writer can write from in place, see writer_source().
+
+// writer_start() flags.
+#define WRITER_SYNC 1 // Start writeback of every batch with sync_file_range() and wait for the one before it, so
+                      // the dirty page cache a transfer leaves behind stays around two batches.
+
+typedef struct {
+    const char *data;                  // The buffer, written in place.
+    size_t size;                       // Bytes of the buffer.
+    off_t offset;                      // File offset of the buffer.
+    size_t ready;                      // Leading bytes handed over with writer_ready().
+    size_t written;                    // Leading bytes written (or dropped after an error).
+} Writer_Source;
+
+typedef struct {
+    int fd;
+    int flags;
+    int blocks;                        // Blocks in the ring, 0 for a writer that only writes sources.
+    char *ring;                        // The blocks, page aligned (NULL without blocks).
+    Placement *placement;              // Where the ring was allocated, NULL for plain pages.
+    size_t sizes[WRITER_MAX_BLOCKS];   // Bytes committed in each block.
+    off_t offsets[WRITER_MAX_BLOCKS];  // File offset of each block.
+    Writer_Source sources[WRITER_MAX_SOURCES];
+    int source_count;
+    uint64_t committed;                // Blocks committed so far.
+    uint64_t written;                  // Blocks written (or dropped after an error) so far.
+    int error;                         // errno of the first failed write, 0 if none.
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;          // Signaled when a block is committed, and on stop.
+    pthread_cond_t not_full;           // Signaled when blocks are written.
+    char *pending;                     // writer_write(): the block being filled, NULL if none.
+    size_t pending_size;
+    off_t pending_offset;
+    off_t synced_offset;               // WRITER_SYNC: the previous batch, whose writeback is waited for next.
+    size_t synced_size;
+    size_t bytes;                      // Bytes written.
+    double write_ms;                   // Time spent in pwritev() and sync_file_range().
+    uint64_t batches;                  // pwritev() calls.
+    uint64_t writer_waits;             // Times the writer found the ring empty: the network is the bottleneck.
+    uint64_t receiver_waits;           // Times the receiver found the ring full: the disk is the bottleneck.
+} Writer;
+
+/*
+* @brief Creates (or truncates) the file at path and reserves size bytes for it with fallocate(), so the
+* transfer neither runs out of space half way nor fragments the file. File systems without fallocate() get a
+* sparse file of the same size.
+* @return The file descriptor, -1 on error.
+*/
+int writer_open(const char *path, size_t size);
+
+/*
+* @brief Allocates a ring of blocks WRITER_BLOCK_SIZE bytes each, as placement asks (NULL for plain pages). blocks
+* may be 0 for a writer that only writes sources. The ring serves every writer_start() until writer_free(), so a
+* transfer of many files allocates it once.
+* @return 0 on success, -1 on error.
+*/
+int writer_init(Writer *writer, int blocks, Placement *placement);
+
+/*
+* @brief Starts a thread writing to fd from the ring and from the sources registered later. The statistics start
+* over. Several writers may share a descriptor as long as they write different parts of the file.
+* @return 0 on success, -1 on error.
+*/
+int writer_start(Writer *writer, int fd, int flags);
+
+// Waits for a free block, WRITER_BLOCK_SIZE bytes to fill and hand to writer_commit().
+char *writer_block(Writer *writer);
+
+// Queues the first size bytes of the block returned by writer_block() to be written at offset.
+void writer_commit(Writer *writer, size_t size, off_t offset);
+
+// Copies size bytes to be written at offset into the ring. Contiguous writes share blocks, a block is committed
+// once it is full or the next write does not continue it.
+void writer_write(Writer *writer, const char *data, size_t size, off_t offset);
+
+/*
+* @brief Registers the size bytes at data as a source, to be written at offset in place once writer_ready() hands
+* them over. The buffer must stay as it is until writer_stop().
+* @return The source's number for writer_ready(), -1 if the writer already has WRITER_MAX_SOURCES.
+*/
+int writer_source(Writer *writer, const char *data, size_t size, off_t offset);
+
+// Hands the first ready bytes of a source over to be written. Never waits, the data stays in the source's buffer:
+// the writer takes it a block at a time, and the rest once the whole source is ready.
+void writer_ready(Writer *writer, int source, size_t ready);
+
+/*
+* @brief Commits what writer_write() left in its block, waits until everything (including whatever the sources
+* have ready) is written and stops the thread. The sources are forgotten, the ring stays for the next
+* writer_start(). The descriptor stays open and the statistics stay in the structure.
+* @return 0 on success, -1 with errno set if a write failed.
+*/
+int writer_stop(Writer *writer);
+
+// Frees the ring of writer_init().
+void writer_free(Writer *writer);
+
+// Prints the combined statistics of count writers: time spent writing, batching and which side waited.
+void writer_print_stats(FILE *out, const Writer *const *writers, int count);
+
+#endif